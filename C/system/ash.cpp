@@ -2,25 +2,284 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
 #include <memory>
-#include <sstream>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <climits>
 #include <filesystem>
 #include <fstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "lib/fuzzylib.hpp"
+#include "lib/fuzzyCommands.hpp"
+#include "lib/commandInterpreter.hpp"
+#include "lib/scriptCache.hpp"
+#include "lib/jobControl.hpp"
+#include "lib/completion.hpp"
+#include "lib/perfCounters.hpp"
+#include "lib/globEngine.hpp"
 
 #define MAX_ARGS 64
 #define MAX_LINE 1024
 #define MAX_PATH 256
 #define HISTORY_FILE ".ash_history"
+#define PROMPT "# "
 
-std::map<std::string, std::string> aliases;
+// posix_spawn can hand the terminal to the child itself from glibc 2.35
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 35)
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+#endif
+
+extern char** environ;
+
+Ash::AliasTable aliases;
 char current_dir[MAX_PATH];
 
+// Exit status of the last foreground pipeline ($?) and of each of its
+// stages ($PIPESTATUS)
+int last_status = 0;
+std::vector<int> pipe_status;
+
+// Set by the exit builtin; stops the current list and the read loop
+bool exit_requested = false;
+
+// Set by `ash -c` when its command is a single external command, which
+// then replaces the shell instead of being spawned. The first pipeline
+// run consumes it, so nothing nested (eval, subshells, command
+// substitutions) can exec over the shell.
+bool exec_in_place = false;
+
+// $0 and the positional parameters $1..$n of a script or `ash -c`
+std::string script_name = "ash";
+std::vector<std::string> positional;
+
+// Job control is on in an interactive shell whose stdin is a terminal:
+// every job gets its own process group and the foreground one owns the
+// terminal
+Ash::JobTable jobs;
+bool job_control = false;
+pid_t shell_pgid = 0;
+struct termios shell_tmodes;
+pid_t last_background = 0;
+
+// fuzzylib commands run inside the shell instead of exec'ing a binary
+FuzzyBox::FuzzyShell fuzzy;
+
+// Command location cache, like bash's `hash`. A hit remembers the index of
+// the PATH directory it was found in; it is only trusted while PATH is the
+// same string and neither that directory nor any directory searched before
+// it has changed mtime (a new binary earlier in PATH would shadow it).
+class CommandHash {
+private:
+    struct Entry {
+        std::string path;
+        size_t dir_index;
+        unsigned hits;
+    };
+
+    struct PathDir {
+        std::string dir;
+        struct timespec mtime;
+    };
+
+    std::string path_value;
+    bool loaded = false;
+    std::vector<PathDir> dirs;
+    std::unordered_map<std::string, Entry> table;
+
+    static struct timespec dir_mtime(const std::string& dir) {
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0) return {0, 0};
+        return st.st_mtim;
+    }
+
+    void reload_path() {
+        const char* env = getenv("PATH");
+        std::string value = env ? env : "/bin:/usr/bin";
+        if (loaded && value == path_value) return;
+
+        path_value = value;
+        loaded = true;
+        dirs.clear();
+        table.clear();
+
+        size_t start = 0;
+        while (start <= path_value.size()) {
+            size_t end = path_value.find(':', start);
+            if (end == std::string::npos) end = path_value.size();
+            std::string dir = path_value.substr(start, end - start);
+            if (dir.empty()) dir = ".";
+            dirs.push_back({dir, dir_mtime(dir)});
+            start = end + 1;
+        }
+    }
+
+    // Re-stat directories [0, upto] and drop every entry found at or after
+    // the first one that changed. Returns false if anything was dropped.
+    bool validate(size_t upto) {
+        for (size_t i = 0; i <= upto && i < dirs.size(); i++) {
+            struct timespec now = dir_mtime(dirs[i].dir);
+            if (now.tv_sec != dirs[i].mtime.tv_sec || now.tv_nsec != dirs[i].mtime.tv_nsec) {
+                for (size_t j = i; j < dirs.size(); j++) {
+                    dirs[j].mtime = dir_mtime(dirs[j].dir);
+                }
+                for (auto it = table.begin(); it != table.end();) {
+                    if (it->second.dir_index >= i) it = table.erase(it);
+                    else ++it;
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const Entry* search(const std::string& name) {
+        for (size_t i = 0; i < dirs.size(); i++) {
+            std::string candidate = dirs[i].dir + "/" + name;
+            struct stat st;
+            if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+                access(candidate.c_str(), X_OK) == 0) {
+                auto& entry = table[name];
+                entry = {candidate, i, 0};
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    // Resolve a command name to an executable path, or "" if not found.
+    std::string lookup(const std::string& name) {
+        if (name.find('/') != std::string::npos) return name;
+
+        reload_path();
+        auto it = table.find(name);
+        if (it != table.end() && validate(it->second.dir_index)) {
+            it->second.hits++;
+            return it->second.path;
+        }
+
+        const Entry* entry = search(name);
+        if (!entry) return "";
+        table[name].hits++;
+        return entry->path;
+    }
+
+    bool remember(const std::string& name) {
+        reload_path();
+        return name.find('/') != std::string::npos || search(name) != nullptr;
+    }
+
+    void clear() {
+        table.clear();
+    }
+
+    void print() const {
+        if (table.empty()) {
+            printf("hash: hash table empty\n");
+            return;
+        }
+        printf("hits\tcommand\n");
+        for (const auto& pair : table) {
+            printf("%4u\t%s\n", pair.second.hits, pair.second.path.c_str());
+        }
+    }
+};
+
+CommandHash command_hash;
+Ash::CompletionEngine completion;
+
+// Directory listings are shared by all the globs of one pipeline
+Ash::GlobEngine glob_engine;
+
+static const char* const builtin_names[] = {
+    "exit", "cd", "alias", "hash", "jobs", "fg", "bg", "wait", "parallel",
+};
+
+void register_commands() {
+    // Commands served in-process by fuzzylib
+    for (const auto& entry : FuzzyBox::command_list) {
+        fuzzy.registerCommand(std::string(entry.name), entry.make());
+    }
+}
+
+static std::vector<std::string> completion_matches;
+
+static char* completion_generator(const char*, int state) {
+    static size_t next;
+    if (state == 0) next = 0;
+    return next < completion_matches.size() ? strdup(completion_matches[next++].c_str()) : nullptr;
+}
+
+// Command names in command position, paths everywhere else
+static char** complete_line(const char* text, int start, int) {
+    rl_attempted_completion_over = 1;
+    completion_matches.clear();
+    
+    int i = start - 1;
+    while (i >= 0 && isspace(static_cast<unsigned char>(rl_line_buffer[i]))) i--;
+    bool command_position = i < 0 || strchr("|&;(", rl_line_buffer[i]) != nullptr;
+    
+    if (command_position && !strchr(text, '/')) {
+        completion.commands(text, completion_matches);
+        size_t len = strlen(text);
+        for (const auto& alias : aliases) {
+            if (alias.first.compare(0, len, text) == 0) completion_matches.push_back(alias.first);
+        }
+        std::sort(completion_matches.begin(), completion_matches.end());
+        completion_matches.erase(std::unique(completion_matches.begin(), completion_matches.end()),
+                                 completion_matches.end());
+    } else {
+        completion.files(text, completion_matches);
+        rl_filename_completion_desired = 1;
+        // Directories already end in '/'; let the user keep typing into them
+        if (completion_matches.size() == 1 && completion_matches[0].back() == '/') {
+            rl_completion_append_character = '\0';
+        }
+    }
+    return rl_completion_matches(text, completion_generator);
+}
+
+// Put the shell in its own process group in the foreground of its terminal
+static void initialize_job_control() {
+    if (!isatty(STDIN_FILENO)) return;
+    
+    // Started in the background: wait until we are brought to the foreground
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+    
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+    
+    setpgid(0, 0);
+    shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+    job_control = true;
+}
+
 void initialize_shell() {
+    initialize_job_control();
     using_history();
     read_history(HISTORY_FILE);
     
@@ -29,36 +288,603 @@ void initialize_shell() {
     aliases["cls"] = "clear";
     
     // Initialize readline
+    for (const char* name : builtin_names) completion.add_static(name);
+    for (const auto& name : fuzzy.commandNames()) completion.add_static(name);
+    completion.add_static("perfstat");
+    rl_attempted_completion_function = complete_line;
     rl_bind_key('\t', rl_complete);
 }
 
-std::vector<std::string> tokenize(const std::string& line) {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(line);
+// Value of a parameter for $name / ${name}. Returns false if it is unset.
+static bool parameter_value(std::string_view name, std::string& out) {
+    if (name == "?") {
+        out = std::to_string(last_status);
+        return true;
+    }
+    if (name == "$") {
+        out = std::to_string(getpid());
+        return true;
+    }
+    if (name == "!") {
+        if (last_background <= 0) return false;
+        out = std::to_string(last_background);
+        return true;
+    }
+    if (name == "#") {
+        out = std::to_string(positional.size());
+        return true;
+    }
+    if (name == "@" || name == "*") {
+        out.clear();
+        for (size_t i = 0; i < positional.size(); i++) {
+            if (i > 0) out += ' ';
+            out += positional[i];
+        }
+        return true;
+    }
+    if (!name.empty() && isdigit(static_cast<unsigned char>(name[0]))) {
+        size_t n = 0;
+        for (char c : name) {
+            if (!isdigit(static_cast<unsigned char>(c))) return false;
+            n = n * 10 + (c - '0');
+        }
+        if (n == 0) {
+            out = script_name;
+            return true;
+        }
+        if (n > positional.size()) return false;
+        out = positional[n - 1];
+        return true;
+    }
+    if (name == "PIPESTATUS") {
+        out.clear();
+        for (size_t i = 0; i < pipe_status.size(); i++) {
+            if (i > 0) out += ' ';
+            out += std::to_string(pipe_status[i]);
+        }
+        return true;
+    }
+    
+    char key[MAX_LINE];
+    if (name.empty() || name.size() >= sizeof(key)) return false;
+    memcpy(key, name.data(), name.size());
+    key[name.size()] = '\0';
+    const char* env_val = getenv(key);
+    if (!env_val) return false;
+    out = env_val;
+    return true;
+}
+
+static bool is_name_char(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+int execute_list(const Ash::List* list);
+static pid_t fork_job_process(pid_t pgid, bool foreground);
+
+// Run `commands` in a forked copy of the shell and capture its stdout,
+// minus trailing newlines, in `out`. The output is read straight into the
+// string's storage, which grows geometrically, so large outputs cost one
+// copy per doubling rather than one per read.
+static void command_substitution(std::string_view commands, std::string& out) {
+    out.clear();
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("ash: pipe");
+        last_status = 1;
+        return;
+    }
+    
+    pid_t pid = fork_job_process(-1, false);
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        Ash::Arena arena;
+        Ash::Parser parser(arena, &aliases);
+        Ash::List* program = nullptr;
+        if (parser.parse(commands, true, program) != Ash::ParseStatus::Ok) {
+            fprintf(stderr, "ash: %s\n", parser.error());
+            _exit(2);
+        }
+        int status = execute_list(program);
+        std::cout.flush();
+        fflush(nullptr);
+        _exit(status);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        perror("ash: fork");
+        close(fds[0]);
+        last_status = 1;
+        return;
+    }
+    
+    size_t len = 0;
+    while (true) {
+        if (out.size() - len < 4096) out.resize(std::max<size_t>(out.size() * 2, 65536));
+        ssize_t n = read(fds[0], &out[len], out.size() - len);
+        if (n > 0) {
+            len += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    close(fds[0]);
+    while (len > 0 && out[len - 1] == '\n') len--;
+    out.resize(len);
     
-    while (std::getline(tokenStream, token, ' ')) {
-        if (!token.empty()) {
-            // Handle environment variables
-            if (token[0] == '$') {
-                const char* env_val = getenv(token.substr(1).c_str());
-                if (env_val) token = env_val;
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0) {
+        if (errno != EINTR) return;
+    }
+    last_status = Ash::wait_status_code(wstatus);
+}
+
+// Expand the `...` substitution starting at word[i]. Inside backquotes a
+// backslash only quotes $, ` and \.
+static size_t expand_backquote(std::string_view word, size_t i, std::string& out) {
+    size_t end = Ash::scan_backquote(word, i);
+    if (end == std::string_view::npos) end = word.size() + 1;
+    std::string commands;
+    for (size_t j = i + 1; j + 1 < end; j++) {
+        if (word[j] == '\\' && j + 2 < end && strchr("$`\\", word[j + 1])) j++;
+        commands += word[j];
+    }
+    command_substitution(commands, out);
+    return std::min(end, word.size());
+}
+
+// Expand the parameter reference starting at word[i] == '$'. Stores the
+// value in `out` and returns the index just past the reference; a '$' that
+// starts no reference expands to itself.
+static size_t expand_parameter(std::string_view word, size_t i, std::string& out) {
+    size_t start = i + 1;
+    out.clear();
+    if (start >= word.size()) {
+        out = "$";
+        return start;
+    }
+    
+    char c = word[start];
+    if (c == '(') {
+        size_t end = Ash::scan_substitution(word, i);
+        if (end == std::string_view::npos) end = word.size() + 1;
+        command_substitution(word.substr(start + 1, end - start - 2), out);
+        return std::min(end, word.size());
+    }
+    if (c == '{') {
+        size_t close = word.find('}', start);
+        if (close == std::string_view::npos) close = word.size();
+        parameter_value(word.substr(start + 1, close - start - 1), out);
+        return close + 1;
+    }
+    if (strchr("?$!#@*", c) || isdigit(static_cast<unsigned char>(c))) {
+        parameter_value(word.substr(start, 1), out);
+        return start + 1;
+    }
+    
+    size_t end = start;
+    while (end < word.size() && is_name_char(word[end])) end++;
+    if (end == start) {
+        out = "$";
+        return start;
+    }
+    parameter_value(word.substr(start, end - start), out);
+    return end;
+}
+
+// A field being built by expand_word(). `pattern` holds the same text with
+// quoted characters backslash-escaped, for pathname expansion.
+struct FieldBuilder {
+    std::string text;
+    std::string pattern;
+    bool started = false;
+    
+    void quoted(char c) {
+        text += c;
+        if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\') pattern += '\\';
+        pattern += c;
+        started = true;
+    }
+    
+    void quoted(std::string_view s) {
+        for (char c : s) quoted(c);
+    }
+    
+    void unquoted(char c) {
+        text += c;
+        pattern += c;
+        started = true;
+    }
+};
+
+// Finish a field: replace it with the paths it matches, if it is a
+// pattern that matches anything
+static void emit_field(FieldBuilder& field, std::vector<std::string>& fields, bool patterns) {
+    if (!patterns || !Ash::GlobEngine::is_pattern(field.pattern) ||
+        !glob_engine.expand(field.pattern, fields)) {
+        fields.push_back(std::move(field.text));
+    }
+    field.text.clear();
+    field.pattern.clear();
+    field.started = false;
+}
+
+// Tilde, parameters, command substitution, field splitting, pathname
+// expansion and quote removal for one brace-expanded word
+static void expand_fields(std::string_view word, std::vector<std::string>& fields, bool patterns) {
+    FieldBuilder field;
+    std::string value;
+    bool empty_at = false;
+    size_t i = 0;
+    
+    if (word[0] == '~' && (word.size() == 1 || word[1] == '/')) {
+        const char* home = getenv("HOME");
+        field.quoted(home ? home : "~");
+        i = 1;
+    }
+    
+    while (i < word.size()) {
+        char c = word[i];
+        if (c == '\\') {
+            if (i + 1 < word.size() && word[i + 1] != '\n') field.quoted(word[i + 1]);
+            field.started = true;
+            i += 2;
+        } else if (c == '\'') {
+            size_t close = word.find('\'', i + 1);
+            field.quoted(word.substr(i + 1, close - i - 1));
+            field.started = true;
+            i = close + 1;
+        } else if (c == '"') {
+            field.started = true;
+            i++;
+            while (i < word.size() && word[i] != '"') {
+                if (word[i] == '\\' && i + 1 < word.size() && strchr("$`\"\\\n", word[i + 1])) {
+                    if (word[i + 1] != '\n') field.quoted(word[i + 1]);
+                    i += 2;
+                } else if (word[i] == '$' && i + 1 < word.size() && word[i + 1] == '@') {
+                    // "$@": one field per positional parameter
+                    for (size_t n = 0; n < positional.size(); n++) {
+                        if (n > 0) emit_field(field, fields, patterns);
+                        field.quoted(positional[n]);
+                    }
+                    empty_at = empty_at || positional.empty();
+                    i += 2;
+                } else if (word[i] == '$') {
+                    i = expand_parameter(word, i, value);
+                    field.quoted(value);
+                } else if (word[i] == '`') {
+                    i = expand_backquote(word, i, value);
+                    field.quoted(value);
+                } else {
+                    field.quoted(word[i++]);
+                }
             }
-            tokens.push_back(token);
+            i++;
+        } else if (c == '$' || c == '`') {
+            i = c == '$' ? expand_parameter(word, i, value) : expand_backquote(word, i, value);
+            for (char v : value) {
+                if (v == ' ' || v == '\t' || v == '\n') {
+                    if (field.started) emit_field(field, fields, patterns);
+                } else {
+                    field.unquoted(v);
+                }
+            }
+        } else {
+            field.unquoted(c);
+            i++;
+        }
+    }
+    
+    if (field.started && !(empty_at && field.text.empty())) emit_field(field, fields, patterns);
+}
+
+// Word expansion. Brace expansion comes first and can turn one word into
+// several; each is then expanded by expand_fields() and the results are
+// appended to `fields`. With `patterns` off (here-strings) braces and
+// globs are left as written.
+static void expand_word(std::string_view word, std::vector<std::string>& fields, bool patterns = true) {
+    if (patterns && Ash::BraceExpander::has_braces(word)) {
+        std::vector<std::string> words;
+        Ash::BraceExpander::expand(word, words);
+        for (const auto& w : words) {
+            if (!w.empty()) expand_fields(w, fields, patterns);
+        }
+        return;
+    }
+    expand_fields(word, fields, patterns);
+}
+
+// Here-document bodies get parameter expansion and command substitution
+// unless the delimiter was quoted; <<- strips leading tabs from every line
+static std::string expand_heredoc(const Ash::Redirect* r) {
+    std::string body;
+    std::string value;
+    std::string_view text = r->target;
+    bool line_start = true;
+    
+    for (size_t i = 0; i < text.size();) {
+        char c = text[i];
+        if (line_start && r->strip_tabs && c == '\t') {
+            i++;
+            continue;
+        }
+        line_start = c == '\n';
+        
+        if (r->quoted) {
+            body += c;
+            i++;
+        } else if (c == '\\' && i + 1 < text.size() && strchr("$`\\\n", text[i + 1])) {
+            if (text[i + 1] != '\n') body += text[i + 1];
+            i += 2;
+        } else if (c == '$') {
+            i = expand_parameter(text, i, value);
+            body += value;
+        } else if (c == '`') {
+            i = expand_backquote(text, i, value);
+            body += value;
+        } else {
+            body += c;
+            i++;
+        }
+    }
+    return body;
+}
+
+// A redirection resolved in the shell: make `target` a copy of `source`, or
+// close it when `source` is negative
+struct FdAction {
+    int target;
+    int source;
+};
+
+// Keep shell-side fds clear of the low numbers commands redirect onto
+static int move_fd_high(int fd) {
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    close(fd);
+    return high;
+}
+
+static bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Here-documents and here-strings are served from an anonymous memfd:
+// no size limit as with a pipe and nothing written to a filesystem
+static int heredoc_fd(const std::string& body) {
+    int fd = memfd_create("ash-heredoc", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    if (!write_all(fd, body.data(), body.size()) || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Open the files and here-documents of a command's redirections in the
+// shell. Opened fds are close-on-exec, numbered 10 and up, and appended to
+// `opened` for the caller to close once the command has started.
+static bool prepare_redirects(const Ash::Redirect* r, std::vector<FdAction>& actions,
+                              std::vector<int>& opened) {
+    std::vector<std::string> fields;
+    
+    for (; r; r = r->next) {
+        fields.clear();
+        if (r->op == Ash::RedirOp::HereDoc || r->op == Ash::RedirOp::HereString) {
+            std::string body;
+            if (r->op == Ash::RedirOp::HereDoc) {
+                body = expand_heredoc(r);
+            } else {
+                expand_word(r->target, fields, false);
+                for (size_t i = 0; i < fields.size(); i++) {
+                    if (i > 0) body += ' ';
+                    body += fields[i];
+                }
+                body += '\n';
+            }
+            int fd = heredoc_fd(body);
+            if (fd < 0) {
+                perror("ash: here-document");
+                return false;
+            }
+            fd = move_fd_high(fd);
+            opened.push_back(fd);
+            actions.push_back({r->fd, fd});
+            continue;
         }
+        
+        expand_word(r->target, fields);
+        if (fields.size() != 1) {
+            fprintf(stderr, "ash: %.*s: ambiguous redirect\n",
+                    static_cast<int>(r->target.size()), r->target.data());
+            return false;
+        }
+        const std::string& target = fields[0];
+        
+        if (r->op == Ash::RedirOp::DupIn || r->op == Ash::RedirOp::DupOut) {
+            if (target == "-") {
+                actions.push_back({r->fd, -1});
+            } else if (!target.empty() && target.find_first_not_of("0123456789") == std::string::npos) {
+                actions.push_back({r->fd, atoi(target.c_str())});
+            } else {
+                fprintf(stderr, "ash: %s: bad file descriptor\n", target.c_str());
+                return false;
+            }
+            continue;
+        }
+        
+        int flags = O_CLOEXEC;
+        switch (r->op) {
+            case Ash::RedirOp::In: flags |= O_RDONLY; break;
+            case Ash::RedirOp::Out: flags |= O_WRONLY | O_CREAT | O_TRUNC; break;
+            case Ash::RedirOp::Append: flags |= O_WRONLY | O_CREAT | O_APPEND; break;
+            default: flags |= O_RDWR | O_CREAT; break;
+        }
+        int fd = open(target.c_str(), flags, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "ash: %s: %s\n", target.c_str(), strerror(errno));
+            return false;
+        }
+        fd = move_fd_high(fd);
+        opened.push_back(fd);
+        actions.push_back({r->fd, fd});
+    }
+    return true;
+}
+
+static bool apply_fd_actions(const std::vector<FdAction>& actions) {
+    for (const auto& action : actions) {
+        if (action.source < 0) {
+            close(action.target);
+        } else if (action.source != action.target && dup2(action.source, action.target) < 0) {
+            fprintf(stderr, "ash: %d: %s\n", action.source, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void close_fds(const std::vector<int>& fds) {
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+// Builtins that run in the shell redirect the shell's own fds; remember
+// what was there so it can be put back
+struct SavedFd {
+    int target;
+    int saved;
+};
+
+static std::vector<SavedFd> redirect_shell(const std::vector<FdAction>& actions, bool& ok) {
+    std::vector<SavedFd> saved;
+    for (const auto& action : actions) {
+        bool seen = false;
+        for (const auto& s : saved) seen = seen || s.target == action.target;
+        if (!seen) saved.push_back({action.target, fcntl(action.target, F_DUPFD_CLOEXEC, 10)});
+    }
+    ok = apply_fd_actions(actions);
+    return saved;
+}
+
+static void restore_shell(const std::vector<SavedFd>& saved) {
+    std::cout.flush();
+    fflush(nullptr);
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (it->saved >= 0) {
+            dup2(it->saved, it->target);
+            close(it->saved);
+        } else {
+            close(it->target);
+        }
+    }
+    // A write to a closed or full fd leaves the stream failed
+    std::cout.clear();
+    std::cerr.clear();
+}
+
+// Give the terminal back to the shell after a foreground job finished or
+// stopped, keeping the job's terminal modes for a later `fg`
+static void reclaim_terminal(Ash::Job& job) {
+    if (!job_control) return;
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    if (job.state() == Ash::Job::State::Stopped) {
+        job.has_tmodes = tcgetattr(STDIN_FILENO, &job.tmodes) == 0;
     }
-    return tokens;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
 }
 
-bool handle_builtin(const std::vector<std::string>& args) {
+// Wait for a foreground job to finish or stop, then set $? and PIPESTATUS
+// from it. A stopped job stays in the table as a background job; a
+// finished one is dropped, after its processes are copied to `finished`
+// (when given).
+static int wait_for_job(Ash::Job& job, std::vector<Ash::JobProcess>* finished = nullptr) {
+    while (job.state() == Ash::Job::State::Running) {
+        if (!jobs.wait_any()) {
+            // No children left to wait for: nothing more will change
+            for (auto& p : job.procs) {
+                if (!p.exited && !p.stopped) {
+                    p.exited = true;
+                    p.status = 1;
+                }
+            }
+        }
+    }
+    reclaim_terminal(job);
+    
+    pipe_status.clear();
+    for (const auto& p : job.procs) {
+        pipe_status.push_back(p.status);
+    }
+    last_status = job.status();
+    
+    if (job.state() == Ash::Job::State::Stopped) {
+        job.background = true;
+        job.notified = true;
+        printf("\n");
+        jobs.print(stdout, job);
+    } else {
+        if (finished) *finished = job.procs;
+        jobs.remove(job);
+    }
+    return last_status;
+}
+
+static Ash::Job* find_job(const char* builtin, const std::vector<std::string>& args) {
+    std::string spec = args.size() > 1 ? args[1] : "";
+    Ash::Job* job = jobs.find(spec);
+    if (!job) {
+        fprintf(stderr, "%s: %s: no such job\n", builtin, spec.empty() ? "current" : spec.c_str());
+    }
+    return job;
+}
+
+static void continue_job(Ash::Job& job) {
+    for (auto& p : job.procs) {
+        p.stopped = false;
+    }
+    killpg(job.pgid, SIGCONT);
+}
+
+static bool is_builtin(const std::string& name) {
+    for (const char* builtin : builtin_names) {
+        if (name == builtin) return true;
+    }
+    return false;
+}
+
+static int run_parallel(const std::vector<std::string>& args);
+
+// Run a shell builtin in the shell process. Returns false if args[0] is not
+// a builtin; otherwise stores its exit status in `status`.
+bool handle_builtin(const std::vector<std::string>& args, int& status) {
+    status = 0;
     if (args.empty()) return true;
     
-    if (args[0] == "exit") return false;
+    if (args[0] == "exit") {
+        status = args.size() > 1 ? atoi(args[1].c_str()) : last_status;
+        exit_requested = true;
+        return true;
+    }
     
     if (args[0] == "cd") {
         const char* dir = args.size() > 1 ? args[1].c_str() : getenv("HOME");
         if (chdir(dir) != 0) {
             perror("cd");
+            status = 1;
         }
         return true;
     }
@@ -70,6 +896,111 @@ bool handle_builtin(const std::vector<std::string>& args) {
             }
         } else if (args.size() == 3) {
             aliases[args[1]] = args[2];
+        } else {
+            for (size_t i = 1; i < args.size(); i++) {
+                size_t eq = args[i].find('=');
+                if (eq != std::string::npos) {
+                    aliases[args[i].substr(0, eq)] = args[i].substr(eq + 1);
+                } else if (aliases.count(args[i])) {
+                    printf("%s='%s'\n", args[i].c_str(), aliases[args[i]].c_str());
+                } else {
+                    fprintf(stderr, "alias: %s: not found\n", args[i].c_str());
+                    status = 1;
+                }
+            }
+        }
+        return true;
+    }
+    
+    if (args[0] == "jobs") {
+        jobs.reap();
+        jobs.list(stdout);
+        return true;
+    }
+    
+    if (args[0] == "fg" || args[0] == "bg") {
+        const char* name = args[0].c_str();
+        if (!job_control) {
+            fprintf(stderr, "%s: no job control\n", name);
+            status = 1;
+            return true;
+        }
+        Ash::Job* job = find_job(name, args);
+        if (!job || job->state() == Ash::Job::State::Done) {
+            if (job) fprintf(stderr, "%s: job has terminated\n", name);
+            status = 1;
+            return true;
+        }
+        
+        if (args[0] == "bg") {
+            continue_job(*job);
+            job->background = true;
+            printf("[%d] %s &\n", job->id, job->command.c_str());
+            return true;
+        }
+        
+        printf("%s\n", job->command.c_str());
+        fflush(stdout);
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+        if (job->has_tmodes) tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+        job->background = false;
+        continue_job(*job);
+        status = wait_for_job(*job);
+        return true;
+    }
+    
+    if (args[0] == "wait") {
+        if (args.size() == 1) {
+            for (Ash::Job* job : jobs.background_jobs()) {
+                while (job->state() == Ash::Job::State::Running && jobs.wait_any()) {}
+                if (job->state() == Ash::Job::State::Done) jobs.remove(*job);
+            }
+            return true;
+        }
+        for (size_t i = 1; i < args.size(); i++) {
+            Ash::Job* job = jobs.find(args[i]);
+            if (!job) {
+                fprintf(stderr, "wait: %s: not a child of this shell\n", args[i].c_str());
+                status = 127;
+                continue;
+            }
+            if (args[i][0] == '%') {
+                while (job->state() == Ash::Job::State::Running && jobs.wait_any()) {}
+                status = job->status();
+            } else {
+                // A pid waits for that process only
+                pid_t pid = atoi(args[i].c_str());
+                auto proc = [&]() -> const Ash::JobProcess& {
+                    for (const auto& p : job->procs) {
+                        if (p.pid == pid) return p;
+                    }
+                    return job->procs.back();
+                };
+                while (!proc().exited && !proc().stopped && jobs.wait_any()) {}
+                status = proc().status;
+            }
+            if (job->state() == Ash::Job::State::Done) jobs.remove(*job);
+        }
+        return true;
+    }
+    
+    if (args[0] == "parallel") {
+        status = run_parallel(args);
+        return true;
+    }
+    
+    if (args[0] == "hash") {
+        if (args.size() == 1) {
+            command_hash.print();
+        } else if (args[1] == "-r") {
+            command_hash.clear();
+        } else {
+            for (size_t i = 1; i < args.size(); i++) {
+                if (!command_hash.remember(args[i])) {
+                    fprintf(stderr, "hash: %s: not found\n", args[i].c_str());
+                    status = 1;
+                }
+            }
         }
         return true;
     }
@@ -77,106 +1008,1248 @@ bool handle_builtin(const std::vector<std::string>& args) {
     return false;
 }
 
-int execute_pipeline(std::vector<std::vector<std::string>>& commands) {
-    int num_cmds = commands.size();
-    std::vector<int> pipes((num_cmds - 1) * 2);
+static void on_interrupt(int) {
+    FuzzyBox::interrupted = true;
+}
+
+// Run a fuzzylib command in the current process and flush what it wrote.
+// Under job control the shell keeps SIGINT blocked and reads it from its
+// signalfd, so ^C would never reach the command. While it runs, SIGINT
+// is unblocked and only sets FuzzyBox::interrupted, which the command's
+// long loops check. There is no SA_RESTART, so a blocking read returns
+// as well.
+static int run_fuzzy(const std::vector<std::string>& args) {
+    std::vector<std::string> cmd_args(args.begin() + 1, args.end());
+    struct sigaction saved_action;
+    sigset_t sigint, saved_mask;
+    if (job_control) {
+        struct sigaction action = {};
+        action.sa_handler = on_interrupt;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, &saved_action);
+        sigemptyset(&sigint);
+        sigaddset(&sigint, SIGINT);
+        sigprocmask(SIG_UNBLOCK, &sigint, &saved_mask);
+    }
+    int status = fuzzy.executeCommand(args[0], cmd_args);
+    std::cout.flush();
+    std::cerr.flush();
+    if (job_control) {
+        sigprocmask(SIG_SETMASK, &saved_mask, nullptr);
+        sigaction(SIGINT, &saved_action, nullptr);
+        if (FuzzyBox::interrupted.exchange(false)) {
+            printf("\n");
+            status = 128 + SIGINT;
+        }
+    }
+    return status;
+}
+
+// Pipe capacity requested for every pipeline pipe, from $ASH_PIPESIZE
+// (bytes). Large values help stages that move a lot of data; 0 keeps the
+// kernel default.
+static int requested_pipe_size() {
+    const char* value = getenv("ASH_PIPESIZE");
+    return value ? atoi(value) : 0;
+}
+
+// One pipeline stage, expanded and with its redirections opened
+struct Stage {
+    const Ash::Command* command;
+    std::vector<std::string> args;
+    std::vector<FdAction> actions;
+    bool ok;
+};
+
+// What a stage runs when it stays inside a copy of the shell
+static int run_in_shell(const Stage& stage) {
+    int status = 0;
+    if (stage.command->subshell) {
+        status = execute_list(stage.command->subshell);
+    } else if (!stage.args.empty() && handle_builtin(stage.args, status)) {
+        // Builtin
+    } else if (!stage.args.empty()) {
+        status = run_fuzzy(stage.args);
+    }
+    return status;
+}
+
+// Undo the shell's signal setup in a child: job-control signals back to
+// their defaults and nothing blocked
+static void reset_child_signals() {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+}
+
+// Fork a copy of the shell as (part of) a job. `pgid` is -1 without job
+// control, 0 to lead a new process group, or the group to join. The child
+// gets a clean job table and never does job control itself.
+static pid_t fork_job_process(pid_t pgid, bool foreground) {
+    std::cout.flush();
+    fflush(nullptr);
     
-    // Create all pipes
-    for (int i = 0; i < num_cmds - 1; i++) {
-        if (pipe(&pipes[i * 2]) < 0) {
-            perror("pipe");
-            return 1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (pgid >= 0) {
+            setpgid(0, pgid);
+            if (foreground && pgid == 0) tcsetpgrp(STDIN_FILENO, getpid());
+        }
+        reset_child_signals();
+        job_control = false;
+        jobs.clear();
+    } else if (pid > 0 && pgid >= 0) {
+        // Also set it here so there is no window where the child is not
+        // yet in its group
+        setpgid(pid, pgid ? pgid : pid);
+    }
+    return pid;
+}
+
+// Start a stage in a forked copy of the shell: subshells, builtins and
+// fuzzylib commands. Nothing is exec'ed, so the child has to drop the
+// close-on-exec pipe ends itself.
+static pid_t fork_stage(const Stage& stage, int in_fd, int out_fd, const std::vector<int>& pipes,
+                        pid_t pgid, bool foreground) {
+    pid_t pid = fork_job_process(pgid, foreground);
+    if (pid == 0) {
+        if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+        if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+        close_fds(pipes);
+        if (!apply_fd_actions(stage.actions)) _exit(1);
+        int status = run_in_shell(stage);
+        std::cout.flush();
+        fflush(nullptr);
+        _exit(status);
+    }
+    return pid;
+}
+
+// posix_spawn an external command, in process group `pgid` as for
+// fork_job_process(). Returns the stage's status if it could not be
+// started, or -1 with `pid` set.
+static int spawn_stage(const Stage& stage, int in_fd, int out_fd, pid_t pgid, bool foreground,
+                       pid_t& pid) {
+    // Resolve in the parent so lookups land in the shared hash table
+    std::string path = command_hash.lookup(stage.args[0]);
+    if (path.empty()) {
+        fprintf(stderr, "ash: %s: command not found\n", stage.args[0].c_str());
+        return 127;
+    }
+    
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    for (const auto& action : stage.actions) {
+        if (action.source < 0) {
+            posix_spawn_file_actions_addclose(&actions, action.target);
+        } else {
+            posix_spawn_file_actions_adddup2(&actions, action.source, action.target);
         }
     }
     
-    // Execute all commands
-    for (int i = 0; i < num_cmds; i++) {
-        pid_t pid = fork();
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    sigset_t none, defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    for (int sig : {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD}) {
+        sigaddset(&defaults, sig);
+    }
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    if (pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+#ifdef HAVE_SPAWN_TCSETPGRP
+        if (foreground && pgid == 0) {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+        }
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    
+    std::vector<char*> c_args;
+    for (auto& arg : stage.args) {
+        c_args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    c_args.push_back(nullptr);
+    
+    int err = posix_spawn(&pid, path.c_str(), &actions, &attr, c_args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "ash: %s: %s\n", c_args[0], strerror(err));
+        return err == ENOENT ? 127 : 126;
+    }
+    
+    if (pgid >= 0) {
+        setpgid(pid, pgid ? pgid : pid);
+#ifndef HAVE_SPAWN_TCSETPGRP
+        if (foreground && pgid == 0) tcsetpgrp(STDIN_FILENO, pid);
+#endif
+    }
+    return -1;
+}
+
+// Replace the shell with an external command, as `ash -c 'cmd'` does when
+// cmd is all there is left to run: no fork, no wait. Only returns the
+// status if the command could not be started.
+static int exec_stage(const Stage& stage) {
+    std::string path = command_hash.lookup(stage.args[0]);
+    if (path.empty()) {
+        fprintf(stderr, "ash: %s: command not found\n", stage.args[0].c_str());
+        return 127;
+    }
+    if (!apply_fd_actions(stage.actions)) return 1;
+    
+    std::vector<char*> c_args;
+    for (auto& arg : stage.args) {
+        c_args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    c_args.push_back(nullptr);
+    fflush(nullptr);
+    execv(path.c_str(), c_args.data());
+    int err = errno;
+    fprintf(stderr, "ash: %s: %s\n", c_args[0], strerror(err));
+    return err == ENOENT ? 127 : 126;
+}
+
+// One command started by the `parallel` builtin. Its stdout is collected
+// through a pipe so concurrent jobs never interleave their output.
+struct ParallelJob {
+    std::string item;
+    pid_t pid = -1;
+    int fd = -1;
+    int status = 0;
+    bool done = false;
+    bool at_line_start = true;
+    std::string output;
+};
+
+// Replace {} (the item), {.} (without extension) and {/} (basename)
+static std::string parallel_substitute(const std::string& word, const std::string& item, bool& used) {
+    std::string out;
+    for (size_t i = 0; i < word.size();) {
+        if (word.compare(i, 2, "{}") == 0) {
+            out += item;
+            i += 2;
+            used = true;
+        } else if (word.compare(i, 3, "{.}") == 0) {
+            size_t slash = item.rfind('/');
+            size_t dot = item.rfind('.');
+            bool has_ext = dot != std::string::npos && (slash == std::string::npos || dot > slash + 1);
+            out.append(item, 0, has_ext ? dot : item.size());
+            i += 3;
+            used = true;
+        } else if (word.compare(i, 3, "{/}") == 0) {
+            size_t slash = item.rfind('/');
+            out.append(item, slash == std::string::npos ? 0 : slash + 1, std::string::npos);
+            i += 3;
+            used = true;
+        } else {
+            out += word[i++];
+        }
+    }
+    return out;
+}
+
+// Write what a job has produced so far, prefixing lines with its item
+// for --tag
+static void parallel_flush(ParallelJob& job, bool tag) {
+    if (job.output.empty()) return;
+    if (!tag) {
+        write_all(STDOUT_FILENO, job.output.data(), job.output.size());
+        job.output.clear();
+        return;
+    }
+    std::string out;
+    for (char c : job.output) {
+        if (job.at_line_start) {
+            out += job.item;
+            out += '\t';
+        }
+        out += c;
+        job.at_line_start = c == '\n';
+    }
+    write_all(STDOUT_FILENO, out.data(), out.size());
+    job.output.clear();
+}
+
+// Start `job` with stdin from /dev/null and stdout into a pipe. Builtins
+// and fuzzylib commands run in a forked shell, which has to close the
+// other jobs' pipes itself.
+static void parallel_start(ParallelJob& job, const std::vector<std::string>& command, int null_fd,
+                           std::vector<int> open_fds) {
+    static const Ash::Command simple_command{};
+    Stage stage{&simple_command, {}, {}, true};
+    bool used = false;
+    for (const auto& word : command) {
+        stage.args.push_back(parallel_substitute(word, job.item, used));
+    }
+    if (!used) stage.args.push_back(job.item);
+    
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("parallel: pipe");
+        job.status = 1;
+        job.done = true;
+        return;
+    }
+    if (is_builtin(stage.args[0]) || fuzzy.hasCommand(stage.args[0])) {
+        open_fds.push_back(fds[0]);
+        open_fds.push_back(fds[1]);
+        open_fds.push_back(null_fd);
+        job.pid = fork_stage(stage, null_fd, fds[1], open_fds, -1, false);
+        if (job.pid < 0) {
+            perror("parallel: fork");
+            job.status = 1;
+        }
+    } else {
+        int status = spawn_stage(stage, null_fd, fds[1], -1, false, job.pid);
+        if (status >= 0) {
+            job.pid = -1;
+            job.status = status;
+        }
+    }
+    close(fds[1]);
+    if (job.pid > 0) {
+        job.fd = fds[0];
+    } else {
+        close(fds[0]);
+        job.done = true;
+    }
+}
+
+// parallel [-j N] [-k] [--tag] [--halt-on-error] command [args...] [::: items...]
+//
+// Runs `command` once per item, at most N at a time (default: one per
+// CPU). Items are the words after ::: or the lines of stdin. Each job's
+// stdout is printed in one piece when it finishes; -k prints in input
+// order instead, streaming the oldest job. stderr is not captured. The
+// status is the number of failed jobs (at most 101), or with
+// --halt-on-error the status of the first failure, after which no more
+// jobs start and running ones get SIGTERM.
+static int run_parallel(const std::vector<std::string>& args) {
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keep_order = false;
+    bool tag = false;
+    bool halt = false;
+    
+    size_t i = 1;
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++) {
+        const std::string& opt = args[i];
+        if (opt == "--") {
+            i++;
+            break;
+        } else if (opt == "-k" || opt == "--keep-order") {
+            keep_order = true;
+        } else if (opt == "--tag") {
+            tag = true;
+        } else if (opt == "--halt-on-error") {
+            halt = true;
+        } else if (opt == "-j" || opt == "--jobs") {
+            if (++i == args.size()) {
+                fprintf(stderr, "parallel: %s: option requires an argument\n", opt.c_str());
+                return 2;
+            }
+            max_jobs = atol(args[i].c_str());
+        } else if (opt.compare(0, 2, "-j") == 0) {
+            max_jobs = atol(opt.c_str() + 2);
+        } else {
+            fprintf(stderr, "parallel: unknown option %s\n", opt.c_str());
+            return 2;
+        }
+    }
+    if (max_jobs < 1) max_jobs = 1;
+    
+    std::vector<std::string> command;
+    while (i < args.size() && args[i] != ":::") command.push_back(args[i++]);
+    if (command.empty()) {
+        fprintf(stderr, "usage: parallel [-j N] [-k] [--tag] [--halt-on-error] command [args...] [::: items...]\n");
+        return 2;
+    }
+    bool from_stdin = i == args.size();
+    std::deque<std::string> items;
+    if (!from_stdin) items.assign(args.begin() + i + 1, args.end());
+    
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    std::string input;
+    size_t input_pos = 0;
+    bool input_eof = !from_stdin;
+    
+    // False once nothing is available right now; exhausted() tells
+    // whether more can still arrive
+    auto next_item = [&](std::string& item) {
+        if (!from_stdin) {
+            if (items.empty()) return false;
+            item = std::move(items.front());
+            items.pop_front();
+            return true;
+        }
+        size_t nl = input.find('\n', input_pos);
+        if (nl == std::string::npos) {
+            if (!input_eof || input_pos == input.size()) return false;
+            nl = input.size();
+        }
+        item.assign(input, input_pos, nl - input_pos);
+        input_pos = std::min(nl + 1, input.size());
+        if (input_pos > 65536 && input_pos * 2 > input.size()) {
+            input.erase(0, input_pos);
+            input_pos = 0;
+        }
+        return true;
+    };
+    auto exhausted = [&]() {
+        return from_stdin ? input_eof && input_pos == input.size() : items.empty();
+    };
+    
+    std::deque<ParallelJob> queue;
+    long running = 0;
+    int failures = 0;
+    int stop_status = 0;
+    bool stopping = false;
+    
+    auto finished = [&](ParallelJob& job) {
+        job.done = true;
+        if (job.status == 0) return;
+        failures++;
+        if (halt && !stopping) {
+            stopping = true;
+            stop_status = job.status;
+            for (auto& other : queue) {
+                if (!other.done && other.pid > 0) kill(other.pid, SIGTERM);
+            }
+        }
+    };
+    
+    std::cout.flush();
+    fflush(stdout);
+    
+    char buf[65536];
+    while (true) {
+        // ^C reaches the jobs through the terminal; just stop starting new
+        // ones and leave the signal pending for the shell
+        sigset_t pending;
+        if (!stopping && sigpending(&pending) == 0 && sigismember(&pending, SIGINT)) {
+            stopping = true;
+            stop_status = 128 + SIGINT;
+        }
         
-        if (pid == 0) {
-            // Child process
+        while (!stopping && running < max_jobs) {
+            std::string item;
+            if (!next_item(item)) break;
+            if (item.empty()) continue;
             
-            // Set up input pipe
-            if (i > 0) {
-                dup2(pipes[(i-1)*2], STDIN_FILENO);
+            std::vector<int> open_fds;
+            for (const auto& job : queue) {
+                if (job.fd >= 0) open_fds.push_back(job.fd);
             }
-            
-            // Set up output pipe
-            if (i < num_cmds - 1) {
-                dup2(pipes[i*2 + 1], STDOUT_FILENO);
+            queue.emplace_back();
+            ParallelJob& job = queue.back();
+            job.item = std::move(item);
+            parallel_start(job, command, null_fd, std::move(open_fds));
+            if (job.done) {
+                finished(job);
+            } else {
+                running++;
             }
-            
-            // Close all pipes
-            for (size_t j = 0; j < pipes.size(); j++) {
-                close(pipes[j]);
+        }
+        
+        if (keep_order) {
+            while (!queue.empty()) {
+                parallel_flush(queue.front(), tag);
+                if (!queue.front().done) break;
+                queue.pop_front();
             }
-            
-            // Convert vector<string> to char*[]
-            std::vector<char*> c_args;
-            for (auto& arg : commands[i]) {
-                c_args.push_back(const_cast<char*>(arg.c_str()));
+        } else {
+            for (auto it = queue.begin(); it != queue.end();) {
+                if (it->done) {
+                    parallel_flush(*it, tag);
+                    it = queue.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        
+        if (running == 0 && (stopping || exhausted())) break;
+        
+        std::vector<struct pollfd> fds;
+        std::vector<ParallelJob*> owners;
+        for (auto& job : queue) {
+            if (job.fd < 0) continue;
+            fds.push_back({job.fd, POLLIN, 0});
+            owners.push_back(&job);
+        }
+        bool want_input = from_stdin && !input_eof && !stopping && running < max_jobs;
+        if (want_input) fds.push_back({STDIN_FILENO, POLLIN, 0});
+        
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("parallel: poll");
+            break;
+        }
+        
+        for (size_t j = 0; j < owners.size(); j++) {
+            if (!fds[j].revents) continue;
+            ParallelJob& job = *owners[j];
+            ssize_t n = read(job.fd, buf, sizeof(buf));
+            if (n > 0) {
+                job.output.append(buf, n);
+                continue;
             }
-            c_args.push_back(nullptr);
+            if (n < 0 && errno == EINTR) continue;
             
-            execvp(c_args[0], c_args.data());
-            perror("execvp");
-            exit(EXIT_FAILURE);
+            close(job.fd);
+            job.fd = -1;
+            int wstatus;
+            while (waitpid(job.pid, &wstatus, 0) < 0 && errno == EINTR) {}
+            job.status = Ash::wait_status_code(wstatus);
+            running--;
+            finished(job);
+        }
+        
+        if (want_input && fds.back().revents) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n > 0) {
+                input.append(buf, n);
+            } else if (n == 0 || errno != EINTR) {
+                input_eof = true;
+            }
         }
     }
     
-    // Parent closes all pipes
-    for (int pipe : pipes) {
-        close(pipe);
+    if (null_fd >= 0) close(null_fd);
+    if (stopping) return stop_status;
+    return failures > 101 ? 101 : failures;
+}
+
+// Command text for `jobs` and perfstat, rebuilt from the AST
+static void describe(const Ash::Command* cmd, std::string& out) {
+    static const char* redir_ops[] = {"<", ">", ">>", "<>", "<&", ">&", "<<", "<<<"};
+    size_t start = out.size();
+    if (cmd->subshell) out += "( ... )";
+    for (const Ash::Word* w = cmd->words; w; w = w->next) {
+        if (out.size() > start) out += ' ';
+        out.append(w->text);
+    }
+    for (const Ash::Redirect* r = cmd->redirects; r; r = r->next) {
+        if (out.size() > start) out += ' ';
+        out += redir_ops[static_cast<int>(r->op)];
+        if (r->op != Ash::RedirOp::HereDoc) out.append(r->target);
+    }
+}
+
+static void describe(const Ash::Pipeline* pipeline, std::string& out) {
+    if (pipeline->profile == Ash::Profile::Text) out += "perfstat ";
+    if (pipeline->profile == Ash::Profile::Json) out += "perfstat --json ";
+    if (pipeline->negate) out += "! ";
+    for (const Ash::Command* cmd = pipeline->commands; cmd; cmd = cmd->next) {
+        if (cmd != pipeline->commands) out += " | ";
+        describe(cmd, out);
+    }
+}
+
+static std::string describe(const Ash::AndOr* chain) {
+    std::string out;
+    for (const Ash::AndOr* node = chain; node; node = node->next) {
+        if (node->connector == Ash::Connector::And) out += " && ";
+        if (node->connector == Ash::Connector::Or) out += " || ";
+        describe(node->pipeline, out);
+    }
+    return out;
+}
+
+// Start a stage under perfstat. The child is forked rather than spawned
+// and holds on a sync pipe until its counters are attached: external
+// commands count from their execve() (enable_on_exec), stages that stay
+// in the shell from the moment they are released.
+static pid_t fork_profiled_stage(const Stage& stage, int in_fd, int out_fd, const std::vector<int>& pipes,
+                                 pid_t pgid, bool foreground, Ash::PerfCounters& counters, int& status) {
+    bool in_shell = stage.command->subshell || stage.args.empty() || is_builtin(stage.args[0]) ||
+                    fuzzy.hasCommand(stage.args[0]);
+    std::string path;
+    if (!in_shell) {
+        path = command_hash.lookup(stage.args[0]);
+        if (path.empty()) {
+            fprintf(stderr, "ash: %s: command not found\n", stage.args[0].c_str());
+            status = 127;
+            return -1;
+        }
     }
     
-    // Wait for all children
-    for (int i = 0; i < num_cmds; i++) {
-        wait(nullptr);
+    int sync[2];
+    if (pipe2(sync, O_CLOEXEC) != 0) {
+        perror("pipe2");
+        status = 1;
+        return -1;
+    }
+    
+    pid_t pid = fork_job_process(pgid, foreground);
+    if (pid == 0) {
+        close(sync[1]);
+        if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+        if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+        close_fds(pipes);
+        if (!apply_fd_actions(stage.actions)) _exit(1);
+        
+        char c;
+        while (read(sync[0], &c, 1) < 0 && errno == EINTR) {}
+        close(sync[0]);
+        
+        if (in_shell) {
+            int code = run_in_shell(stage);
+            std::cout.flush();
+            fflush(nullptr);
+            _exit(code);
+        }
+        std::vector<char*> c_args;
+        for (auto& arg : stage.args) {
+            c_args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        c_args.push_back(nullptr);
+        execv(path.c_str(), c_args.data());
+        fprintf(stderr, "ash: %s: %s\n", c_args[0], strerror(errno));
+        _exit(errno == ENOENT ? 127 : 126);
     }
     
-    return 1;
+    close(sync[0]);
+    if (pid < 0) {
+        perror("fork");
+        close(sync[1]);
+        status = 1;
+        return -1;
+    }
+    counters.open(pid, !in_shell);
+    if (in_shell) counters.enable();
+    close(sync[1]);
+    return pid;
 }
 
-int main() {
-    initialize_shell();
-    char* input;
-    int status = 1;
+// One perfstat line: a stage, or the whole pipeline
+struct StageProfile {
+    std::string command;
+    int status = 0;
+    double real = 0, user = 0, sys = 0;
+    long maxrss = 0, minflt = 0, majflt = 0, nvcsw = 0, nivcsw = 0;
+    bool has[Ash::PerfCounters::NUM_EVENTS] = {};
+    uint64_t value[Ash::PerfCounters::NUM_EVENTS] = {};
+};
+
+static double seconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void json_string(std::string& out, const std::string& s) {
+    out += '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
+
+static void json_profile(std::string& out, const StageProfile& p, bool with_command) {
+    char buf[512];
+    out += '{';
+    if (with_command) {
+        out += "\"command\":";
+        json_string(out, p.command);
+        out += ',';
+    }
+    snprintf(buf, sizeof(buf),
+             "\"status\":%d,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+             "\"minor_faults\":%ld,\"major_faults\":%ld,\"voluntary_switches\":%ld,"
+             "\"involuntary_switches\":%ld",
+             p.status, p.real, p.user, p.sys, p.maxrss, p.minflt, p.majflt, p.nvcsw, p.nivcsw);
+    out += buf;
+    for (int e = 0; e < Ash::PerfCounters::NUM_EVENTS; e++) {
+        std::string key = Ash::PerfCounters::name(e);
+        std::replace(key.begin(), key.end(), '-', '_');
+        if (p.has[e]) {
+            snprintf(buf, sizeof(buf), ",\"%s\":%llu", key.c_str(), static_cast<unsigned long long>(p.value[e]));
+        } else {
+            snprintf(buf, sizeof(buf), ",\"%s\":null", key.c_str());
+        }
+        out += buf;
+    }
+    out += '}';
+}
+
+static void print_profile(const char* label, const StageProfile& p) {
+    fprintf(stderr, "perfstat: %s  (status %d)\n", label, p.status);
+    fprintf(stderr, "    real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KB\n", p.real, p.user, p.sys, p.maxrss);
+    fprintf(stderr, "   ");
+    for (int e = 0; e < Ash::PerfCounters::NUM_EVENTS; e++) {
+        if (p.has[e]) {
+            fprintf(stderr, " %s %llu", Ash::PerfCounters::name(e), static_cast<unsigned long long>(p.value[e]));
+        } else {
+            fprintf(stderr, " %s n/a", Ash::PerfCounters::name(e));
+        }
+    }
+    if (p.has[Ash::PerfCounters::Cycles] && p.has[Ash::PerfCounters::Instructions] &&
+        p.value[Ash::PerfCounters::Cycles] > 0) {
+        fprintf(stderr, "  IPC %.2f", static_cast<double>(p.value[Ash::PerfCounters::Instructions]) /
+                                          p.value[Ash::PerfCounters::Cycles]);
+    }
+    fprintf(stderr, "\n    switches %ld voluntary, %ld involuntary  faults %ld minor, %ld major\n",
+            p.nvcsw, p.nivcsw, p.minflt, p.majflt);
+}
+
+// Report a finished perfstat pipeline on stderr: one entry per stage
+// plus the total, as text or a single line of JSON
+static void report_profile(const Ash::Pipeline* pipeline, const std::vector<Ash::JobProcess>& procs,
+                           std::vector<std::unique_ptr<Ash::PerfCounters>>& counters,
+                           std::chrono::steady_clock::time_point started) {
+    std::vector<StageProfile> stages(procs.size());
+    StageProfile total;
+    total.command = "total";
     
-    while (status && (input = readline("# "))) {
-        if (input[0] != '\0') {
-            add_history(input);
-            write_history(HISTORY_FILE);
-            
-            std::string line(input);
-            std::vector<std::vector<std::string>> pipeline;
-            std::istringstream pipe_stream(line);
-            std::string command;
-            
-            // Split into pipeline segments
-            while (std::getline(pipe_stream, command, '|')) {
-                auto tokens = tokenize(command);
-                if (!tokens.empty()) {
-                    // Check for aliases
-                    if (aliases.count(tokens[0])) {
-                        auto alias_tokens = tokenize(aliases[tokens[0]]);
-                        tokens.erase(tokens.begin());
-                        tokens.insert(tokens.begin(), alias_tokens.begin(), alias_tokens.end());
-                    }
-                    pipeline.push_back(tokens);
-                }
+    const Ash::Command* cmd = pipeline->commands;
+    for (size_t i = 0; i < procs.size(); i++, cmd = cmd->next) {
+        const Ash::JobProcess& proc = procs[i];
+        StageProfile& p = stages[i];
+        describe(cmd, p.command);
+        p.status = proc.status;
+        if (proc.pid > 0 && proc.ended > started) {
+            p.real = std::chrono::duration<double>(proc.ended - started).count();
+        }
+        p.user = seconds(proc.usage.ru_utime);
+        p.sys = seconds(proc.usage.ru_stime);
+        p.maxrss = proc.usage.ru_maxrss;
+        p.minflt = proc.usage.ru_minflt;
+        p.majflt = proc.usage.ru_majflt;
+        p.nvcsw = proc.usage.ru_nvcsw;
+        p.nivcsw = proc.usage.ru_nivcsw;
+        counters[i]->collect();
+        for (int e = 0; e < Ash::PerfCounters::NUM_EVENTS; e++) {
+            p.has[e] = counters[i]->available(e);
+            p.value[e] = counters[i]->value(e);
+        }
+        counters[i]->close_all();
+        
+        total.status = p.status;
+        total.real = std::max(total.real, p.real);
+        total.user += p.user;
+        total.sys += p.sys;
+        total.maxrss = std::max(total.maxrss, p.maxrss);
+        total.minflt += p.minflt;
+        total.majflt += p.majflt;
+        total.nvcsw += p.nvcsw;
+        total.nivcsw += p.nivcsw;
+        for (int e = 0; e < Ash::PerfCounters::NUM_EVENTS; e++) {
+            total.has[e] = total.has[e] || p.has[e];
+            total.value[e] += p.value[e];
+        }
+    }
+    
+    if (pipeline->profile == Ash::Profile::Json) {
+        std::string out = "{\"stages\":[";
+        for (size_t i = 0; i < stages.size(); i++) {
+            if (i > 0) out += ',';
+            json_profile(out, stages[i], true);
+        }
+        out += "],\"total\":";
+        json_profile(out, total, false);
+        out += "}\n";
+        write_all(STDERR_FILENO, out.data(), out.size());
+        return;
+    }
+    
+    for (size_t i = 0; i < stages.size(); i++) {
+        std::string label = "[" + std::to_string(i + 1) + "] " + stages[i].command;
+        print_profile(label.c_str(), stages[i]);
+    }
+    if (stages.size() > 1) print_profile("total", total);
+}
+
+// Report a background job the way interactive shells do, and make it $!
+static void started_background(const Ash::Job& job) {
+    last_background = job.last_pid();
+    if (job_control) printf("[%d] %d\n", job.id, last_background);
+    last_status = 0;
+}
+
+// Run a pipeline. External stages are started with posix_spawn; pipes are
+// O_CLOEXEC, so each child only keeps the ends dup2'ed onto its
+// stdin/stdout. A lone builtin or fuzzylib command in the foreground runs
+// in the shell itself. Every started pipeline is a job; a foreground one
+// is waited for, and its stage statuses go to $? and PIPESTATUS. Under
+// perfstat every stage is forked with counters attached, and a foreground
+// pipeline is reported once it finishes.
+int execute_pipeline(const Ash::Pipeline* pipeline, bool background = false) {
+    bool in_place = exec_in_place;
+    exec_in_place = false;
+    int num_cmds = pipeline->length;
+    std::vector<Stage> stages(num_cmds);
+    std::vector<int> opened;
+    std::vector<int> statuses(num_cmds, 0);
+    
+    const Ash::Command* cmd = pipeline->commands;
+    for (int i = 0; i < num_cmds; i++, cmd = cmd->next) {
+        Stage& stage = stages[i];
+        stage.command = cmd;
+        for (const Ash::Word* w = cmd->words; w; w = w->next) {
+            if (w->plain) stage.args.emplace_back(w->text);
+            else expand_word(w->text, stage.args);
+        }
+        stage.ok = prepare_redirects(cmd->redirects, stage.actions, opened);
+        if (!stage.ok) statuses[i] = 1;
+    }
+    glob_engine.clear();
+    
+    bool profiled = pipeline->profile != Ash::Profile::None;
+    const Stage& first = stages[0];
+    if (!background && !profiled && num_cmds == 1 && !first.command->subshell &&
+        (first.args.empty() || is_builtin(first.args[0]) || fuzzy.hasCommand(first.args[0]))) {
+        if (first.ok) {
+            bool ok;
+            std::vector<SavedFd> saved = redirect_shell(first.actions, ok);
+            statuses[0] = ok ? run_in_shell(first) : 1;
+            restore_shell(saved);
+        }
+        close_fds(opened);
+        pipe_status = statuses;
+        last_status = statuses[0];
+        if (pipeline->negate) last_status = !last_status;
+        return last_status;
+    }
+    
+    if (in_place && !background && !profiled && num_cmds == 1 && !first.command->subshell) {
+        last_status = first.ok ? exec_stage(first) : 1;
+        close_fds(opened);
+        return last_status;
+    }
+    
+    std::vector<int> pipes((num_cmds - 1) * 2, -1);
+    std::vector<Ash::JobProcess> procs(num_cmds, Ash::JobProcess{-1, 0, true, false});
+    int pipe_size = requested_pipe_size();
+    pid_t pgid = job_control ? 0 : -1;
+    bool started = false;
+    std::vector<std::unique_ptr<Ash::PerfCounters>> counters;
+    for (int i = 0; profiled && i < num_cmds; i++) {
+        counters.push_back(std::make_unique<Ash::PerfCounters>());
+    }
+    auto started_at = std::chrono::steady_clock::now();
+    
+    for (int i = 0; i < num_cmds - 1; i++) {
+        if (pipe2(&pipes[i * 2], O_CLOEXEC) < 0) {
+            perror("pipe2");
+            close_fds(pipes);
+            close_fds(opened);
+            return last_status = 1;
+        }
+        if (pipe_size > 0 && fcntl(pipes[i * 2], F_SETPIPE_SZ, pipe_size) < 0) {
+            perror("F_SETPIPE_SZ");
+        }
+    }
+    
+    for (int i = 0; i < num_cmds; i++) {
+        const Stage& stage = stages[i];
+        int in_fd = i > 0 ? pipes[(i-1)*2] : -1;
+        int out_fd = i < num_cmds - 1 ? pipes[i*2 + 1] : -1;
+        procs[i].status = statuses[i];
+        if (!stage.ok) continue;
+        
+        pid_t pid = -1;
+        if (profiled) {
+            pid = fork_profiled_stage(stage, in_fd, out_fd, pipes, pgid, !background, *counters[i],
+                                      procs[i].status);
+        } else if (stage.command->subshell || stage.args.empty() || is_builtin(stage.args[0]) ||
+                   fuzzy.hasCommand(stage.args[0])) {
+            pid = fork_stage(stage, in_fd, out_fd, pipes, pgid, !background);
+            if (pid < 0) {
+                perror("fork");
+                procs[i].status = 1;
             }
-            
-            if (!pipeline.empty()) {
-                if (pipeline.size() == 1 && !handle_builtin(pipeline[0])) {
-                    status = 0;
-                } else {
-                    status = execute_pipeline(pipeline);
-                }
+        } else {
+            int status = spawn_stage(stage, in_fd, out_fd, pgid, !background, pid);
+            if (status >= 0) {
+                pid = -1;
+                procs[i].status = status;
             }
         }
-        free(input);
+        
+        if (pid > 0) {
+            procs[i] = Ash::JobProcess{pid, 0, false, false};
+            started = true;
+            if (pgid == 0) pgid = pid;
+        }
+    }
+    
+    // Parent closes all pipes
+    close_fds(pipes);
+    close_fds(opened);
+    
+    if (!started) {
+        pipe_status.clear();
+        for (const auto& p : procs) {
+            pipe_status.push_back(p.status);
+        }
+        last_status = procs.back().status;
+    } else {
+        std::string command;
+        describe(pipeline, command);
+        Ash::Job& job = jobs.add(pgid > 0 ? pgid : 0, std::move(procs), command, background);
+        if (background) {
+            started_background(job);
+            return 0;
+        }
+        std::vector<Ash::JobProcess> finished;
+        wait_for_job(job, profiled ? &finished : nullptr);
+        if (!finished.empty()) report_profile(pipeline, finished, counters, started_at);
+    }
+    
+    if (pipeline->negate) last_status = !last_status;
+    return last_status;
+}
+
+// Run an && / || chain; a pipeline is skipped when its connector does not
+// match the status so far
+int execute_and_or(const Ash::AndOr* chain) {
+    int status = 0;
+    for (const Ash::AndOr* node = chain; node && !exit_requested; node = node->next) {
+        if (node->connector == Ash::Connector::And && status != 0) continue;
+        if (node->connector == Ash::Connector::Or && status == 0) continue;
+        status = execute_pipeline(node->pipeline);
+    }
+    return status;
+}
+
+// `cmd &`. A single pipeline becomes a background job directly; a longer
+// && / || chain runs in a forked copy of the shell that is the job.
+static void start_background(const Ash::AndOr* chain) {
+    if (!chain->next) {
+        execute_pipeline(chain->pipeline, true);
+        return;
+    }
+    
+    pid_t pgid = job_control ? 0 : -1;
+    pid_t pid = fork_job_process(pgid, false);
+    if (pid == 0) {
+        int status = execute_and_or(chain);
+        std::cout.flush();
+        fflush(nullptr);
+        _exit(status);
+    }
+    if (pid < 0) {
+        perror("fork");
+        last_status = 1;
+        return;
+    }
+    
+    Ash::Job& job = jobs.add(job_control ? pid : 0, {Ash::JobProcess{pid, 0, false, false}},
+                             describe(chain), true);
+    started_background(job);
+}
+
+int execute_list(const Ash::List* list) {
+    for (const Ash::ListEntry* entry = list->entries; entry && !exit_requested; entry = entry->next) {
+        // Without a SIGCHLD-driven loop (scripts), collect finished
+        // background jobs between commands, and drop the oldest once too
+        // many have piled up unreported
+        if (!jobs.empty()) {
+            jobs.reap();
+            jobs.prune();
+        }
+        
+        if (entry->background) {
+            start_background(entry->chain);
+        } else {
+            execute_and_or(entry->chain);
+        }
+    }
+    return last_status;
+}
+
+static bool is_blank(const std::string& line) {
+    return line.find_first_not_of(" \t\n") == std::string::npos;
+}
+
+// Run a script file. Its parsed form is cached on disk, so an unchanged
+// script is decoded from the cache instead of being lexed and parsed.
+// Scripts are parsed without aliases so the cached form never depends on
+// the aliases of the shell that compiled it.
+static int run_script(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "ash: %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 127;
+    }
+    
+    char resolved[PATH_MAX];
+    std::string key = realpath(path, resolved) ? resolved : path;
+    Ash::Arena arena;
+    Ash::ScriptCache cache;
+    std::string source;
+    
+    Ash::List* program = S_ISREG(st.st_mode) ? cache.load(key, st, arena) : nullptr;
+    if (!program) {
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            source.append(buf, n);
+        }
+        
+        Ash::Parser parser(arena);
+        if (parser.parse(source, true, program) != Ash::ParseStatus::Ok) {
+            fprintf(stderr, "ash: %s: %s\n", path, parser.error());
+            close(fd);
+            return 2;
+        }
+        if (S_ISREG(st.st_mode)) cache.store(key, st, program);
+    }
+    close(fd);
+    
+    execute_list(program);
+    return last_status;
+}
+
+// ash -c 'commands'
+static int run_string(const char* commands) {
+    Ash::Arena arena;
+    Ash::Parser parser(arena);
+    Ash::List* program;
+    if (parser.parse(commands, true, program) != Ash::ParseStatus::Ok) {
+        fprintf(stderr, "ash: -c: %s\n", parser.error());
+        return 2;
+    }
+    // A lone simple command is exec'ed in place of the shell
+    const Ash::ListEntry* entry = program->entries;
+    exec_in_place = entry && !entry->next && !entry->background && !entry->chain->next &&
+                    !entry->chain->pipeline->negate;
+    execute_list(program);
+    return last_status;
+}
+
+// Commands from a stdin that is not a terminal (`ash < file`, `cmd | ash`):
+// no readline, history or default aliases. Each command is run as soon as
+// its last line arrives. Commands may read the rest of stdin themselves,
+// so the shell never consumes input past the command it is about to run:
+// a seekable stdin is read ahead in large blocks with the file offset
+// moved back to the end of the command before it runs, and a pipe is read
+// one byte at a time up to the next newline. As with scripts, aliases are
+// not expanded.
+static int run_stream(int fd) {
+    static const size_t READ_SIZE = 128 << 10;
+    Ash::Arena arena;
+    Ash::Parser parser(arena);
+    std::string buffer;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    bool seekable = offset >= 0;
+    bool eof = false;
+    size_t scan = 0;
+    
+    while (!exit_requested) {
+        size_t newline = buffer.find('\n', scan);
+        if (newline == std::string::npos && !eof) {
+            scan = buffer.size();
+            size_t want = seekable ? READ_SIZE : 1;
+            buffer.resize(scan + want);
+            ssize_t n = seekable ? pread(fd, &buffer[scan], want, offset + scan)
+                                 : read(fd, &buffer[scan], want);
+            buffer.resize(scan + (n > 0 ? n : 0));
+            if (n < 0 && errno == EINTR) continue;
+            eof = n <= 0;
+            continue;
+        }
+        size_t end = newline == std::string::npos ? buffer.size() : newline + 1;
+        if (end == 0) break;
+        
+        arena.reset();
+        Ash::List* program = nullptr;
+        bool last = eof && end == buffer.size();
+        Ash::ParseStatus status = parser.parse(std::string_view(buffer.data(), end), last, program);
+        if (status == Ash::ParseStatus::Incomplete && !last) {
+            scan = end;
+            continue;
+        }
+        if (status != Ash::ParseStatus::Ok) {
+            fprintf(stderr, "ash: %s\n", parser.error());
+            return 2;
+        }
+        if (seekable) {
+            offset += end;
+            lseek(fd, offset, SEEK_SET);
+        }
+        // The parsed program points into the buffer, so drop the command's
+        // text only once it has run
+        execute_list(program);
+        buffer.erase(0, end);
+        scan = 0;
+        if (seekable) {
+            // The command read some of stdin: carry on after what it took
+            off_t now = lseek(fd, 0, SEEK_CUR);
+            if (now != offset) {
+                offset = now;
+                buffer.clear();
+                eof = false;
+            }
+        }
+    }
+    return last_status;
+}
+
+// State of the interactive reader. readline runs in callback mode so the
+// loop can also watch a signalfd for SIGCHLD (reap jobs as they finish)
+// and SIGINT (discard the current line).
+static Ash::Arena line_arena;
+static Ash::Parser line_parser(line_arena, &aliases);
+static std::string line_buffer;
+static bool continuing = false;
+static bool input_eof = false;
+static bool handler_installed = false;
+
+static void run_line(Ash::ParseStatus status, Ash::List* program) {
+    if (is_blank(line_buffer)) return;
+    add_history(line_buffer.c_str());
+    write_history(HISTORY_FILE);
+    
+    if (status == Ash::ParseStatus::Error) {
+        fprintf(stderr, "ash: %s\n", line_parser.error());
+        last_status = 2;
+    } else {
+        execute_list(program);
+    }
+}
+
+static void on_line(char* input) {
+    Ash::List* program = nullptr;
+    Ash::ParseStatus status;
+    
+    if (!input) {
+        // EOF: finish whatever was pending and stop
+        rl_callback_handler_remove();
+        handler_installed = false;
+        input_eof = true;
+        if (continuing) {
+            line_arena.reset();
+            run_line(line_parser.parse(line_buffer, true, program), program);
+        }
+        return;
+    }
+    
+    if (continuing) line_buffer += '\n';
+    line_buffer += input;
+    free(input);
+    
+    // Keep reading while the command is unfinished (open quotes,
+    // trailing operators, here-documents)
+    line_arena.reset();
+    status = line_parser.parse(line_buffer, false, program);
+    if (status == Ash::ParseStatus::Incomplete) {
+        continuing = true;
+        rl_set_prompt("> ");
+        return;
+    }
+    
+    rl_callback_handler_remove();
+    handler_installed = false;
+    run_line(status, program);
+    line_buffer.clear();
+    continuing = false;
+    
+    if (!exit_requested) {
+        jobs.reap();
+        jobs.notify(stdout);
+        rl_callback_handler_install(PROMPT, on_line);
+        handler_installed = true;
+    }
+}
+
+static void handle_signals(int sfd) {
+    struct signalfd_siginfo info;
+    while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) {
+            jobs.reap();
+        } else if (info.ssi_signo == SIGINT) {
+            line_buffer.clear();
+            continuing = false;
+            rl_replace_line("", 0);
+            rl_set_prompt(PROMPT);
+            printf("\n");
+            rl_on_new_line();
+            rl_redisplay();
+        }
+    }
+}
+
+static int interactive_loop() {
+    initialize_shell();
+    
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (job_control) sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    
+    rl_callback_handler_install(PROMPT, on_line);
+    handler_installed = true;
+    
+    while (!exit_requested && !input_eof) {
+        // poll() skips negative descriptors; the completion index has no
+        // inotify fd until the first completion builds it
+        struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {sfd, POLLIN, 0}, {completion.fd(), POLLIN, 0}};
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[2].revents & POLLIN) completion.process_events();
+        if (sfd >= 0 && (fds[1].revents & POLLIN)) handle_signals(sfd);
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) rl_callback_read_char();
+    }
+    
+    if (handler_installed) rl_callback_handler_remove();
+    if (sfd >= 0) close(sfd);
+    if (!exit_requested) printf("\n");
+    return last_status;
+}
+
+// ash                          interactive shell
+// ash script [args...]         run a script
+// ash -c commands [name args...]
+int main(int argc, char* argv[]) {
+    register_commands();
+    
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "ash: -c: option requires an argument\n");
+            return 2;
+        }
+        if (argc > 3) script_name = argv[3];
+        positional.assign(argv + (argc > 4 ? 4 : argc), argv + argc);
+        return run_string(argv[2]);
+    }
+    
+    if (argc > 1) {
+        script_name = argv[1];
+        positional.assign(argv + 2, argv + argc);
+        return run_script(argv[1]);
     }
     
-    printf("\n");
-    return EXIT_SUCCESS;
+    if (!isatty(STDIN_FILENO)) return run_stream(STDIN_FILENO);
+    return interactive_loop();
 }
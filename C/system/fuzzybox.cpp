@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lib/fuzzylib.hpp"
+#include "lib/fuzzyCommands.hpp"
+
+// fuzzybox: every fuzzylib command in one multi-call binary. Invoked
+// through a symlink it runs the command the link is named after;
+// otherwise the first argument names the command. One image serves every
+// command, so its pages stay shared and warm in the page cache.
+
+static std::string base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void usage() {
+    std::cout << "Usage: fuzzybox <command> [args...]\n"
+              << "       fuzzybox --install [-f] [directory]\n"
+              << "       <command> [args...]   (through a symlink to fuzzybox)\n\n"
+              << "Commands:\n";
+    for (const auto& entry : FuzzyBox::command_list) {
+        std::cout << "  " << entry.name << " - " << entry.make()->help() << "\n";
+    }
+}
+
+// Link every command name in `dir` to this binary. Existing symlinks are
+// replaced; other files are left alone unless `force` is given.
+static int install(const std::string& dir, bool force) {
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        std::cerr << "fuzzybox: /proc/self/exe: " << strerror(errno) << "\n";
+        return 1;
+    }
+    self[len] = '\0';
+
+    int status = 0;
+    for (const auto& entry : FuzzyBox::command_list) {
+        std::string link = dir + "/" + std::string(entry.name);
+        struct stat st;
+        if (lstat(link.c_str(), &st) == 0) {
+            if (!S_ISLNK(st.st_mode) && !force) {
+                std::cerr << "fuzzybox: " << link << ": exists, skipping (use -f to replace)\n";
+                status = 1;
+                continue;
+            }
+            unlink(link.c_str());
+        }
+        if (symlink(self, link.c_str()) != 0) {
+            std::cerr << "fuzzybox: " << link << ": " << strerror(errno) << "\n";
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    std::string name = base_name(argv[0]);
+    int first = 1;
+
+    if (name == "fuzzybox") {
+        if (argc < 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+            usage();
+            return argc < 2 ? 1 : 0;
+        }
+        if (strcmp(argv[1], "--install") == 0) {
+            bool force = argc > 2 && strcmp(argv[2], "-f") == 0;
+            int dir = force ? 3 : 2;
+            return install(argc > dir ? argv[dir] : "/bin", force);
+        }
+        name = argv[1];
+        first = 2;
+    }
+
+    const FuzzyBox::CommandEntry* entry = FuzzyBox::find_command(name);
+    if (!entry) {
+        std::cerr << "fuzzybox: " << name << ": command not found\n";
+        return 127;
+    }
+    std::vector<std::string> args(argv + first, argv + argc);
+    int status = entry->make()->execute(args);
+    std::cout.flush();
+    return status;
+}
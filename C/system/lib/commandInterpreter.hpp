@@ -0,0 +1,722 @@
+#ifndef COMMAND_INTERPRETER_HPP
+#define COMMAND_INTERPRETER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace Ash {
+
+// Bump allocator for everything produced while parsing one command line.
+// reset() rewinds without freeing, so once the blocks have grown to fit a
+// typical line no further heap allocation happens.
+class Arena {
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t offset = 0;
+    size_t block_size;
+
+public:
+    explicit Arena(size_t size = 16384) : block_size(size) {}
+
+    void* allocate(size_t size, size_t align) {
+        while (true) {
+            if (current < blocks.size()) {
+                Block& block = blocks[current];
+                size_t start = (offset + align - 1) & ~(align - 1);
+                if (start + size <= block.size) {
+                    offset = start + size;
+                    return block.data.get() + start;
+                }
+                if (current + 1 < blocks.size()) {
+                    current++;
+                    offset = 0;
+                    continue;
+                }
+            }
+            size_t want = size + align > block_size ? size + align : block_size;
+            blocks.push_back({std::unique_ptr<char[]>(new char[want]), want});
+            current = blocks.size() - 1;
+            offset = 0;
+        }
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+    }
+
+    std::string_view copy(std::string_view text) {
+        char* dst = static_cast<char*>(allocate(text.size() + 1, 1));
+        memcpy(dst, text.data(), text.size());
+        dst[text.size()] = '\0';
+        return std::string_view(dst, text.size());
+    }
+
+    void reset() {
+        current = 0;
+        offset = 0;
+    }
+};
+
+// Aliases are looked up with string_view keys, so no std::string is built
+// per word during parsing
+using AliasTable = std::map<std::string, std::string, std::less<>>;
+
+// AST. Every node lives in an Arena and every string is a view into either
+// the parsed input or the arena.
+
+// A word exactly as written, quotes included. `plain` words contain nothing
+// that expansion would change and can be used verbatim.
+struct Word {
+    std::string_view text;
+    bool plain;
+    Word* next;
+};
+
+enum class RedirOp : uint8_t {
+    In,         // <
+    Out,        // >  >|
+    Append,     // >>
+    ReadWrite,  // <>
+    DupIn,      // <&
+    DupOut,     // >&
+    HereDoc,    // <<  <<-
+    HereString, // <<<
+};
+
+struct Redirect {
+    RedirOp op;
+    int fd;
+    // Target word, or the here-document body for HereDoc
+    std::string_view target;
+    // HereDoc only: the delimiter was quoted (no expansion in the body)
+    bool quoted;
+    // HereDoc only: <<- form, leading tabs are stripped from each line
+    bool strip_tabs;
+    Redirect* next;
+};
+
+struct List;
+
+// A simple command or, when `subshell` is set, a parenthesised list
+struct Command {
+    Word* words;
+    Redirect* redirects;
+    List* subshell;
+    Command* next;
+};
+
+// `perfstat [--json]` in front of a pipeline
+enum class Profile : uint8_t { None, Text, Json };
+
+struct Pipeline {
+    Command* commands;
+    size_t length;
+    bool negate;
+    Profile profile;
+};
+
+enum class Connector : uint8_t { None, And, Or };
+
+// One pipeline of an && / || chain; `connector` joins it to the previous one
+struct AndOr {
+    Pipeline* pipeline;
+    Connector connector;
+    AndOr* next;
+};
+
+struct ListEntry {
+    AndOr* chain;
+    bool background;
+    ListEntry* next;
+};
+
+struct List {
+    ListEntry* entries;
+};
+
+enum class TokenType : uint8_t {
+    Word,
+    Newline,
+    Semi,
+    Amp,
+    Pipe,
+    AndIf,
+    OrIf,
+    LParen,
+    RParen,
+    Redirect,
+    End,
+};
+
+struct Token {
+    TokenType type;
+    std::string_view text;
+    bool plain;
+    RedirOp redir;
+    bool strip_tabs;
+    int io_number;
+};
+
+enum class ParseStatus { Ok, Incomplete, Error };
+
+// Scanners for the quoted and substituted parts of a word, shared by the
+// lexer and by word expansion. Each takes the index of the opening
+// character and returns the index just past the closing one, or npos if
+// the input ends first.
+
+inline size_t scan_substitution(std::string_view s, size_t pos);
+
+// `...`
+inline size_t scan_backquote(std::string_view s, size_t pos) {
+    for (size_t i = pos + 1; i < s.size(); i++) {
+        if (s[i] == '\\') {
+            i++;
+        } else if (s[i] == '`') {
+            return i + 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+// "..."
+inline size_t scan_double_quote(std::string_view s, size_t pos) {
+    size_t i = pos + 1;
+    while (i < s.size() && s[i] != '"') {
+        if (s[i] == '\\') {
+            i += 2;
+        } else if (s[i] == '$' && i + 1 < s.size() && s[i + 1] == '(') {
+            i = scan_substitution(s, i);
+        } else if (s[i] == '`') {
+            i = scan_backquote(s, i);
+        } else {
+            i++;
+        }
+        if (i == std::string_view::npos) return i;
+    }
+    return i < s.size() ? i + 1 : std::string_view::npos;
+}
+
+// $(...), with nested quotes, substitutions and parentheses
+inline size_t scan_substitution(std::string_view s, size_t pos) {
+    int depth = 0;
+    size_t i = pos + 1;
+    while (i < s.size()) {
+        char c = s[i];
+        if (c == '\\') {
+            i += 2;
+        } else if (c == '\'') {
+            i = s.find('\'', i + 1);
+            if (i == std::string_view::npos) return i;
+            i++;
+        } else if (c == '"') {
+            i = scan_double_quote(s, i);
+        } else if (c == '`') {
+            i = scan_backquote(s, i);
+        } else if (c == '#' && (s[i - 1] == ' ' || s[i - 1] == '\t' || s[i - 1] == '\n')) {
+            i = s.find('\n', i);
+        } else if (c == '(') {
+            depth++;
+            i++;
+        } else if (c == ')') {
+            if (--depth == 0) return i + 1;
+            i++;
+        } else {
+            i++;
+        }
+        if (i == std::string_view::npos) return i;
+    }
+    return std::string_view::npos;
+}
+
+// Thrown inside the parser to unwind to Parser::parse()
+struct ParseStop {
+    ParseStatus status;
+    const char* message;
+};
+
+class Lexer {
+private:
+    std::string_view src;
+    size_t pos = 0;
+
+    static bool is_meta(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' ||
+               c == '|' || c == '(' || c == ')' || c == '<' || c == '>';
+    }
+
+    [[noreturn]] static void incomplete(const char* what) {
+        throw ParseStop{ParseStatus::Incomplete, what};
+    }
+
+    // Skip past a balanced ${...}, starting at the '{'
+    void skip_braces() {
+        int depth = 0;
+        while (pos < src.size()) {
+            char c = src[pos++];
+            if (c == '\\') {
+                pos++;
+            } else if (c == '{') {
+                depth++;
+            } else if (c == '}' && --depth == 0) {
+                return;
+            }
+        }
+        incomplete("unterminated ${");
+    }
+
+    Token scan_word() {
+        size_t start = pos;
+        bool plain = true;
+
+        while (pos < src.size() && !is_meta(src[pos])) {
+            char c = src[pos];
+            if (c == '\\') {
+                plain = false;
+                if (pos + 1 >= src.size()) incomplete("trailing backslash");
+                pos += 2;
+            } else if (c == '\'') {
+                plain = false;
+                size_t close = src.find('\'', pos + 1);
+                if (close == std::string_view::npos) incomplete("unterminated '");
+                pos = close + 1;
+            } else if (c == '"') {
+                plain = false;
+                pos = scan_double_quote(src, pos);
+                if (pos == std::string_view::npos) incomplete("unterminated \"");
+            } else if (c == '`') {
+                plain = false;
+                pos = scan_backquote(src, pos);
+                if (pos == std::string_view::npos) incomplete("unterminated `");
+            } else if (c == '$') {
+                plain = false;
+                if (pos + 1 < src.size() && src[pos + 1] == '(') {
+                    pos = scan_substitution(src, pos);
+                    if (pos == std::string_view::npos) incomplete("unterminated $(");
+                    continue;
+                }
+                pos++;
+                if (pos < src.size() && src[pos] == '{') skip_braces();
+            } else {
+                if (c == '~' && pos == start) plain = false;
+                if (c == '*' || c == '?' || c == '[' || c == '{') plain = false;
+                pos++;
+            }
+        }
+
+        return Token{TokenType::Word, src.substr(start, pos - start), plain, RedirOp::In, false, -1};
+    }
+
+    Token op(TokenType type, size_t len) {
+        Token tok{type, src.substr(pos, len), true, RedirOp::In, false, -1};
+        pos += len;
+        return tok;
+    }
+
+    Token redirect(RedirOp kind, size_t len, int io_number, bool strip_tabs = false) {
+        Token tok = op(TokenType::Redirect, len);
+        tok.redir = kind;
+        tok.io_number = io_number;
+        tok.strip_tabs = strip_tabs;
+        return tok;
+    }
+
+    Token scan_redirect(int io_number) {
+        char c = src[pos];
+        char n1 = pos + 1 < src.size() ? src[pos + 1] : '\0';
+        char n2 = pos + 2 < src.size() ? src[pos + 2] : '\0';
+
+        if (c == '<') {
+            if (n1 == '<' && n2 == '<') return redirect(RedirOp::HereString, 3, io_number);
+            if (n1 == '<' && n2 == '-') return redirect(RedirOp::HereDoc, 3, io_number, true);
+            if (n1 == '<') return redirect(RedirOp::HereDoc, 2, io_number);
+            if (n1 == '&') return redirect(RedirOp::DupIn, 2, io_number);
+            if (n1 == '>') return redirect(RedirOp::ReadWrite, 2, io_number);
+            return redirect(RedirOp::In, 1, io_number);
+        }
+        if (n1 == '>') return redirect(RedirOp::Append, 2, io_number);
+        if (n1 == '&') return redirect(RedirOp::DupOut, 2, io_number);
+        if (n1 == '|') return redirect(RedirOp::Out, 2, io_number);
+        return redirect(RedirOp::Out, 1, io_number);
+    }
+
+public:
+    explicit Lexer(std::string_view input = {}) : src(input) {}
+
+    size_t position() const { return pos; }
+    void seek(size_t p) { pos = p; }
+    std::string_view input() const { return src; }
+
+    Token next() {
+        // Blanks, line continuations and comments
+        while (pos < src.size()) {
+            char c = src[pos];
+            if (c == ' ' || c == '\t') {
+                pos++;
+            } else if (c == '\\' && pos + 1 < src.size() && src[pos + 1] == '\n') {
+                pos += 2;
+            } else if (c == '#') {
+                while (pos < src.size() && src[pos] != '\n') pos++;
+            } else {
+                break;
+            }
+        }
+
+        if (pos >= src.size()) return Token{TokenType::End, {}, true, RedirOp::In, false, -1};
+
+        char c = src[pos];
+        char n1 = pos + 1 < src.size() ? src[pos + 1] : '\0';
+        switch (c) {
+            case '\n': return op(TokenType::Newline, 1);
+            case ';': return op(TokenType::Semi, 1);
+            case '&': return n1 == '&' ? op(TokenType::AndIf, 2) : op(TokenType::Amp, 1);
+            case '|': return n1 == '|' ? op(TokenType::OrIf, 2) : op(TokenType::Pipe, 1);
+            case '(': return op(TokenType::LParen, 1);
+            case ')': return op(TokenType::RParen, 1);
+            case '<':
+            case '>': return scan_redirect(-1);
+            default: break;
+        }
+
+        // An unquoted run of digits directly before < or > is an fd number
+        size_t digits = pos;
+        while (digits < src.size() && src[digits] >= '0' && src[digits] <= '9') digits++;
+        if (digits > pos && digits - pos < 4 && digits < src.size() &&
+            (src[digits] == '<' || src[digits] == '>')) {
+            int fd = 0;
+            for (size_t i = pos; i < digits; i++) fd = fd * 10 + (src[i] - '0');
+            pos = digits;
+            return scan_redirect(fd);
+        }
+
+        return scan_word();
+    }
+};
+
+// Recursive-descent parser for the ash grammar:
+//
+//   list     := and_or (('; ' | '&' | NL) and_or)*
+//   and_or   := pipeline (('&&' | '||') NL* pipeline)*
+//   pipeline := ['perfstat' ['--json']] ['!'] command ('|' NL* command)*
+//   command  := '(' list ')' redirect* | (word | redirect)+
+//
+// Here-document bodies are read from the input after the next newline.
+// Incomplete input (open quote, trailing operator, missing here-doc body)
+// is reported as ParseStatus::Incomplete so an interactive caller can read
+// another line and parse the whole buffer again.
+class Parser {
+private:
+    static const int MAX_ALIAS_DEPTH = 8;
+    static const int MAX_HEREDOCS = 16;
+
+    Arena& arena;
+    const AliasTable* aliases;
+    bool at_eof = false;
+    const char* message = "";
+
+    // Lexer stack: alias values are lexed in place of the alias name
+    Lexer lexers[MAX_ALIAS_DEPTH + 1];
+    std::string_view expanding[MAX_ALIAS_DEPTH + 1];
+    int depth = 0;
+    Token tok{};
+
+    Redirect* pending[MAX_HEREDOCS];
+    int num_pending = 0;
+
+    [[noreturn]] void fail(const char* what) {
+        throw ParseStop{ParseStatus::Error, what};
+    }
+
+    // Running out of input mid-construct only means "read more" if more
+    // input can still come
+    [[noreturn]] void need_more(const char* what) {
+        throw ParseStop{at_eof ? ParseStatus::Error : ParseStatus::Incomplete, what};
+    }
+
+    void advance() {
+        if (tok.type == TokenType::Newline && depth == 0 && num_pending > 0) {
+            read_heredocs();
+        }
+        while (true) {
+            try {
+                tok = lexers[depth].next();
+            } catch (const ParseStop& stop) {
+                // An alias value can't be continued on the next line
+                if (depth > 0) fail(stop.message);
+                need_more(stop.message);
+            }
+            if (tok.type != TokenType::End || depth == 0) return;
+            depth--;
+        }
+    }
+
+    void skip_newlines() {
+        while (tok.type == TokenType::Newline) advance();
+    }
+
+    bool alias_active(std::string_view name) const {
+        for (int i = 1; i <= depth; i++) {
+            if (expanding[i] == name) return true;
+        }
+        return false;
+    }
+
+    // Replace an alias name at the start of a simple command with its value
+    void expand_alias() {
+        while (aliases && tok.type == TokenType::Word && tok.plain && depth < MAX_ALIAS_DEPTH &&
+               !alias_active(tok.text)) {
+            auto it = aliases->find(tok.text);
+            if (it == aliases->end()) return;
+
+            // Copy: the alias may be redefined before this line finishes
+            std::string_view value = arena.copy(it->second);
+            depth++;
+            lexers[depth] = Lexer(value);
+            expanding[depth] = tok.text;
+            tok = Token{TokenType::Semi, {}, true, RedirOp::In, false, -1};
+            advance();
+        }
+    }
+
+    // Quote removal for here-document delimiters
+    std::string_view unquote(std::string_view word) {
+        char* out = static_cast<char*>(arena.allocate(word.size() + 1, 1));
+        size_t len = 0;
+        char quote = '\0';
+        for (size_t i = 0; i < word.size(); i++) {
+            char c = word[i];
+            if (quote) {
+                if (c == quote) quote = '\0';
+                else out[len++] = c;
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+            } else if (c == '\\' && i + 1 < word.size()) {
+                out[len++] = word[++i];
+            } else {
+                out[len++] = c;
+            }
+        }
+        out[len] = '\0';
+        return std::string_view(out, len);
+    }
+
+    void read_heredocs() {
+        Lexer& base = lexers[0];
+        std::string_view src = base.input();
+        size_t pos = base.position();
+
+        for (int i = 0; i < num_pending; i++) {
+            Redirect* r = pending[i];
+            std::string_view delim = r->target;
+            size_t body_start = pos;
+            bool found = false;
+
+            while (pos < src.size()) {
+                size_t eol = src.find('\n', pos);
+                if (eol == std::string_view::npos) eol = src.size();
+                std::string_view line = src.substr(pos, eol - pos);
+                if (r->strip_tabs) {
+                    while (!line.empty() && line[0] == '\t') line.remove_prefix(1);
+                }
+                if (line == delim) {
+                    r->target = src.substr(body_start, pos - body_start);
+                    pos = eol < src.size() ? eol + 1 : eol;
+                    found = true;
+                    break;
+                }
+                pos = eol < src.size() ? eol + 1 : eol;
+            }
+
+            if (!found) {
+                if (!at_eof) throw ParseStop{ParseStatus::Incomplete, "here-document"};
+                r->target = src.substr(body_start);
+            }
+        }
+
+        num_pending = 0;
+        base.seek(pos);
+    }
+
+    Redirect* parse_redirect() {
+        Redirect* r = arena.make<Redirect>();
+        r->op = tok.redir;
+        r->strip_tabs = tok.strip_tabs;
+        r->fd = tok.io_number >= 0 ? tok.io_number
+              : (r->op == RedirOp::In || r->op == RedirOp::DupIn || r->op == RedirOp::ReadWrite ||
+                 r->op == RedirOp::HereDoc || r->op == RedirOp::HereString) ? 0 : 1;
+        advance();
+
+        if (tok.type != TokenType::Word) {
+            if (tok.type == TokenType::End) need_more("expected word after redirection");
+            fail("expected word after redirection");
+        }
+
+        if (r->op == RedirOp::HereDoc) {
+            if (num_pending == MAX_HEREDOCS) fail("too many here-documents");
+            r->quoted = !tok.plain;
+            r->target = tok.plain ? tok.text : unquote(tok.text);
+            pending[num_pending++] = r;
+        } else {
+            r->target = tok.text;
+        }
+        advance();
+        return r;
+    }
+
+    Command* parse_command() {
+        Command* cmd = arena.make<Command>();
+        Redirect** redir_tail = &cmd->redirects;
+
+        if (tok.type == TokenType::LParen) {
+            advance();
+            cmd->subshell = parse_list(true);
+            if (tok.type != TokenType::RParen) {
+                if (tok.type == TokenType::End) need_more("expected )");
+                fail("expected )");
+            }
+            advance();
+        } else {
+            expand_alias();
+            Word** word_tail = &cmd->words;
+            while (true) {
+                if (tok.type == TokenType::Word) {
+                    *word_tail = arena.make<Word>(Word{tok.text, tok.plain, nullptr});
+                    word_tail = &(*word_tail)->next;
+                    advance();
+                } else if (tok.type == TokenType::Redirect) {
+                    *redir_tail = parse_redirect();
+                    redir_tail = &(*redir_tail)->next;
+                } else {
+                    break;
+                }
+            }
+            if (!cmd->words && !cmd->redirects) {
+                if (tok.type == TokenType::End) need_more("unexpected end of input");
+                fail("syntax error near unexpected token");
+            }
+            return cmd;
+        }
+
+        while (tok.type == TokenType::Redirect) {
+            *redir_tail = parse_redirect();
+            redir_tail = &(*redir_tail)->next;
+        }
+        return cmd;
+    }
+
+    Pipeline* parse_pipeline() {
+        Pipeline* p = arena.make<Pipeline>();
+        if (tok.type == TokenType::Word && tok.plain && tok.text == "perfstat") {
+            p->profile = Profile::Text;
+            advance();
+            if (tok.type == TokenType::Word && tok.plain && tok.text == "--json") {
+                p->profile = Profile::Json;
+                advance();
+            }
+        }
+        if (tok.type == TokenType::Word && tok.plain && tok.text == "!") {
+            p->negate = true;
+            advance();
+        }
+
+        Command** tail = &p->commands;
+        while (true) {
+            *tail = parse_command();
+            tail = &(*tail)->next;
+            p->length++;
+            if (tok.type != TokenType::Pipe) break;
+            advance();
+            skip_newlines();
+        }
+        return p;
+    }
+
+    AndOr* parse_and_or() {
+        AndOr* head = arena.make<AndOr>(AndOr{parse_pipeline(), Connector::None, nullptr});
+        AndOr* tail = head;
+        while (tok.type == TokenType::AndIf || tok.type == TokenType::OrIf) {
+            Connector c = tok.type == TokenType::AndIf ? Connector::And : Connector::Or;
+            advance();
+            skip_newlines();
+            tail->next = arena.make<AndOr>(AndOr{parse_pipeline(), c, nullptr});
+            tail = tail->next;
+        }
+        return head;
+    }
+
+    List* parse_list(bool subshell) {
+        List* list = arena.make<List>();
+        ListEntry** tail = &list->entries;
+        skip_newlines();
+
+        while (tok.type != TokenType::End && !(subshell && tok.type == TokenType::RParen)) {
+            ListEntry* entry = arena.make<ListEntry>(ListEntry{parse_and_or(), false, nullptr});
+            *tail = entry;
+            tail = &entry->next;
+
+            if (tok.type == TokenType::Amp) {
+                entry->background = true;
+                advance();
+            } else if (tok.type == TokenType::Semi || tok.type == TokenType::Newline) {
+                advance();
+            } else if (tok.type != TokenType::End && tok.type != TokenType::RParen) {
+                fail("syntax error near unexpected token");
+            }
+            skip_newlines();
+        }
+
+        if (subshell && !list->entries) {
+            if (tok.type == TokenType::End) need_more("expected command");
+            fail("syntax error near unexpected token )");
+        }
+        return list;
+    }
+
+public:
+    explicit Parser(Arena& a, const AliasTable* table = nullptr) : arena(a), aliases(table) {}
+
+    const char* error() const { return message; }
+
+    // Parse a complete input buffer. With `eof` set, running out of input
+    // is a syntax error instead of ParseStatus::Incomplete.
+    ParseStatus parse(std::string_view input, bool eof, List*& program) {
+        at_eof = eof;
+        depth = 0;
+        num_pending = 0;
+        message = "";
+        lexers[0] = Lexer(input);
+        tok = Token{TokenType::Semi, {}, true, RedirOp::In, false, -1};
+
+        try {
+            advance();
+            program = parse_list(false);
+            if (num_pending > 0) {
+                tok = Token{TokenType::Newline, {}, true, RedirOp::In, false, -1};
+                read_heredocs();
+            }
+        } catch (const ParseStop& stop) {
+            message = stop.message;
+            program = nullptr;
+            return stop.status;
+        }
+        return ParseStatus::Ok;
+    }
+};
+
+} // namespace Ash
+
+#endif // COMMAND_INTERPRETER_HPP
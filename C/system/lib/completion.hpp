@@ -0,0 +1,345 @@
+#ifndef COMPLETION_HPP
+#define COMPLETION_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+namespace Ash {
+
+// Byte trie of command names. A name can come from several PATH
+// directories, so terminal nodes are reference counted; erased names leave
+// their nodes behind until the next clear().
+class CommandTrie {
+private:
+    struct Node {
+        std::vector<std::pair<char, uint32_t>> children;
+        uint32_t refs = 0;
+    };
+
+    std::vector<Node> nodes{1};
+
+    uint32_t child(uint32_t node, char c) const {
+        const auto& children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, uint32_t(0)),
+                                   [](const auto& a, const auto& b) { return a.first < b.first; });
+        return it != children.end() && it->first == c ? it->second : 0;
+    }
+
+    void collect(uint32_t node, std::string& prefix, std::vector<std::string>& out) const {
+        if (nodes[node].refs > 0) out.push_back(prefix);
+        for (const auto& edge : nodes[node].children) {
+            prefix.push_back(edge.first);
+            collect(edge.second, prefix, out);
+            prefix.pop_back();
+        }
+    }
+
+public:
+    void insert(std::string_view name) {
+        uint32_t node = 0;
+        for (char c : name) {
+            uint32_t next = child(node, c);
+            if (!next) {
+                next = static_cast<uint32_t>(nodes.size());
+                nodes.emplace_back();
+                auto& children = nodes[node].children;
+                auto pos = std::lower_bound(children.begin(), children.end(), std::make_pair(c, uint32_t(0)),
+                                            [](const auto& a, const auto& b) { return a.first < b.first; });
+                children.insert(pos, {c, next});
+            }
+            node = next;
+        }
+        nodes[node].refs++;
+    }
+
+    void erase(std::string_view name) {
+        uint32_t node = 0;
+        for (char c : name) {
+            node = child(node, c);
+            if (!node) return;
+        }
+        if (nodes[node].refs > 0) nodes[node].refs--;
+    }
+
+    void clear() {
+        nodes.clear();
+        nodes.emplace_back();
+    }
+
+    // Every name starting with `prefix`, in byte order
+    void complete(std::string_view prefix, std::vector<std::string>& out) const {
+        uint32_t node = 0;
+        for (char c : prefix) {
+            node = child(node, c);
+            if (!node) return;
+        }
+        std::string name(prefix);
+        collect(node, name, out);
+    }
+};
+
+// Tab completion data for ash. Command names come from a trie of every
+// executable on $PATH plus the names registered with add_static(); the
+// trie is built on first use and then kept current through inotify
+// watches on the PATH directories instead of rescanning them. Filename
+// completion reads directories through a small LRU cache that is
+// revalidated with a single stat of the directory.
+class CompletionEngine {
+private:
+    struct PathDir {
+        std::string path;
+        int wd;
+        std::unordered_set<std::string> names;
+    };
+
+    struct Listing {
+        std::string path;
+        struct timespec mtime;
+        std::vector<std::string> names;
+        std::vector<bool> is_dir;
+        uint64_t last_used;
+    };
+
+    static const size_t MAX_LISTINGS = 16;
+
+    CommandTrie trie;
+    std::vector<std::string> statics;
+    std::vector<PathDir> dirs;
+    std::string path_value;
+    bool loaded = false;
+    int inotify_fd = -1;
+
+    std::vector<Listing> listings;
+    uint64_t clock = 0;
+
+    static bool is_executable(int dirfd, const char* name) {
+        struct stat st;
+        return fstatat(dirfd, name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111);
+    }
+
+    void scan(PathDir& dir) {
+        int dirfd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd < 0) return;
+        DIR* d = fdopendir(dirfd);
+        if (!d) {
+            close(dirfd);
+            return;
+        }
+        while (struct dirent* entry = readdir(d)) {
+            if (entry->d_name[0] == '.') continue;
+            if (entry->d_type == DT_DIR) continue;
+            if (is_executable(dirfd, entry->d_name) && dir.names.insert(entry->d_name).second) {
+                trie.insert(entry->d_name);
+            }
+        }
+        closedir(d);
+    }
+
+    void rebuild() {
+        const char* env = getenv("PATH");
+        path_value = env ? env : "/bin:/usr/bin";
+        loaded = true;
+
+        if (inotify_fd >= 0) close(inotify_fd);
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        trie.clear();
+        dirs.clear();
+        for (const auto& name : statics) trie.insert(name);
+
+        size_t start = 0;
+        while (start <= path_value.size()) {
+            size_t end = path_value.find(':', start);
+            if (end == std::string::npos) end = path_value.size();
+            std::string path = path_value.substr(start, end - start);
+            start = end + 1;
+            if (path.empty()) path = ".";
+
+            bool seen = false;
+            for (const auto& dir : dirs) seen = seen || dir.path == path;
+            if (seen) continue;
+
+            int wd = inotify_fd < 0 ? -1
+                   : inotify_add_watch(inotify_fd, path.c_str(),
+                                       IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                       IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+            dirs.push_back({path, wd, {}});
+            scan(dirs.back());
+        }
+    }
+
+    void ensure_current() {
+        const char* env = getenv("PATH");
+        if (!loaded || path_value != (env ? env : "/bin:/usr/bin")) rebuild();
+    }
+
+    void apply_event(const struct inotify_event* ev) {
+        if (ev->mask & IN_Q_OVERFLOW) {
+            loaded = false;
+            return;
+        }
+        for (auto& dir : dirs) {
+            if (dir.wd != ev->wd) continue;
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                for (const auto& name : dir.names) trie.erase(name);
+                dir.names.clear();
+                dir.wd = -1;
+                return;
+            }
+            if (ev->len == 0 || ev->name[0] == '.') return;
+
+            std::string name = ev->name;
+            bool present = dir.names.count(name) != 0;
+            bool wanted = false;
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) {
+                int dirfd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (dirfd >= 0) {
+                    wanted = is_executable(dirfd, name.c_str());
+                    close(dirfd);
+                }
+            }
+            if (wanted && !present) {
+                dir.names.insert(name);
+                trie.insert(name);
+            } else if (!wanted && present) {
+                dir.names.erase(name);
+                trie.erase(name);
+            }
+            return;
+        }
+    }
+
+    const Listing* listing(const std::string& path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return nullptr;
+
+        Listing* slot = nullptr;
+        for (auto& l : listings) {
+            if (l.path == path) {
+                slot = &l;
+                break;
+            }
+        }
+        if (slot && slot->mtime.tv_sec == st.st_mtim.tv_sec && slot->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            slot->last_used = ++clock;
+            return slot;
+        }
+
+        if (!slot) {
+            if (listings.size() < MAX_LISTINGS) {
+                listings.emplace_back();
+                slot = &listings.back();
+            } else {
+                slot = &*std::min_element(listings.begin(), listings.end(),
+                                          [](const Listing& a, const Listing& b) { return a.last_used < b.last_used; });
+            }
+        }
+
+        DIR* d = opendir(path.c_str());
+        if (!d) return nullptr;
+        std::vector<std::pair<std::string, bool>> entries;
+        while (struct dirent* entry = readdir(d)) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            bool is_dir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                struct stat est;
+                is_dir = fstatat(dirfd(d), entry->d_name, &est, 0) == 0 && S_ISDIR(est.st_mode);
+            }
+            entries.emplace_back(entry->d_name, is_dir);
+        }
+        closedir(d);
+        std::sort(entries.begin(), entries.end());
+
+        slot->path = path;
+        slot->mtime = st.st_mtim;
+        slot->last_used = ++clock;
+        slot->names.clear();
+        slot->is_dir.clear();
+        for (auto& entry : entries) {
+            slot->names.push_back(std::move(entry.first));
+            slot->is_dir.push_back(entry.second);
+        }
+        return slot;
+    }
+
+public:
+    CompletionEngine() = default;
+    ~CompletionEngine() {
+        if (inotify_fd >= 0) close(inotify_fd);
+    }
+
+    CompletionEngine(const CompletionEngine&) = delete;
+    CompletionEngine& operator=(const CompletionEngine&) = delete;
+
+    // Builtins and other names that are commands without being files
+    void add_static(const std::string& name) {
+        statics.push_back(name);
+        if (loaded) trie.insert(name);
+    }
+
+    // inotify descriptor for the caller's event loop; -1 until the first
+    // completion builds the index
+    int fd() const { return inotify_fd; }
+
+    void process_events() {
+        alignas(struct inotify_event) char buf[8192];
+        ssize_t n;
+        while (inotify_fd >= 0 && (n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + n;) {
+                auto* ev = reinterpret_cast<struct inotify_event*>(p);
+                apply_event(ev);
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+
+    void commands(std::string_view prefix, std::vector<std::string>& out) {
+        process_events();
+        ensure_current();
+        trie.complete(prefix, out);
+    }
+
+    // Paths completing `text`; directories get a trailing '/'
+    void files(std::string_view text, std::vector<std::string>& out) {
+        size_t slash = text.rfind('/');
+        std::string_view dir_part = slash == std::string_view::npos ? std::string_view() : text.substr(0, slash + 1);
+        std::string_view base = text.substr(dir_part.size());
+
+        std::string path;
+        if (dir_part.empty()) {
+            path = ".";
+        } else if (dir_part.substr(0, 2) == "~/") {
+            const char* home = getenv("HOME");
+            path = std::string(home ? home : "") + std::string(dir_part.substr(1));
+        } else {
+            path = std::string(dir_part);
+        }
+
+        const Listing* l = listing(path);
+        if (!l) return;
+        auto it = std::lower_bound(l->names.begin(), l->names.end(), base,
+                                   [](const std::string& a, std::string_view b) { return std::string_view(a) < b; });
+        for (; it != l->names.end() && std::string_view(*it).substr(0, base.size()) == base; ++it) {
+            if ((*it)[0] == '.' && (base.empty() || base[0] != '.')) continue;
+            std::string match(dir_part);
+            match += *it;
+            if (l->is_dir[it - l->names.begin()]) match += '/';
+            out.push_back(std::move(match));
+        }
+    }
+};
+
+} // namespace Ash
+
+#endif // COMPLETION_HPP
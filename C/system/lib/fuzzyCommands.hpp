@@ -0,0 +1,111 @@
+#ifndef FUZZY_COMMANDS_HPP
+#define FUZZY_COMMANDS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include "fuzzylib.hpp"
+
+namespace FuzzyBox {
+
+struct CommandEntry {
+    std::string_view name;
+    std::unique_ptr<Command> (*make)();
+};
+
+template <typename T>
+std::unique_ptr<Command> make_command() {
+    return std::make_unique<T>();
+}
+
+// Every fuzzylib command. ash serves these in-process and fuzzybox
+// dispatches on them; add new commands here.
+inline constexpr CommandEntry command_list[] = {
+    {"cat", make_command<Commands::CatCommand>},
+    {"ls", make_command<Commands::LsCommand>},
+    {"cp", make_command<Commands::CpCommand>},
+    {"mv", make_command<Commands::MvCommand>},
+    {"rm", make_command<Commands::RmCommand>},
+    {"mkdir", make_command<Commands::MkdirCommand>},
+    {"pwd", make_command<Commands::PwdCommand>},
+    {"cd", make_command<Commands::CdCommand>},
+    {"echo", make_command<Commands::EchoCommand>},
+    {"find", make_command<Commands::FindCommand>},
+    {"grep", make_command<Commands::GrepCommand>},
+    {"du", make_command<Commands::DuCommand>},
+    {"sort", make_command<Commands::SortCommand>},
+    {"wc", make_command<Commands::WcCommand>},
+    {"sha256sum", make_command<Commands::Sha256SumCommand>},
+    {"tar", make_command<Commands::TarCommand>},
+};
+
+inline constexpr size_t command_count = sizeof(command_list) / sizeof(command_list[0]);
+
+// The lookup table is a perfect hash built by the compiler: FNV-1a with a
+// seed it searches for until every name lands in its own slot, so a
+// lookup is one hash, one slot and one string compare.
+namespace Detail {
+
+constexpr uint32_t command_hash(std::string_view name, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+constexpr size_t table_size() {
+    size_t size = 1;
+    while (size < command_count * 2) size <<= 1;
+    return size;
+}
+
+inline constexpr size_t TABLE_SIZE = table_size();
+
+constexpr bool seed_works(uint32_t seed) {
+    bool used[TABLE_SIZE] = {};
+    for (const auto& entry : command_list) {
+        size_t slot = command_hash(entry.name, seed) & (TABLE_SIZE - 1);
+        if (used[slot]) return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t find_seed() {
+    for (uint32_t seed = 1; seed < 100000; seed++) {
+        if (seed_works(seed)) return seed;
+    }
+    return 0;
+}
+
+inline constexpr uint32_t SEED = find_seed();
+static_assert(SEED != 0, "no perfect hash seed for the fuzzylib command names");
+
+struct Slots {
+    int8_t index[TABLE_SIZE];
+};
+
+constexpr Slots build_slots() {
+    Slots slots = {};
+    for (size_t i = 0; i < TABLE_SIZE; i++) slots.index[i] = -1;
+    for (size_t i = 0; i < command_count; i++) {
+        slots.index[command_hash(command_list[i].name, SEED) & (TABLE_SIZE - 1)] = static_cast<int8_t>(i);
+    }
+    return slots;
+}
+
+inline constexpr Slots SLOTS = build_slots();
+
+} // namespace Detail
+
+inline const CommandEntry* find_command(std::string_view name) {
+    int8_t i = Detail::SLOTS.index[Detail::command_hash(name, Detail::SEED) & (Detail::TABLE_SIZE - 1)];
+    return i >= 0 && command_list[i].name == name ? &command_list[i] : nullptr;
+}
+
+} // namespace FuzzyBox
+
+#endif // FUZZY_COMMANDS_HPP
@@ -0,0 +1,366 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include "fuzzyOutput.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+struct DuOptions {
+    bool human = false;
+    bool apparent = false;
+    bool one_fs = false;
+    int max_depth = INT_MAX;
+};
+
+// One directory of the tree. Its total starts as its own size, gains its
+// files when it is read, and gains each subdirectory's total when that
+// one finishes. The last of those to finish hands the total up in turn,
+// so the sums flow up the tree without locks.
+struct DirNode {
+    DirNode* parent = nullptr;
+    std::string path;
+    int depth = 0;
+    // Operand index, then the entry index within each directory down to
+    // this one: comparing these orders names as a sequential walk would
+    std::vector<uint32_t> order;
+    uint64_t dev = 0;
+    std::atomic<uint64_t> total{0};
+    std::atomic<int> pending{1};
+    std::vector<std::unique_ptr<DirNode>> children; // only touched by this node's own scan
+};
+
+struct InodeKey {
+    uint64_t dev;
+    uint64_t ino;
+    bool operator==(const InodeKey& other) const { return dev == other.dev && ino == other.ino; }
+};
+
+struct InodeKeyHash {
+    size_t operator()(const InodeKey& k) const { return std::hash<uint64_t>()(k.ino * 0x9e3779b97f4a7c15ull ^ k.dev); }
+};
+
+// Inodes with more than one link, so each is counted once however many
+// names it has. The size goes to the name a sequential depth-first walk
+// (GNU du's) meets first; workers meet the names in any order, so each
+// inode keeps its earliest claim until the walk is over. Lock striping
+// keeps workers from queueing on one mutex.
+class InodeClaims {
+public:
+    struct Claim {
+        std::vector<uint32_t> order;
+        DirNode* node; // charged directory, or null for a file operand
+        size_t file;   // index of that file operand
+        uint64_t size;
+    };
+
+private:
+    static const size_t SHARDS = 64;
+
+    struct Shard {
+        std::mutex lock;
+        std::unordered_map<InodeKey, Claim, InodeKeyHash> claims;
+    };
+
+    Shard shards[SHARDS];
+
+public:
+    void claim(uint64_t dev, uint64_t ino, Claim claim) {
+        InodeKey key{dev, ino};
+        Shard& shard = shards[InodeKeyHash()(key) % SHARDS];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto found = shard.claims.try_emplace(key, claim);
+        if (!found.second && claim.order < found.first->second.order) found.first->second = std::move(claim);
+    }
+
+    // After the walk, with no workers left
+    template <typename Fn>
+    void for_each(Fn&& fn) {
+        for (auto& shard : shards) {
+            for (auto& entry : shard.claims) fn(entry.second);
+        }
+    }
+};
+
+uint64_t device(const struct statx& stx) {
+    return (static_cast<uint64_t>(stx.stx_dev_major) << 32) | stx.stx_dev_minor;
+}
+
+// Rounded up like GNU du: one decimal below 10, whole units above
+std::string human_size(uint64_t bytes) {
+    if (bytes < 1024) return std::to_string(bytes);
+    static const char units[] = "KMGTPE";
+    double value = static_cast<double>(bytes);
+    int unit = -1;
+    while (value >= 1024 && unit < 5) {
+        value /= 1024;
+        unit++;
+    }
+    char text[32];
+    if (value < 10) {
+        double tenths = std::ceil(value * 10) / 10;
+        if (tenths < 10) {
+            snprintf(text, sizeof(text), "%.1f%c", tenths, units[unit]);
+            return text;
+        }
+        value = tenths;
+    }
+    uint64_t whole = static_cast<uint64_t>(std::ceil(value));
+    if (whole >= 1024 && unit < 5) {
+        snprintf(text, sizeof(text), "1.0%c", units[unit + 1]);
+        return text;
+    }
+    snprintf(text, sizeof(text), "%llu%c", static_cast<unsigned long long>(whole), units[unit]);
+    return text;
+}
+
+// A file operand, printed in place among the directory operands
+struct FileOperand {
+    size_t before; // index of the directory operand that follows it
+    uint32_t operand;
+    std::string path;
+    uint64_t size;
+};
+
+class DiskUsage {
+private:
+    DuOptions opts;
+    unsigned mask;
+    WorkPool pool;
+    InodeClaims inodes;
+    uint32_t operands = 0;
+    std::mutex lock;
+    std::atomic<bool> failed{false};
+    std::vector<std::unique_ptr<DirNode>> roots;
+    std::vector<FileOperand> files;
+    // Each operand's own inode. Operands that overlap are counted once, by
+    // whichever a sequential walk reaches first: an earlier operand met
+    // inside a later one's tree is left out of it, and a later operand
+    // met inside an earlier one is dropped.
+    std::unordered_map<InodeKey, uint32_t, InodeKeyHash> operand_inodes;
+    std::unique_ptr<std::atomic<bool>[]> dropped;
+
+    void error(const std::string& what, const std::string& path, int err) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::cerr << "du: " << what << " '" << path << "': " << strerror(err) << "\n";
+        failed = true;
+    }
+
+    uint64_t size_of(const struct statx& stx) const {
+        return opts.apparent ? stx.stx_size : stx.stx_blocks * 512;
+    }
+
+    bool multi_linked(const struct statx& stx) const { return stx.stx_nlink > 1 && !S_ISDIR(stx.stx_mode); }
+
+    // Whether an entry met in the walk of `operand` was already counted
+    bool counted_before(const struct statx& stx, uint32_t operand) {
+        if (operand_inodes.size() < 2) return false;
+        auto found = operand_inodes.find({device(stx), stx.stx_ino});
+        if (found == operand_inodes.end()) return false;
+        if (found->second < operand) return true;
+        dropped[found->second] = true;
+        return false;
+    }
+
+    void complete(DirNode* node) {
+        while (node && node->pending.fetch_sub(1) == 1) {
+            if (node->parent) node->parent->total.fetch_add(node->total.load());
+            node = node->parent;
+        }
+    }
+
+    void scan(DirNode* node) {
+        int fd = open(node->path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            error("cannot read directory", node->path, errno);
+            complete(node);
+            return;
+        }
+        std::string prefix = node->path.back() == '/' ? node->path : node->path + "/";
+        uint64_t sum = 0;
+        uint32_t index = 0;
+        bool ok = read_dirents(fd, [&](const char* name, unsigned char) {
+            if (is_dot_or_dotdot(name)) return;
+            index++;
+            struct statx stx;
+            if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) != 0) {
+                error("cannot access", prefix + name, errno);
+                return;
+            }
+            if (counted_before(stx, node->order[0])) return;
+            if (S_ISDIR(stx.stx_mode)) {
+                if (opts.one_fs && device(stx) != node->dev) return;
+                auto child = std::make_unique<DirNode>();
+                child->parent = node;
+                child->path = prefix + name;
+                child->depth = node->depth + 1;
+                child->order = node->order;
+                child->order.push_back(index);
+                child->dev = node->dev;
+                child->total = size_of(stx);
+                DirNode* raw = child.get();
+                node->children.push_back(std::move(child));
+                node->pending++;
+                pool.push([this, raw] { scan(raw); });
+            } else if (multi_linked(stx)) {
+                std::vector<uint32_t> order = node->order;
+                order.push_back(index);
+                inodes.claim(device(stx), stx.stx_ino, {std::move(order), node, 0, size_of(stx)});
+            } else {
+                sum += size_of(stx);
+            }
+        });
+        if (!ok) error("cannot read directory", node->path, errno);
+        close(fd);
+        node->total.fetch_add(sum);
+        complete(node);
+    }
+
+    void print(Output& out, const std::string& path, uint64_t bytes) {
+        std::string size = opts.human ? human_size(bytes) : std::to_string((bytes + 1023) / 1024);
+        out.write_parts({size, "\t", path, "\n"});
+    }
+
+    // Subdirectories before their parent, in the order they were read
+    void print_tree(Output& out, const DirNode& node) {
+        for (const auto& child : node.children) print_tree(out, *child);
+        if (node.depth <= opts.max_depth) print(out, node.path, node.total.load());
+    }
+
+public:
+    explicit DiskUsage(const DuOptions& o)
+        : opts(o), mask(STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | (o.apparent ? STATX_SIZE : STATX_BLOCKS)) {}
+
+    void add(const std::string& path) {
+        struct statx stx;
+        if (statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) != 0) {
+            error("cannot access", path, errno);
+            return;
+        }
+        uint32_t operand = operands;
+        if (!operand_inodes.try_emplace({device(stx), stx.stx_ino}, operand).second) return;
+        operands++;
+        if (!S_ISDIR(stx.stx_mode)) {
+            if (multi_linked(stx)) inodes.claim(device(stx), stx.stx_ino, {{operand}, nullptr, files.size(), size_of(stx)});
+            files.push_back({roots.size(), operand, path, multi_linked(stx) ? 0 : size_of(stx)});
+            return;
+        }
+        auto root = std::make_unique<DirNode>();
+        root->path = path;
+        root->order = {operand};
+        root->dev = device(stx);
+        root->total = size_of(stx);
+        roots.push_back(std::move(root));
+    }
+
+    // Walk every operand added so far, then print them in order
+    int run() {
+        dropped.reset(new std::atomic<bool>[operands]());
+        for (auto& root : roots) {
+            DirNode* raw = root.get();
+            pool.push([this, raw] { scan(raw); });
+        }
+        pool.run();
+        inodes.for_each([&](const InodeClaims::Claim& claim) {
+            if (!claim.node) files[claim.file].size += claim.size;
+            for (DirNode* node = claim.node; node; node = node->parent) node->total.fetch_add(claim.size);
+        });
+        Output out;
+        size_t next_file = 0;
+        for (size_t i = 0; i <= roots.size(); i++) {
+            for (; next_file < files.size() && files[next_file].before == i; next_file++) {
+                const FileOperand& file = files[next_file];
+                if (!dropped[file.operand]) print(out, file.path, file.size);
+            }
+            if (i < roots.size() && !dropped[roots[i]->order[0]]) print_tree(out, *roots[i]);
+        }
+        out.flush();
+        return failed ? 1 : 0;
+    }
+};
+
+bool parse_depth(const std::string& text, int& depth) {
+    char* end;
+    errno = 0;
+    long value = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || errno != 0 || value < 0 || value > INT_MAX) {
+        std::cerr << "du: invalid maximum depth '" << text << "'\n";
+        return false;
+    }
+    depth = static_cast<int>(value);
+    return true;
+}
+
+} // namespace
+
+int DuCommand::execute(const std::vector<std::string>& args) {
+    DuOptions opts;
+    std::vector<std::string> operands;
+    bool options = true;
+    for (size_t a = 0; a < args.size(); a++) {
+        const std::string& arg = args[a];
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && arg == "--apparent-size") {
+            opts.apparent = true;
+        } else if (options && arg.compare(0, 12, "--max-depth=") == 0) {
+            if (!parse_depth(arg.substr(12), opts.max_depth)) return 1;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                switch (arg[i]) {
+                    case 's': opts.max_depth = 0; break;
+                    case 'h': opts.human = true; break;
+                    case 'x': opts.one_fs = true; break;
+                    case 'd': {
+                        std::string value = arg.substr(i + 1);
+                        if (value.empty()) {
+                            if (++a == args.size()) {
+                                std::cerr << "du: option requires an argument -- 'd'\n";
+                                return 1;
+                            }
+                            value = args[a];
+                        }
+                        if (!parse_depth(value, opts.max_depth)) return 1;
+                        i = arg.size();
+                        break;
+                    }
+                    default:
+                        std::cerr << "du: invalid option -- '" << arg[i] << "'\n"
+                                  << "Usage: du [-hsx] [-d depth] [--apparent-size] [file...]\n";
+                        return 1;
+                }
+            }
+        } else {
+            operands.push_back(arg);
+        }
+    }
+    if (operands.empty()) operands.push_back(".");
+
+    DiskUsage usage(opts);
+    for (const auto& path : operands) usage.add(path);
+    return usage.run();
+}
+
+std::string DuCommand::help() const {
+    return "Estimate disk usage (-h -s -x -d depth --apparent-size)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
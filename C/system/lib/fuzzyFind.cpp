@@ -0,0 +1,566 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include "fuzzyOutput.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+// Bytes of paths collected before an `-exec ... {} +` batch runs
+const size_t EXEC_BATCH_BYTES = 128 << 10;
+
+// One step of a compiled find expression. The program runs top to bottom
+// over a single truth value; -a and -o compile to conditional jumps past
+// their right-hand side, which is how they short-circuit.
+enum class Op : uint8_t {
+    Name,        // arg: pattern index
+    Type,        // value: bitmask of DT_* types
+    Size,        // value: size, unit in arg, cmp
+    Mtime,       // value: days, cmp
+    Newer,       // value: nanoseconds since the epoch
+    Prune,
+    Print,
+    Print0,
+    Exec,        // arg: exec index
+    True,
+    False,
+    Not,
+    JumpIfFalse, // arg: target
+    JumpIfTrue,  // arg: target
+};
+
+struct Insn {
+    Op op;
+    int cmp = 0; // -1 for -N, +1 for +N, 0 for exactly N
+    uint32_t arg = 0;
+    int64_t value = 0;
+};
+
+struct ExecAction {
+    std::vector<std::string> argv; // with "{}" where the path goes
+    bool batch = false;            // `+` rather than `;`
+};
+
+struct Program {
+    std::vector<Insn> code;
+    std::vector<std::string> patterns;
+    std::vector<ExecAction> execs;
+    int min_depth = 0;
+    int max_depth = -1;
+    bool unordered = false;
+};
+
+class ExprParser {
+private:
+    const std::vector<std::string>& tokens;
+    size_t pos;
+    Program& program;
+    std::string error;
+    bool has_action = false;
+
+    bool at_end() const { return pos >= tokens.size(); }
+    const std::string& peek() const { return tokens[pos]; }
+
+    void emit(Op op, uint32_t arg = 0, int64_t value = 0, int cmp = 0) {
+        program.code.push_back({op, cmp, arg, value});
+    }
+
+    bool fail(const std::string& message) {
+        if (error.empty()) error = message;
+        return false;
+    }
+
+    bool argument(const std::string& primary, std::string& out) {
+        if (at_end()) return fail("missing argument to `" + primary + "'");
+        out = tokens[pos++];
+        return true;
+    }
+
+    // "+N", "-N" or "N"
+    static bool numeric(const std::string& text, int& cmp, int64_t& value, std::string& suffix) {
+        size_t i = 0;
+        cmp = 0;
+        if (!text.empty() && (text[0] == '+' || text[0] == '-')) {
+            cmp = text[0] == '+' ? 1 : -1;
+            i = 1;
+        }
+        if (i >= text.size() || !isdigit(static_cast<unsigned char>(text[i]))) return false;
+        char* end;
+        value = strtoll(text.c_str() + i, &end, 10);
+        suffix = end;
+        return true;
+    }
+
+    bool primary() {
+        std::string tok = tokens[pos++];
+        std::string arg;
+        if (tok == "(") {
+            if (!expression()) return false;
+            if (at_end() || peek() != ")") return fail("missing `)'");
+            pos++;
+            return true;
+        }
+        if (tok == "-name") {
+            if (!argument(tok, arg)) return false;
+            emit(Op::Name, static_cast<uint32_t>(program.patterns.size()));
+            program.patterns.push_back(arg);
+        } else if (tok == "-type") {
+            if (!argument(tok, arg)) return false;
+            int64_t mask = 0;
+            for (char c : arg) {
+                switch (c) {
+                    case 'f': mask |= 1 << DT_REG; break;
+                    case 'd': mask |= 1 << DT_DIR; break;
+                    case 'l': mask |= 1 << DT_LNK; break;
+                    case 'p': mask |= 1 << DT_FIFO; break;
+                    case 's': mask |= 1 << DT_SOCK; break;
+                    case 'c': mask |= 1 << DT_CHR; break;
+                    case 'b': mask |= 1 << DT_BLK; break;
+                    case ',': break;
+                    default: return fail("unknown argument to -type: " + arg);
+                }
+            }
+            emit(Op::Type, 0, mask);
+        } else if (tok == "-size") {
+            int cmp;
+            int64_t n;
+            std::string suffix;
+            if (!argument(tok, arg)) return false;
+            if (!numeric(arg, cmp, n, suffix) || suffix.size() > 1) return fail("invalid -size argument `" + arg + "'");
+            uint32_t unit = 512;
+            if (suffix == "c") unit = 1;
+            else if (suffix == "w") unit = 2;
+            else if (suffix == "k") unit = 1024;
+            else if (suffix == "M") unit = 1024 * 1024;
+            else if (suffix == "G") unit = 1024 * 1024 * 1024;
+            else if (!suffix.empty() && suffix != "b") return fail("invalid -size argument `" + arg + "'");
+            emit(Op::Size, unit, n, cmp);
+        } else if (tok == "-mtime") {
+            int cmp;
+            int64_t n;
+            std::string suffix;
+            if (!argument(tok, arg)) return false;
+            if (!numeric(arg, cmp, n, suffix) || !suffix.empty()) return fail("invalid -mtime argument `" + arg + "'");
+            emit(Op::Mtime, 0, n, cmp);
+        } else if (tok == "-newer") {
+            if (!argument(tok, arg)) return false;
+            struct stat st;
+            if (stat(arg.c_str(), &st) != 0) return fail("'" + arg + "': " + strerror(errno));
+            emit(Op::Newer, 0, static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec);
+        } else if (tok == "-prune") {
+            emit(Op::Prune);
+        } else if (tok == "-print" || tok == "-print0") {
+            emit(tok == "-print" ? Op::Print : Op::Print0);
+            has_action = true;
+        } else if (tok == "-exec") {
+            ExecAction action;
+            while (!at_end() && peek() != ";" && peek() != "+") action.argv.push_back(tokens[pos++]);
+            if (at_end() || action.argv.empty()) return fail("missing argument to `-exec'");
+            action.batch = tokens[pos++] == "+";
+            if (action.batch && action.argv.back() != "{}") {
+                return fail("-exec ... + requires {} just before the +");
+            }
+            if (action.batch) action.argv.pop_back();
+            emit(Op::Exec, static_cast<uint32_t>(program.execs.size()));
+            program.execs.push_back(std::move(action));
+            has_action = true;
+        } else if (tok == "-true" || tok == "-false") {
+            emit(tok == "-true" ? Op::True : Op::False);
+        } else if (tok == "-maxdepth" || tok == "-mindepth") {
+            if (!argument(tok, arg)) return false;
+            int depth = atoi(arg.c_str());
+            if (arg.empty() || depth < 0) return fail("invalid " + tok + " argument `" + arg + "'");
+            (tok == "-maxdepth" ? program.max_depth : program.min_depth) = depth;
+            emit(Op::True);
+        } else if (tok == "-unordered") {
+            program.unordered = true;
+            emit(Op::True);
+        } else {
+            return fail("unknown predicate `" + tok + "'");
+        }
+        return true;
+    }
+
+    bool unary() {
+        if (at_end()) return fail("expected an expression");
+        if (peek() == "!" || peek() == "-not") {
+            pos++;
+            if (!unary()) return false;
+            emit(Op::Not);
+            return true;
+        }
+        return primary();
+    }
+
+    bool conjunction() {
+        std::vector<size_t> jumps;
+        if (!unary()) return false;
+        while (!at_end() && peek() != ")" && peek() != "-o" && peek() != "-or") {
+            if (peek() == "-a" || peek() == "-and") pos++;
+            jumps.push_back(program.code.size());
+            emit(Op::JumpIfFalse);
+            if (!unary()) return false;
+        }
+        for (size_t j : jumps) program.code[j].arg = static_cast<uint32_t>(program.code.size());
+        return true;
+    }
+
+    bool expression() {
+        std::vector<size_t> jumps;
+        if (!conjunction()) return false;
+        while (!at_end() && (peek() == "-o" || peek() == "-or")) {
+            pos++;
+            jumps.push_back(program.code.size());
+            emit(Op::JumpIfTrue);
+            if (!conjunction()) return false;
+        }
+        for (size_t j : jumps) program.code[j].arg = static_cast<uint32_t>(program.code.size());
+        return true;
+    }
+
+public:
+    ExprParser(const std::vector<std::string>& t, size_t start, Program& p)
+        : tokens(t), pos(start), program(p) {}
+
+    bool parse() {
+        if (!at_end() && !expression()) {
+            std::cerr << "find: " << error << "\n";
+            return false;
+        }
+        if (!at_end()) {
+            std::cerr << "find: unexpected `" << peek() << "'\n";
+            return false;
+        }
+        // Without an action, the whole expression is `( expr ) -print`
+        if (!has_action) {
+            if (!program.code.empty()) {
+                size_t jump = program.code.size();
+                emit(Op::JumpIfFalse);
+                emit(Op::Print);
+                program.code[jump].arg = static_cast<uint32_t>(program.code.size());
+            } else {
+                emit(Op::Print);
+            }
+        }
+        return true;
+    }
+};
+
+// Output of one directory, kept until the walk is over when the order
+// must match a sequential find: each subdirectory's own result is spliced
+// in at the offset where its entry was printed
+struct DirResult {
+    std::string text;
+    std::vector<std::pair<size_t, std::shared_ptr<DirResult>>> children;
+};
+
+// What the program is evaluated against: one directory entry, with its
+// metadata fetched on first use
+struct Candidate {
+    int dirfd;
+    const char* name;     // relative to dirfd
+    const char* basename; // for -name
+    const std::string& path;
+    unsigned char type;
+    int depth;
+    unsigned have = 0;
+    struct statx stx;
+    bool prune = false;
+
+    Candidate(int fd, const char* n, const char* base, const std::string& p, unsigned char t, int d)
+        : dirfd(fd), name(n), basename(base), path(p), type(t), depth(d) {}
+
+    bool ensure(unsigned mask) {
+        if ((have & mask) == mask) return true;
+        if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask | have, &stx) != 0) return false;
+        have |= mask;
+        if (type == DT_UNKNOWN) type = IFTODT(stx.stx_mode);
+        return true;
+    }
+};
+
+class Finder {
+private:
+    Program program;
+    WorkPool pool;
+    Output out;
+    std::mutex lock;
+    std::atomic<bool> failed{false};
+    int64_t now = time(nullptr);
+
+    struct Batch {
+        std::mutex mutex;
+        std::vector<std::string> paths;
+        size_t bytes = 0;
+    };
+    std::vector<std::unique_ptr<Batch>> batches;
+
+    void error(const std::string& path, int err) {
+        std::lock_guard<std::mutex> guard(lock);
+        out.flush();
+        std::cerr << "find: '" << path << "': " << strerror(err) << "\n";
+        failed = true;
+    }
+
+    int spawn(const std::vector<std::string>& args) {
+        std::vector<char*> argv;
+        for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        pid_t pid;
+        int err = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+        if (err != 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            std::cerr << "find: " << argv[0] << ": " << strerror(err) << "\n";
+            return 127;
+        }
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+
+    void run_batch(const ExecAction& action, std::vector<std::string>& paths) {
+        if (paths.empty()) return;
+        std::vector<std::string> args = action.argv;
+        args.insert(args.end(), paths.begin(), paths.end());
+        paths.clear();
+        if (spawn(args) != 0) failed = true;
+    }
+
+    bool exec(uint32_t index, const std::string& path) {
+        const ExecAction& action = program.execs[index];
+        if (!action.batch) {
+            std::vector<std::string> args = action.argv;
+            for (auto& arg : args) {
+                for (size_t at; (at = arg.find("{}")) != std::string::npos;) arg.replace(at, 2, path);
+            }
+            return spawn(args) == 0;
+        }
+        Batch& batch = *batches[index];
+        std::vector<std::string> full;
+        {
+            std::lock_guard<std::mutex> guard(batch.mutex);
+            batch.paths.push_back(path);
+            batch.bytes += path.size() + 1;
+            if (batch.bytes < EXEC_BATCH_BYTES) return true;
+            full.swap(batch.paths);
+            batch.bytes = 0;
+        }
+        run_batch(action, full);
+        return true;
+    }
+
+    bool evaluate(Candidate& c, std::string& text) {
+        bool value = true;
+        const auto& code = program.code;
+        for (size_t pc = 0; pc < code.size(); pc++) {
+            const Insn& insn = code[pc];
+            switch (insn.op) {
+                case Op::Name:
+                    value = fnmatch(program.patterns[insn.arg].c_str(), c.basename, 0) == 0;
+                    break;
+                case Op::Type:
+                    if (c.type == DT_UNKNOWN) c.ensure(STATX_TYPE);
+                    value = (insn.value >> c.type) & 1;
+                    break;
+                case Op::Size: {
+                    if (!c.ensure(STATX_SIZE)) {
+                        value = false;
+                        break;
+                    }
+                    int64_t units = (static_cast<int64_t>(c.stx.stx_size) + insn.arg - 1) / insn.arg;
+                    value = insn.cmp > 0 ? units > insn.value : insn.cmp < 0 ? units < insn.value : units == insn.value;
+                    break;
+                }
+                case Op::Mtime: {
+                    if (!c.ensure(STATX_MTIME)) {
+                        value = false;
+                        break;
+                    }
+                    int64_t days = (now - c.stx.stx_mtime.tv_sec) / 86400;
+                    value = insn.cmp > 0 ? days > insn.value : insn.cmp < 0 ? days < insn.value : days == insn.value;
+                    break;
+                }
+                case Op::Newer:
+                    value = c.ensure(STATX_MTIME) &&
+                            static_cast<int64_t>(c.stx.stx_mtime.tv_sec) * 1000000000 + c.stx.stx_mtime.tv_nsec > insn.value;
+                    break;
+                case Op::Prune:
+                    c.prune = true;
+                    value = true;
+                    break;
+                case Op::Print:
+                    text += c.path;
+                    text += '\n';
+                    value = true;
+                    break;
+                case Op::Print0:
+                    text += c.path;
+                    text += '\0';
+                    value = true;
+                    break;
+                case Op::Exec:
+                    value = exec(insn.arg, c.path);
+                    break;
+                case Op::True: value = true; break;
+                case Op::False: value = false; break;
+                case Op::Not: value = !value; break;
+                case Op::JumpIfFalse:
+                    if (!value) pc = insn.arg - 1;
+                    break;
+                case Op::JumpIfTrue:
+                    if (value) pc = insn.arg - 1;
+                    break;
+            }
+        }
+        return value;
+    }
+
+    // Decide about one entry; returns true if the walk should go into it
+    bool visit(Candidate& c, std::string& text) {
+        if (c.depth >= program.min_depth) evaluate(c, text);
+        if (c.prune || (program.max_depth >= 0 && c.depth >= program.max_depth)) return false;
+        if (c.type == DT_UNKNOWN) c.ensure(STATX_TYPE);
+        return c.type == DT_DIR;
+    }
+
+    void publish(std::string& text) {
+        if (text.empty()) return;
+        std::lock_guard<std::mutex> guard(lock);
+        out.write(text);
+        text.clear();
+    }
+
+    void walk(const std::string& path, int depth, const std::shared_ptr<DirResult>& result) {
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            error(path, errno);
+            return;
+        }
+        std::string prefix = path.back() == '/' ? path : path + "/";
+        std::string local;
+        std::string& text = result ? result->text : local;
+        bool ok = read_dirents(fd, [&](const char* name, unsigned char type) {
+            if (is_dot_or_dotdot(name)) return;
+            std::string child = prefix + name;
+            Candidate c{fd, name, name, child, type, depth};
+            if (!visit(c, text)) return;
+            std::shared_ptr<DirResult> sub;
+            if (result) {
+                sub = std::make_shared<DirResult>();
+                result->children.emplace_back(text.size(), sub);
+            }
+            pool.push([this, child, depth, sub] { walk(child, depth + 1, sub); });
+        });
+        if (!ok) error(path, errno);
+        close(fd);
+        if (!result) publish(local);
+    }
+
+    void emit(const std::shared_ptr<DirResult>& root) {
+        struct Frame {
+            DirResult* node;
+            size_t child;
+            size_t pos;
+        };
+        std::vector<Frame> stack{{root.get(), 0, 0}};
+        while (!stack.empty() && out.ok()) {
+            Frame& f = stack.back();
+            if (f.child < f.node->children.size()) {
+                auto& next = f.node->children[f.child++];
+                out.write(std::string_view(f.node->text).substr(f.pos, next.first - f.pos));
+                f.pos = next.first;
+                stack.push_back({next.second.get(), 0, 0});
+            } else {
+                out.write(std::string_view(f.node->text).substr(f.pos));
+                stack.pop_back();
+            }
+        }
+    }
+
+public:
+    explicit Finder(Program&& p) : program(std::move(p)) {
+        for (size_t i = 0; i < program.execs.size(); i++) batches.push_back(std::make_unique<Batch>());
+    }
+
+    int run(const std::vector<std::string>& roots) {
+        for (const auto& root : roots) {
+            std::string base = root;
+            while (base.size() > 1 && base.back() == '/') base.pop_back();
+            size_t slash = base.find_last_of('/');
+            if (slash != std::string::npos && base.size() > 1) base = base.substr(slash + 1);
+
+            Candidate c{AT_FDCWD, root.c_str(), base.c_str(), root, DT_UNKNOWN, 0};
+            if (!c.ensure(STATX_TYPE)) {
+                error(root, errno);
+                continue;
+            }
+            auto result = program.unordered ? nullptr : std::make_shared<DirResult>();
+            std::string local;
+            std::string& text = result ? result->text : local;
+            bool descend = visit(c, text);
+            if (descend) {
+                std::shared_ptr<DirResult> sub;
+                if (result) {
+                    sub = std::make_shared<DirResult>();
+                    result->children.emplace_back(text.size(), sub);
+                }
+                pool.push([this, root, sub] { walk(root, 1, sub); });
+            }
+            if (!result) publish(local);
+            pool.run();
+            if (result) emit(result);
+            if (!out.ok()) break;
+        }
+        for (size_t i = 0; i < program.execs.size(); i++) {
+            if (program.execs[i].batch) {
+                out.flush();
+                run_batch(program.execs[i], batches[i]->paths);
+            }
+        }
+        out.flush();
+        return failed || !out.ok() ? 1 : 0;
+    }
+};
+
+} // namespace
+
+int FindCommand::execute(const std::vector<std::string>& args) {
+    std::vector<std::string> roots;
+    size_t i = 0;
+    while (i < args.size() && !args[i].empty() && args[i][0] != '-' && args[i] != "(" && args[i] != "!") {
+        roots.push_back(args[i++]);
+    }
+    if (roots.empty()) roots.push_back(".");
+
+    Program program;
+    if (!ExprParser(args, i, program).parse()) return 1;
+    return Finder(std::move(program)).run(roots);
+}
+
+std::string FindCommand::help() const {
+    return "Search a directory tree (-name -type -size -mtime -newer -prune -exec -print0 "
+           "-maxdepth -mindepth -unordered)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
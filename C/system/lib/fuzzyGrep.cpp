@@ -0,0 +1,953 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include "fuzzyOutput.hpp"
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <bitset>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <regex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+// Files at least this big are mapped instead of read
+const size_t MMAP_THRESHOLD = 64 << 10;
+// and searched this much at a time
+const size_t MMAP_SLICE = 16 << 20;
+const size_t READ_CHUNK = 128 << 10;
+// A NUL byte this close to the start makes a file binary
+const size_t BINARY_PROBE = 32 << 10;
+const size_t MAX_DFA_STATES = 2048;
+const size_t FILE_BATCH = 64;
+
+struct GrepOptions {
+    bool count = false;
+    bool list = false;
+    bool number = false;
+    bool icase = false;
+    bool invert = false;
+    bool recursive = false;
+    bool quiet = false;
+    bool fixed = false;
+    bool extended = false;
+    bool with_names = false;
+};
+
+// Substring search with a SIMD filter on the needle's first and last
+// bytes: 16 candidate positions are tested per step, and only positions
+// where both ends match get a full compare. With -i each end is compared
+// against both of its ASCII cases.
+class Needle {
+private:
+    std::string text;
+    bool icase;
+    unsigned char first[2];
+    unsigned char last[2];
+
+    bool equals(const char* p) const {
+        if (!icase) return memcmp(p, text.data(), text.size()) == 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            if (tolower(static_cast<unsigned char>(p[i])) != static_cast<unsigned char>(text[i])) return false;
+        }
+        return true;
+    }
+
+    bool end_matches(const char* p) const {
+        unsigned char a = p[0], b = p[text.size() - 1];
+        return (a == first[0] || a == first[1]) && (b == last[0] || b == last[1]);
+    }
+
+public:
+    Needle(const std::string& s, bool ignore_case) : text(s), icase(ignore_case) {
+        if (icase) {
+            for (char& c : text) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        unsigned char f = text.empty() ? 0 : text.front();
+        unsigned char l = text.empty() ? 0 : text.back();
+        first[0] = f;
+        first[1] = icase ? static_cast<unsigned char>(toupper(f)) : f;
+        last[0] = l;
+        last[1] = icase ? static_cast<unsigned char>(toupper(l)) : l;
+    }
+
+    bool empty() const { return text.empty(); }
+
+    // First occurrence in [begin, end), or nullptr
+    const char* find(const char* begin, const char* end) const {
+        size_t n = text.size();
+        if (n == 0) return begin;
+        if (static_cast<size_t>(end - begin) < n) return nullptr;
+        if (n == 1 && !icase) return static_cast<const char*>(memchr(begin, first[0], end - begin));
+        const char* p = begin;
+#ifdef __SSE2__
+        const __m128i f0 = _mm_set1_epi8(static_cast<char>(first[0]));
+        const __m128i f1 = _mm_set1_epi8(static_cast<char>(first[1]));
+        const __m128i l0 = _mm_set1_epi8(static_cast<char>(last[0]));
+        const __m128i l1 = _mm_set1_epi8(static_cast<char>(last[1]));
+        for (; p + n - 1 + 16 <= end; p += 16) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n - 1));
+            __m128i heads = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+            __m128i tails = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(heads, tails)));
+            while (mask) {
+                const char* candidate = p + __builtin_ctz(mask);
+                if (equals(candidate)) return candidate;
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; p + n <= end; p++) {
+            if (end_matches(p) && equals(p)) return p;
+        }
+        return nullptr;
+    }
+};
+
+// Thompson NFA for the supported regex subset: literals, ., bracket
+// expressions with ranges and [:classes:], ^ and $, * + ?, alternation
+// and groups. Anything else (back-references, intervals, word anchors)
+// makes the parser give up and grep use regcomp() instead.
+struct Nfa {
+    enum Kind : uint8_t { Set, Split, Jump, Bol, Eol, Match };
+    struct Node {
+        Kind kind;
+        int out = -1;
+        int out1 = -1;
+        int set = -1;
+    };
+    std::vector<Node> nodes;
+    std::vector<std::bitset<256>> sets;
+    int start = -1;
+};
+
+class RegexParser {
+private:
+    struct Fragment {
+        int start;
+        std::vector<std::pair<int, int>> outs; // (node, 0 for out / 1 for out1)
+    };
+
+    const std::string& re;
+    size_t pos = 0;
+    bool extended;
+    bool icase;
+    Nfa& nfa;
+    int depth = 0;
+    int branches = 1;
+    std::string run;
+    std::string best;
+
+    int node(Nfa::Kind kind, int set = -1) {
+        nfa.nodes.push_back({kind, -1, -1, set});
+        return static_cast<int>(nfa.nodes.size()) - 1;
+    }
+
+    void patch(const Fragment& f, int target) {
+        for (auto& o : f.outs) (o.second ? nfa.nodes[o.first].out1 : nfa.nodes[o.first].out) = target;
+    }
+
+    Fragment single(Nfa::Kind kind, int set = -1) {
+        int n = node(kind, set);
+        return {n, {{n, 0}}};
+    }
+
+    Fragment charset(const std::bitset<256>& chars) {
+        std::bitset<256> set = chars;
+        if (icase) {
+            for (int c = 'a'; c <= 'z'; c++) {
+                if (set[c] || set[toupper(c)]) {
+                    set[c] = true;
+                    set[toupper(c)] = true;
+                }
+            }
+        }
+        set['\n'] = false;
+        nfa.sets.push_back(set);
+        return single(Nfa::Set, static_cast<int>(nfa.sets.size()) - 1);
+    }
+
+    bool at(const char* op) const {
+        size_t n = strlen(op);
+        return re.compare(pos, n, op) == 0;
+    }
+
+    // Operator spellings differ between BRE and ERE
+    bool is_op(char c) const {
+        if (extended) return pos < re.size() && re[pos] == c;
+        return pos + 1 < re.size() && re[pos] == '\\' && re[pos + 1] == c;
+    }
+
+    size_t op_len() const { return extended ? 1 : 2; }
+
+    void end_run() {
+        if (run.size() > best.size()) best = run;
+        run.clear();
+    }
+
+    bool bracket(std::bitset<256>& set) {
+        pos++; // [
+        bool negate = pos < re.size() && re[pos] == '^';
+        if (negate) pos++;
+        bool first = true;
+        while (pos < re.size() && (re[pos] != ']' || first)) {
+            first = false;
+            if (re.compare(pos, 2, "[:") == 0) {
+                size_t close = re.find(":]", pos + 2);
+                if (close == std::string::npos) return false;
+                std::string name = re.substr(pos + 2, close - pos - 2);
+                int (*test)(int) = nullptr;
+                if (name == "alpha") test = isalpha;
+                else if (name == "digit") test = isdigit;
+                else if (name == "alnum") test = isalnum;
+                else if (name == "upper") test = isupper;
+                else if (name == "lower") test = islower;
+                else if (name == "space") test = isspace;
+                else if (name == "blank") test = isblank;
+                else if (name == "punct") test = ispunct;
+                else if (name == "print") test = isprint;
+                else if (name == "graph") test = isgraph;
+                else if (name == "cntrl") test = iscntrl;
+                else if (name == "xdigit") test = isxdigit;
+                else return false;
+                for (int c = 0; c < 256; c++) if (test(c)) set[c] = true;
+                pos = close + 2;
+                continue;
+            }
+            if (re.compare(pos, 2, "[=") == 0 || re.compare(pos, 2, "[.") == 0) return false;
+            unsigned char lo = re[pos++];
+            if (pos + 1 < re.size() && re[pos] == '-' && re[pos + 1] != ']') {
+                unsigned char hi = re[pos + 1];
+                pos += 2;
+                for (int c = lo; c <= hi; c++) set[c] = true;
+            } else {
+                set[lo] = true;
+            }
+        }
+        if (pos >= re.size()) return false;
+        pos++; // ]
+        if (negate) set.flip();
+        return true;
+    }
+
+    bool atom(Fragment& f, bool& literal, char& literal_char, bool branch_start) {
+        literal = false;
+        char c = re[pos];
+        if (is_op('(')) {
+            pos += op_len();
+            depth++;
+            if (!alternation(f)) return false;
+            depth--;
+            if (!is_op(')')) return false;
+            pos += op_len();
+            return true;
+        }
+        if (c == '[') {
+            std::bitset<256> set;
+            if (!bracket(set)) return false;
+            f = charset(set);
+            return true;
+        }
+        if (c == '.') {
+            pos++;
+            f = charset(std::bitset<256>().set());
+            return true;
+        }
+        if (c == '^' && (extended || branch_start)) {
+            pos++;
+            f = single(Nfa::Bol);
+            return true;
+        }
+        if (c == '$') {
+            size_t after = pos + 1;
+            bool at_branch_end = after == re.size() ||
+                                 (extended ? re[after] == ')' || re[after] == '|'
+                                           : re.compare(after, 2, "\\)") == 0 || re.compare(after, 2, "\\|") == 0);
+            if (extended || at_branch_end) {
+                pos++;
+                f = single(Nfa::Eol);
+                return true;
+            }
+        }
+        if (c == '\\') {
+            if (pos + 1 >= re.size()) return false;
+            c = re[pos + 1];
+            // Back-references, intervals, word anchors and the GNU
+            // shorthand classes are left to regcomp
+            if (isalnum(static_cast<unsigned char>(c)) || c == '<' || c == '>' || c == '{' || c == '`' ||
+                c == '\'') {
+                return false;
+            }
+            pos += 2;
+        } else {
+            if (extended && (c == '{' || c == '*' || c == '+' || c == '?' || c == ')')) return false;
+            pos++;
+        }
+        std::bitset<256> set;
+        set[static_cast<unsigned char>(c)] = true;
+        f = charset(set);
+        literal = true;
+        literal_char = c;
+        return true;
+    }
+
+    bool repeat(Fragment& f, bool branch_start) {
+        bool literal;
+        char literal_char = 0;
+        if (!atom(f, literal, literal_char, branch_start)) return false;
+        bool optional = false, plus = false;
+        while (pos < re.size()) {
+            if (re[pos] == '*') {
+                pos++;
+                int s = node(Nfa::Split);
+                nfa.nodes[s].out = f.start;
+                patch(f, s);
+                f = {s, {{s, 1}}};
+                optional = true;
+            } else if (is_op('+') || is_op('?')) {
+                bool question = is_op('?');
+                pos += op_len();
+                int s = node(Nfa::Split);
+                nfa.nodes[s].out = f.start;
+                if (question) {
+                    f.outs.push_back({s, 1});
+                    f = {s, f.outs};
+                    optional = true;
+                } else {
+                    patch(f, s);
+                    f = {f.start, {{s, 1}}};
+                    plus = true;
+                }
+            } else if (is_op('{')) {
+                return false;
+            } else {
+                break;
+            }
+        }
+        // Literals that every match must contain feed the prefilter
+        if (depth == 0 && literal && !optional) {
+            run += literal_char;
+            if (plus) end_run();
+        } else if (depth == 0) {
+            end_run();
+        }
+        return true;
+    }
+
+    bool concatenation(Fragment& f) {
+        bool empty = true;
+        while (pos < re.size() && !is_op('|') && !is_op(')')) {
+            Fragment next;
+            if (!repeat(next, empty)) return false;
+            if (empty) {
+                f = next;
+                empty = false;
+            } else {
+                patch(f, next.start);
+                f.outs = next.outs;
+            }
+        }
+        if (empty) f = single(Nfa::Jump);
+        if (depth == 0) end_run();
+        return true;
+    }
+
+    bool alternation(Fragment& f) {
+        if (!concatenation(f)) return false;
+        while (is_op('|')) {
+            pos += op_len();
+            if (depth == 0) branches++;
+            Fragment right;
+            if (!concatenation(right)) return false;
+            int s = node(Nfa::Split);
+            nfa.nodes[s].out = f.start;
+            nfa.nodes[s].out1 = right.start;
+            f.start = s;
+            f.outs.insert(f.outs.end(), right.outs.begin(), right.outs.end());
+        }
+        return true;
+    }
+
+public:
+    RegexParser(const std::string& pattern, bool ere, bool ignore_case, Nfa& out)
+        : re(pattern), extended(ere), icase(ignore_case), nfa(out) {}
+
+    // Returns false for patterns outside the supported subset
+    bool parse(std::string& required_literal) {
+        Fragment f;
+        if (!alternation(f) || pos != re.size()) return false;
+        patch(f, node(Nfa::Match));
+        nfa.start = f.start;
+        required_literal = branches == 1 ? best : "";
+        return true;
+    }
+};
+
+// A DFA built lazily from the NFA, one state per set of NFA nodes. It
+// decides whether a line matches anywhere: after every byte the NFA's
+// start is added back in (an implicit leading .*), and ^ only holds in
+// the state for the start of the line. Eol nodes wait in the sets until
+// the end of the line is reached.
+class Dfa {
+private:
+    const Nfa& nfa;
+    std::map<std::vector<int>, int> index;
+    std::vector<std::vector<int>> states;
+    std::vector<int32_t> trans;
+    std::vector<uint8_t> accepts;
+    std::vector<uint8_t> accepts_at_eol;
+    std::vector<int> restart;
+    int initial = 0;
+    std::vector<int> stack;
+    std::vector<uint32_t> seen;
+    uint32_t mark = 0;
+
+    void closure(std::vector<int>& set, int from, bool bol, bool eol) {
+        stack.push_back(from);
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+            if (n < 0 || seen[n] == mark) continue;
+            seen[n] = mark;
+            const Nfa::Node& node = nfa.nodes[n];
+            switch (node.kind) {
+                case Nfa::Split:
+                    stack.push_back(node.out1);
+                    stack.push_back(node.out);
+                    break;
+                case Nfa::Jump:
+                    stack.push_back(node.out);
+                    break;
+                case Nfa::Bol:
+                    if (bol) stack.push_back(node.out);
+                    break;
+                case Nfa::Eol:
+                    set.push_back(n);
+                    if (eol) stack.push_back(node.out);
+                    break;
+                default:
+                    set.push_back(n);
+                    break;
+            }
+        }
+    }
+
+    bool contains_match(const std::vector<int>& set) const {
+        for (int n : set) if (nfa.nodes[n].kind == Nfa::Match) return true;
+        return false;
+    }
+
+    int add(std::vector<int> set) {
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+        auto it = index.find(set);
+        if (it != index.end()) return it->second;
+
+        int id = static_cast<int>(states.size());
+        bool now = contains_match(set);
+        std::vector<int> at_eol;
+        mark++;
+        for (int n : set) closure(at_eol, n, false, true);
+        accepts.push_back(now);
+        accepts_at_eol.push_back(now || contains_match(at_eol));
+        index.emplace(set, id);
+        states.push_back(std::move(set));
+        trans.resize(states.size() * 256, -1);
+        return id;
+    }
+
+    int compute(int state, unsigned char c) {
+        std::vector<int> next;
+        mark++;
+        for (int n : states[state]) {
+            const Nfa::Node& node = nfa.nodes[n];
+            if (node.kind == Nfa::Set && nfa.sets[node.set][c]) closure(next, node.out, false, false);
+        }
+        for (int n : restart) closure(next, n, false, false);
+        if (states.size() >= MAX_DFA_STATES) reset();
+        return add(std::move(next));
+    }
+
+    // The cache is full: start over with only the initial state
+    void reset() {
+        index.clear();
+        states.clear();
+        trans.clear();
+        accepts.clear();
+        accepts_at_eol.clear();
+        std::vector<int> start;
+        mark++;
+        closure(start, nfa.start, true, false);
+        initial = add(std::move(start));
+    }
+
+public:
+    explicit Dfa(const Nfa& n) : nfa(n), seen(n.nodes.size(), 0) {
+        mark++;
+        closure(restart, nfa.start, false, false);
+        reset();
+    }
+
+    bool match_line(const char* p, const char* end) {
+        int s = initial;
+        if (accepts[s]) return true;
+        for (; p < end; p++) {
+            int32_t t = trans[s * 256 + static_cast<unsigned char>(*p)];
+            if (t < 0) {
+                t = compute(s, static_cast<unsigned char>(*p));
+                // compute() may have reset the cache, and with it `s`
+                if (static_cast<size_t>(s) < states.size()) trans[s * 256 + static_cast<unsigned char>(*p)] = t;
+            }
+            s = t;
+            if (accepts[s]) return true;
+        }
+        return accepts_at_eol[s];
+    }
+};
+
+// The pattern, compiled once and shared by every search
+struct Pattern {
+    bool fixed = false;
+    std::unique_ptr<Needle> needle;  // whole pattern, or a required literal
+    std::unique_ptr<Nfa> nfa;
+    bool use_regex = false;
+    regex_t regex;
+
+    ~Pattern() {
+        if (use_regex) regfree(&regex);
+    }
+
+    bool compile(const std::string& text, const GrepOptions& opts) {
+        bool meta = text.find_first_of(opts.extended ? ".[]\\*+?(){}|^$" : ".[]\\*^$") != std::string::npos;
+        if (opts.fixed || !meta) {
+            fixed = true;
+            needle = std::make_unique<Needle>(text, opts.icase);
+            return true;
+        }
+        nfa = std::make_unique<Nfa>();
+        std::string literal;
+        if (RegexParser(text, opts.extended, opts.icase, *nfa).parse(literal)) {
+            if (!literal.empty()) needle = std::make_unique<Needle>(literal, opts.icase);
+            return true;
+        }
+        nfa.reset();
+        int flags = REG_NOSUB | REG_NEWLINE | (opts.extended ? REG_EXTENDED : 0) | (opts.icase ? REG_ICASE : 0);
+        int err = regcomp(&regex, text.c_str(), flags);
+        if (err != 0) {
+            char message[256];
+            regerror(err, &regex, message, sizeof(message));
+            std::cerr << "grep: " << message << "\n";
+            return false;
+        }
+        use_regex = true;
+        return true;
+    }
+};
+
+// Per-thread matching state over a shared Pattern: the DFA cache fills in
+// as it goes, so every worker has its own
+class LineMatcher {
+private:
+    const Pattern& pattern;
+    std::unique_ptr<Dfa> dfa;
+
+    static const char* line_start(const char* begin, const char* p) {
+        const char* nl = static_cast<const char*>(memrchr(begin, '\n', p - begin));
+        return nl ? nl + 1 : begin;
+    }
+
+    static const char* line_end(const char* p, const char* end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        return nl ? nl : end;
+    }
+
+    bool line_matches(const char* line, const char* eol) {
+        if (dfa) return dfa->match_line(line, eol);
+        regmatch_t m;
+        m.rm_so = 0;
+        m.rm_eo = eol - line;
+        return regexec(&pattern.regex, line, 1, &m, REG_STARTEND) == 0;
+    }
+
+public:
+    explicit LineMatcher(const Pattern& p) : pattern(p) {
+        if (p.nfa) dfa = std::make_unique<Dfa>(*p.nfa);
+    }
+
+    // Start of the first matching line at or after `begin` (a line
+    // start), or nullptr
+    const char* find_line(const char* begin, const char* end) {
+        if (pattern.fixed) {
+            const char* hit = pattern.needle->find(begin, end);
+            return hit ? line_start(begin, hit) : nullptr;
+        }
+        const char* p = begin;
+        while (p < end) {
+            const char* line = p;
+            if (pattern.needle) {
+                const char* hit = pattern.needle->find(p, end);
+                if (!hit) return nullptr;
+                line = line_start(p, hit);
+            }
+            const char* eol = line_end(line, end);
+            if (line_matches(line, eol)) return line;
+            p = eol + 1;
+        }
+        return nullptr;
+    }
+};
+
+size_t count_newlines(const char* p, const char* end) {
+    size_t n = 0;
+    while ((p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+// Search state for one file, fed whole lines in one or more chunks
+class FileSearch {
+private:
+    const GrepOptions& opts;
+    LineMatcher& matcher;
+    const std::string& name;
+    std::string& text;
+    size_t selected = 0;
+    size_t lineno = 1;
+    bool binary = false;
+    bool probed = false;
+    bool done = false;
+
+    // Returns false once nothing more needs to be looked at
+    bool select(const char* line, const char* eol, const char* counted_from) {
+        selected++;
+        if (opts.quiet || opts.list) return false;
+        if (opts.count) return true;
+        if (binary) {
+            text += "Binary file " + name + " matches\n";
+            return false;
+        }
+        if (opts.with_names) {
+            text += name;
+            text += ':';
+        }
+        if (opts.number) {
+            lineno += count_newlines(counted_from, line);
+            text += std::to_string(lineno);
+            text += ':';
+        }
+        text.append(line, eol - line);
+        text += '\n';
+        return true;
+    }
+
+public:
+    FileSearch(const GrepOptions& o, LineMatcher& m, const std::string& n, std::string& out)
+        : opts(o), matcher(m), name(n), text(out) {}
+
+    size_t matches() const { return selected; }
+    bool finished() const { return done; }
+
+    // [begin, end) holds complete lines; the last one may lack its
+    // newline only in the final chunk
+    void search(const char* begin, const char* end) {
+        if (done) return;
+        if (!probed) {
+            probed = true;
+            binary = memchr(begin, '\0', std::min<size_t>(end - begin, BINARY_PROBE)) != nullptr;
+        }
+        const char* pos = begin;
+        const char* counted = begin; // line numbers are known up to here
+        while (pos < end) {
+            const char* line = matcher.find_line(pos, end);
+            if (opts.invert) {
+                const char* stop = line ? line : end;
+                while (pos < stop) {
+                    const char* nl = static_cast<const char*>(memchr(pos, '\n', stop - pos));
+                    const char* eol = nl ? nl : stop;
+                    if (!select(pos, eol, counted)) {
+                        done = true;
+                        return;
+                    }
+                    if (opts.number) counted = pos;
+                    pos = eol + 1;
+                }
+                if (!line) break;
+                const char* nl = static_cast<const char*>(memchr(line, '\n', end - line));
+                pos = nl ? nl + 1 : end;
+            } else {
+                if (!line) break;
+                const char* nl = static_cast<const char*>(memchr(line, '\n', end - line));
+                const char* eol = nl ? nl : end;
+                if (!select(line, eol, counted)) {
+                    done = true;
+                    return;
+                }
+                if (opts.number) counted = line;
+                pos = eol + 1;
+            }
+        }
+        if (opts.number) lineno += count_newlines(counted, end);
+    }
+};
+
+class Grep {
+private:
+    GrepOptions opts;
+    Pattern pattern;
+    Output out;
+    std::mutex lock;
+    std::atomic<bool> any{false};
+    std::atomic<bool> failed{false};
+    std::atomic<bool> stop{false};
+    WorkPool pool;
+
+    void error(const std::string& what, int err) {
+        std::lock_guard<std::mutex> guard(lock);
+        out.flush();
+        std::cerr << "grep: " << what << ": " << strerror(err) << "\n";
+        failed = true;
+    }
+
+    void publish(std::string& text) {
+        if (text.empty()) return;
+        std::lock_guard<std::mutex> guard(lock);
+        out.write(text);
+        text.clear();
+        if (!out.ok()) stop = true;
+    }
+
+    void finish(FileSearch& search, const std::string& name, std::string& text) {
+        if (search.matches() > 0) {
+            any = true;
+            if (opts.quiet) stop = true;
+        }
+        if (opts.list && search.matches() > 0) {
+            text += name;
+            text += '\n';
+        } else if (opts.count && !opts.list) {
+            if (opts.with_names) {
+                text += name;
+                text += ':';
+            }
+            text += std::to_string(search.matches());
+            text += '\n';
+        }
+    }
+
+    // Feed a stream through in chunks, holding back a partial last line
+    void search_stream(int fd, FileSearch& search, const std::string& name, std::string& text) {
+        std::string buffer;
+        size_t held = 0;
+        while (!search.finished() && !stop && !interrupted) {
+            buffer.resize(held + READ_CHUNK);
+            ssize_t n = read(fd, &buffer[held], READ_CHUNK);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                error(name, errno);
+                break;
+            }
+            if (n == 0) {
+                search.search(buffer.data(), buffer.data() + held);
+                break;
+            }
+            size_t filled = held + n;
+            const char* nl = static_cast<const char*>(memrchr(buffer.data(), '\n', filled));
+            size_t whole = nl ? nl - buffer.data() + 1 : 0;
+            search.search(buffer.data(), buffer.data() + whole);
+            buffer.erase(0, whole);
+            held = filled - whole;
+            if (text.size() >= READ_CHUNK) publish(text);
+        }
+    }
+
+    void search_file(LineMatcher& matcher, int dirfd, const char* path, const std::string& name) {
+        std::string text;
+        bool use_stdin = dirfd == AT_FDCWD && strcmp(path, "-") == 0;
+        int fd = use_stdin ? STDIN_FILENO : openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            error(name, errno);
+            if (fd >= 0 && !use_stdin) close(fd);
+            return;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (!use_stdin) close(fd);
+            if (opts.recursive) {
+                walk(name);
+            } else {
+                error(name, EISDIR);
+            }
+            return;
+        }
+
+        FileSearch search(opts, matcher, name, text);
+        if (S_ISREG(st.st_mode) && static_cast<size_t>(st.st_size) >= MMAP_THRESHOLD) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                search_stream(fd, search, name, text);
+            } else {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                // In whole-line slices, so an interrupt is noticed
+                const char* data = static_cast<const char*>(map);
+                const char* end = data + st.st_size;
+                while (data < end && !search.finished() && !interrupted) {
+                    // A line longer than a slice makes its slice longer
+                    const char* cut = nullptr;
+                    for (const char* from = data; !cut && from < end && !interrupted;) {
+                        size_t span = std::min<size_t>(MMAP_SLICE, end - from);
+                        const void* nl = memrchr(from, '\n', span);
+                        from += span;
+                        cut = nl ? static_cast<const char*>(nl) + 1 : from == end ? end : nullptr;
+                    }
+                    if (!cut) break;
+                    search.search(data, cut);
+                    data = cut;
+                }
+                munmap(map, st.st_size);
+            }
+        } else {
+            search_stream(fd, search, name, text);
+        }
+        if (!use_stdin) close(fd);
+        finish(search, name, text);
+        publish(text);
+    }
+
+    void search_dir(const std::string& dir, const std::vector<std::string>& names) {
+        LineMatcher matcher(pattern);
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            error(dir, errno);
+            return;
+        }
+        std::string prefix = dir == "." ? "" : dir.back() == '/' ? dir : dir + "/";
+        for (const auto& name : names) {
+            if (stop) break;
+            search_file(matcher, fd, name.c_str(), prefix + name);
+        }
+        close(fd);
+    }
+
+    // Files of a directory are searched in batches on the pool;
+    // symlinks inside the tree are not followed
+    void walk(const std::string& dir) {
+        pool.push([this, dir] {
+            int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0) {
+                error(dir, errno);
+                return;
+            }
+            std::string prefix = dir == "." ? "" : dir.back() == '/' ? dir : dir + "/";
+            std::vector<std::string> batch;
+            read_dirents(fd, [&](const char* name, unsigned char type) {
+                if (is_dot_or_dotdot(name) || stop) return;
+                if (type == DT_UNKNOWN) {
+                    struct stat st;
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) type = IFTODT(st.st_mode);
+                }
+                if (type == DT_DIR) {
+                    walk(prefix + name);
+                } else if (type == DT_REG) {
+                    batch.push_back(name);
+                    if (batch.size() == FILE_BATCH) {
+                        pool.push([this, dir, b = std::move(batch)] { search_dir(dir, b); });
+                        batch.clear();
+                    }
+                }
+            });
+            close(fd);
+            if (!batch.empty()) search_dir(dir, batch);
+        });
+    }
+
+public:
+    explicit Grep(const GrepOptions& o) : opts(o) {}
+
+    bool compile(const std::string& text) { return pattern.compile(text, opts); }
+
+    int run(const std::vector<std::string>& files) {
+        LineMatcher matcher(pattern);
+        for (const auto& file : files) {
+            if (stop) break;
+            search_file(matcher, AT_FDCWD, file.c_str(), file == "-" ? "(standard input)" : file);
+            pool.run();
+        }
+        out.flush();
+        if (opts.quiet && any) return 0;
+        return failed ? 2 : any ? 0 : 1;
+    }
+};
+
+} // namespace
+
+int GrepCommand::execute(const std::vector<std::string>& args) {
+    GrepOptions opts;
+    std::vector<std::string> operands;
+    bool options = true;
+    for (const auto& arg : args) {
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                switch (arg[i]) {
+                    case 'c': opts.count = true; break;
+                    case 'l': opts.list = true; break;
+                    case 'n': opts.number = true; break;
+                    case 'i': opts.icase = true; break;
+                    case 'v': opts.invert = true; break;
+                    case 'r': case 'R': opts.recursive = true; break;
+                    case 'q': opts.quiet = true; break;
+                    case 'F': opts.fixed = true; break;
+                    case 'E': opts.extended = true; break;
+                    default:
+                        std::cerr << "grep: invalid option -- '" << arg[i] << "'\n"
+                                  << "Usage: grep [-EFcilnqrv] <pattern> [file...]\n";
+                        return 2;
+                }
+            }
+        } else {
+            operands.push_back(arg);
+        }
+    }
+    if (operands.empty()) {
+        std::cerr << "Usage: grep [-EFcilnqrv] <pattern> [file...]\n";
+        return 2;
+    }
+
+    std::string pattern = operands.front();
+    std::vector<std::string> files(operands.begin() + 1, operands.end());
+    if (files.empty()) files.push_back(opts.recursive ? "." : "-");
+    opts.with_names = files.size() > 1 || opts.recursive;
+
+    Grep grep(opts);
+    if (!grep.compile(pattern)) return 2;
+    return grep.run(files);
+}
+
+std::string GrepCommand::help() const {
+    return "Search files for lines matching a pattern (-E -F -c -i -l -n -q -r -v)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
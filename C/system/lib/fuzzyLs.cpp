@@ -0,0 +1,449 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include "fuzzyOutput.hpp"
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+// Below this many entries one thread stats faster than starting more
+const size_t PARALLEL_STATX = 4096;
+
+struct LsOptions {
+    bool all = false;
+    bool long_format = false;
+    bool one_per_line = false;
+    bool recursive = false;
+    bool reverse = false;
+    bool by_time = false;
+};
+
+// The entries of one directory, stored column-wise: names back to back in
+// one string, metadata in parallel arrays that are only filled when the
+// options need them, and the sort permutes 32-bit indices only.
+struct Listing {
+    std::string names;
+    std::vector<uint32_t> name_at;
+    std::vector<uint8_t> type;
+    std::vector<uint32_t> mode;
+    std::vector<uint32_t> nlink;
+    std::vector<uint32_t> uid;
+    std::vector<uint32_t> gid;
+    std::vector<uint64_t> size;
+    std::vector<uint64_t> blocks;
+    std::vector<int64_t> mtime;
+    std::vector<uint32_t> mtime_nsec;
+    std::vector<uint32_t> order;
+
+    size_t count() const { return name_at.size(); }
+    const char* name(uint32_t i) const { return names.data() + name_at[i]; }
+
+    void add(std::string_view entry, uint8_t entry_type) {
+        name_at.push_back(static_cast<uint32_t>(names.size()));
+        names.append(entry);
+        names.push_back('\0');
+        type.push_back(entry_type);
+    }
+
+    bool is_dir(uint32_t i) const {
+        return mode.empty() || mode[i] == 0 ? type[i] == DT_DIR : S_ISDIR(mode[i]);
+    }
+};
+
+bool read_listing(int fd, bool all, Listing& listing) {
+    return read_dirents(fd, [&](const char* name, unsigned char type) {
+        if (name[0] != '.' || all) listing.add(name, type);
+    });
+}
+
+unsigned statx_mask(const LsOptions& opts) {
+    unsigned mask = 0;
+    if (opts.long_format) {
+        mask |= STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE |
+                STATX_MTIME | STATX_BLOCKS;
+    }
+    if (opts.by_time) mask |= STATX_TYPE | STATX_MTIME;
+    return mask;
+}
+
+// statx every entry relative to `dirfd`, asking only for `mask`. Huge
+// directories are split between threads: on a cold cache each call waits
+// on the disk, so this overlaps the waits even on one CPU.
+void fill_stats(int dirfd, Listing& listing, unsigned mask) {
+    size_t n = listing.count();
+    listing.mode.assign(n, 0);
+    listing.nlink.assign(n, 0);
+    listing.uid.assign(n, 0);
+    listing.gid.assign(n, 0);
+    listing.size.assign(n, 0);
+    listing.blocks.assign(n, 0);
+    listing.mtime.assign(n, 0);
+    listing.mtime_nsec.assign(n, 0);
+
+    auto work = [&](size_t begin, size_t end) {
+        struct statx stx;
+        for (size_t i = begin; i < end; i++) {
+            if (statx(dirfd, listing.name(i), AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) != 0) {
+                continue;
+            }
+            listing.mode[i] = stx.stx_mode;
+            listing.nlink[i] = stx.stx_nlink;
+            listing.uid[i] = stx.stx_uid;
+            listing.gid[i] = stx.stx_gid;
+            listing.size[i] = stx.stx_size;
+            listing.blocks[i] = stx.stx_blocks;
+            listing.mtime[i] = stx.stx_mtime.tv_sec;
+            listing.mtime_nsec[i] = stx.stx_mtime.tv_nsec;
+        }
+    };
+
+    size_t threads = 1;
+    if (n >= PARALLEL_STATX) {
+        threads = std::min<size_t>(8, std::max(2u, std::thread::hardware_concurrency()));
+        threads = std::min(threads, n / (PARALLEL_STATX / 4));
+    }
+    if (threads <= 1) {
+        work(0, n);
+        return;
+    }
+    std::vector<std::thread> pool;
+    size_t per = (n + threads - 1) / threads;
+    for (size_t t = 0; t < threads; t++) {
+        size_t begin = t * per;
+        size_t end = std::min(n, begin + per);
+        if (begin < end) pool.emplace_back(work, begin, end);
+    }
+    for (auto& thread : pool) thread.join();
+}
+
+void sort_listing(Listing& listing, const LsOptions& opts) {
+    listing.order.resize(listing.count());
+    for (uint32_t i = 0; i < listing.order.size(); i++) listing.order[i] = i;
+    auto by_name = [&](uint32_t a, uint32_t b) { return strcmp(listing.name(a), listing.name(b)) < 0; };
+    if (opts.by_time) {
+        std::sort(listing.order.begin(), listing.order.end(), [&](uint32_t a, uint32_t b) {
+            if (listing.mtime[a] != listing.mtime[b]) return listing.mtime[a] > listing.mtime[b];
+            if (listing.mtime_nsec[a] != listing.mtime_nsec[b]) {
+                return listing.mtime_nsec[a] > listing.mtime_nsec[b];
+            }
+            return by_name(a, b);
+        });
+    } else {
+        std::sort(listing.order.begin(), listing.order.end(), by_name);
+    }
+    if (opts.reverse) std::reverse(listing.order.begin(), listing.order.end());
+}
+
+class LsPrinter {
+private:
+    LsOptions opts;
+    Output out;
+    std::unordered_map<uint32_t, std::string> users;
+    std::unordered_map<uint32_t, std::string> groups;
+    unsigned width = 0;
+    time_t now = time(nullptr);
+
+    const std::string& user(uint32_t uid) {
+        auto it = users.find(uid);
+        if (it != users.end()) return it->second;
+        struct passwd* pw = getpwuid(uid);
+        return users[uid] = pw ? pw->pw_name : std::to_string(uid);
+    }
+
+    const std::string& group(uint32_t gid) {
+        auto it = groups.find(gid);
+        if (it != groups.end()) return it->second;
+        struct group* gr = getgrgid(gid);
+        return groups[gid] = gr ? gr->gr_name : std::to_string(gid);
+    }
+
+    static char type_char(uint32_t mode) {
+        if (S_ISDIR(mode)) return 'd';
+        if (S_ISLNK(mode)) return 'l';
+        if (S_ISCHR(mode)) return 'c';
+        if (S_ISBLK(mode)) return 'b';
+        if (S_ISFIFO(mode)) return 'p';
+        if (S_ISSOCK(mode)) return 's';
+        return '-';
+    }
+
+    static void mode_string(uint32_t mode, char* s) {
+        if (mode == 0) {
+            memcpy(s, "??????????", 10);
+            return;
+        }
+        s[0] = type_char(mode);
+        const char* rwx = "rwxrwxrwx";
+        for (int i = 0; i < 9; i++) s[i + 1] = mode & (0400 >> i) ? rwx[i] : '-';
+        if (mode & S_ISUID) s[3] = mode & S_IXUSR ? 's' : 'S';
+        if (mode & S_ISGID) s[6] = mode & S_IXGRP ? 's' : 'S';
+        if (mode & S_ISVTX) s[9] = mode & S_IXOTH ? 't' : 'T';
+    }
+
+    static size_t digits(uint64_t n) {
+        size_t d = 1;
+        while (n >= 10) {
+            n /= 10;
+            d++;
+        }
+        return d;
+    }
+
+    void pad_left(const std::string& s, size_t w) {
+        if (s.size() < w) out.fill(' ', w - s.size());
+        out.write(s);
+    }
+
+    void pad_right(const std::string& s, size_t w) {
+        out.write(s);
+        if (s.size() < w) out.fill(' ', w - s.size());
+    }
+
+    void print_long(const Listing& listing, int dirfd, bool total) {
+        size_t w_links = 1, w_user = 1, w_group = 1, w_size = 1;
+        uint64_t blocks = 0;
+        for (uint32_t i : listing.order) {
+            w_links = std::max(w_links, digits(listing.nlink[i]));
+            w_user = std::max(w_user, user(listing.uid[i]).size());
+            w_group = std::max(w_group, group(listing.gid[i]).size());
+            w_size = std::max(w_size, digits(listing.size[i]));
+            blocks += (listing.blocks[i] + 1) / 2;
+        }
+        if (total) {
+            out.write("total ");
+            out.number(blocks);
+            out.newline();
+        }
+
+        for (uint32_t i : listing.order) {
+            char mode[11] = {};
+            mode_string(listing.mode[i], mode);
+            out.write(mode, 10);
+            out.put(' ');
+            pad_left(std::to_string(listing.nlink[i]), w_links);
+            out.put(' ');
+            pad_right(user(listing.uid[i]), w_user);
+            out.put(' ');
+            pad_right(group(listing.gid[i]), w_group);
+            out.put(' ');
+            pad_left(std::to_string(listing.size[i]), w_size);
+            out.put(' ');
+
+            char stamp[32];
+            time_t mtime = listing.mtime[i];
+            struct tm tm;
+            localtime_r(&mtime, &tm);
+            bool recent = mtime <= now && now - mtime < 15778476; // six months
+            strftime(stamp, sizeof(stamp), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+            out.write_parts({stamp, " ", listing.name(i)});
+
+            if (S_ISLNK(listing.mode[i])) {
+                char target[4096];
+                ssize_t len = readlinkat(dirfd, listing.name(i), target, sizeof(target));
+                if (len >= 0) {
+                    out.write_parts({" -> ", std::string_view(target, len)});
+                }
+            }
+            out.newline();
+            if (!out.ok()) return;
+        }
+    }
+
+    // Fixed-width columns filled down then across, sized to the terminal
+    void print_columns(const Listing& listing) {
+        size_t n = listing.order.size();
+        if (n == 0) return;
+        size_t longest = 0;
+        for (uint32_t i : listing.order) longest = std::max(longest, strlen(listing.name(i)));
+        size_t column = longest + 2;
+        size_t cols = std::max<size_t>(1, width / column);
+        size_t rows = (n + cols - 1) / cols;
+        for (size_t r = 0; r < rows; r++) {
+            for (size_t c = 0; c < cols; c++) {
+                size_t k = c * rows + r;
+                if (k >= n) break;
+                const char* name = listing.name(listing.order[k]);
+                out.write(name);
+                if (k + rows < n) out.fill(' ', column - strlen(name));
+            }
+            out.newline();
+            if (!out.ok()) return;
+        }
+    }
+
+public:
+    explicit LsPrinter(const LsOptions& o) : opts(o) {
+        struct winsize ws;
+        if (!opts.one_per_line && !opts.long_format && isatty(STDOUT_FILENO)) {
+            width = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+        }
+    }
+
+    void text(const std::string& s) { out.write(s); }
+
+    bool ok() const { return out.ok(); }
+
+    void print(const Listing& listing, int dirfd, bool total) {
+        if (opts.long_format) {
+            print_long(listing, dirfd, total);
+        } else if (width > 0) {
+            print_columns(listing);
+        } else {
+            for (uint32_t i : listing.order) {
+                out.line(listing.name(i));
+                if (!out.ok()) return;
+            }
+        }
+    }
+
+    void flush() { out.flush(); }
+};
+
+class Lister {
+private:
+    LsOptions opts;
+    LsPrinter printer;
+    unsigned mask;
+    bool headers = false;
+    bool first = true;
+    int status = 0;
+
+    void list_dir(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        Listing listing;
+        if (fd < 0 || !read_listing(fd, opts.all, listing)) {
+            printer.flush();
+            std::cerr << "ls: cannot open directory '" << path << "': " << strerror(errno) << "\n";
+            if (fd >= 0) close(fd);
+            status = std::max(status, 1);
+            return;
+        }
+        if (mask) fill_stats(fd, listing, mask);
+        sort_listing(listing, opts);
+
+        if (headers) printer.text((first ? "" : "\n") + path + ":\n");
+        first = false;
+        printer.print(listing, fd, true);
+        if (!printer.ok()) {
+            close(fd);
+            return;
+        }
+
+        if (opts.recursive) {
+            std::vector<std::string> subdirs;
+            for (uint32_t i : listing.order) {
+                const char* name = listing.name(i);
+                if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+                bool dir = listing.is_dir(i);
+                if (listing.type[i] == DT_UNKNOWN && (listing.mode.empty() || listing.mode[i] == 0)) {
+                    struct stat st;
+                    dir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+                }
+                if (dir) subdirs.push_back(path == "/" ? "/" + std::string(name) : path + "/" + name);
+            }
+            close(fd);
+            for (const auto& sub : subdirs) list_dir(sub);
+            return;
+        }
+        close(fd);
+    }
+
+public:
+    explicit Lister(const LsOptions& o) : opts(o), printer(o), mask(statx_mask(o)) {}
+
+    int run(const std::vector<std::string>& operands) {
+        // Files named on the command line are listed first, together;
+        // directories follow, each under its own header when there are
+        // several of them or with -R
+        Listing files;
+        std::vector<std::string> dirs;
+        for (const auto& operand : operands) {
+            struct statx stx;
+            int flags = opts.long_format ? AT_SYMLINK_NOFOLLOW : 0;
+            if (statx(AT_FDCWD, operand.c_str(), flags, STATX_TYPE, &stx) != 0) {
+                std::cerr << "ls: cannot access '" << operand << "': " << strerror(errno) << "\n";
+                status = 2;
+                continue;
+            }
+            if (S_ISDIR(stx.stx_mode)) {
+                dirs.push_back(operand);
+            } else {
+                files.add(operand, DT_UNKNOWN);
+            }
+        }
+
+        if (files.count() > 0) {
+            if (mask) fill_stats(AT_FDCWD, files, mask);
+            sort_listing(files, opts);
+            printer.print(files, AT_FDCWD, false);
+            first = false;
+        }
+        std::sort(dirs.begin(), dirs.end());
+        if (opts.reverse) std::reverse(dirs.begin(), dirs.end());
+        headers = opts.recursive || operands.size() > 1;
+        for (const auto& dir : dirs) {
+            if (printer.ok()) list_dir(dir);
+        }
+        printer.flush();
+        return printer.ok() ? status : std::max(status, 1);
+    }
+};
+
+} // namespace
+
+int LsCommand::execute(const std::vector<std::string>& args) {
+    LsOptions opts;
+    std::vector<std::string> operands;
+    bool options = true;
+    for (const auto& arg : args) {
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                switch (arg[i]) {
+                    case 'a': opts.all = true; break;
+                    case 'l': opts.long_format = true; break;
+                    case '1': opts.one_per_line = true; break;
+                    case 'R': opts.recursive = true; break;
+                    case 'r': opts.reverse = true; break;
+                    case 't': opts.by_time = true; break;
+                    default:
+                        std::cerr << "ls: invalid option -- '" << arg[i] << "'\n"
+                                  << "Usage: ls [-1alRrt] [file...]\n";
+                        return 2;
+                }
+            }
+        } else {
+            operands.push_back(arg);
+        }
+    }
+    if (operands.empty()) operands.push_back(".");
+
+    return Lister(opts).run(operands);
+}
+
+std::string LsCommand::help() const {
+    return "List directory contents (-1 -a -l -R -r -t)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
@@ -0,0 +1,148 @@
+#ifndef FUZZY_OUTPUT_HPP
+#define FUZZY_OUTPUT_HPP
+
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <initializer_list>
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/uio.h>
+
+namespace FuzzyBox {
+
+// Buffered output for fuzzylib commands. Pipes and files get large block
+// writes; a terminal still sees every line as soon as it is complete.
+// Records too big for the buffer go out together with it in one writev
+// instead of being copied. Once a write fails -- EPIPE when the reader
+// has gone away -- everything else is dropped and ok() turns false, so a
+// command can stop early without an error message per line.
+class Output {
+public:
+    static const size_t DEFAULT_CAPACITY = 64 << 10;
+
+private:
+    int fd;
+    bool tty;
+    int failure = 0;
+    size_t used = 0;
+    size_t capacity;
+    std::unique_ptr<char[]> buffer;
+
+    bool write_iov(struct iovec* iov, int count) {
+        while (count > 0) {
+            ssize_t n = writev(fd, iov, count);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                failure = errno;
+                return false;
+            }
+            while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+        return true;
+    }
+
+public:
+    explicit Output(int out_fd = STDOUT_FILENO, size_t size = DEFAULT_CAPACITY)
+        : fd(out_fd), tty(isatty(out_fd)), capacity(size), buffer(new char[size]) {
+        // Keep order with anything already written through iostreams
+        if (fd == STDOUT_FILENO) std::cout.flush();
+    }
+
+    ~Output() { flush(); }
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    bool ok() const { return failure == 0; }
+    // errno of the write that failed, 0 if none has
+    int error() const { return failure; }
+    bool is_tty() const { return tty; }
+
+    bool flush() {
+        if (used == 0 || failure) {
+            used = 0;
+            return ok();
+        }
+        struct iovec iov = {buffer.get(), used};
+        used = 0;
+        return write_iov(&iov, 1);
+    }
+
+    // A record made of several parts, written as a unit: copied into the
+    // buffer when it fits, otherwise sent with the buffer in one writev
+    void write_parts(std::initializer_list<std::string_view> parts) {
+        if (failure) return;
+        size_t total = 0;
+        for (auto part : parts) total += part.size();
+        if (total <= capacity - used) {
+            for (auto part : parts) {
+                memcpy(buffer.get() + used, part.data(), part.size());
+                used += part.size();
+            }
+            return;
+        }
+        if (total < capacity / 2) {
+            flush();
+            write_parts(parts);
+            return;
+        }
+        struct iovec iov[16];
+        int count = 0;
+        if (used > 0) iov[count++] = {buffer.get(), used};
+        for (auto part : parts) {
+            if (count == 16) {
+                if (!write_iov(iov, count)) break;
+                count = 0;
+            }
+            if (!part.empty()) iov[count++] = {const_cast<char*>(part.data()), part.size()};
+        }
+        used = 0;
+        if (!failure) write_iov(iov, count);
+    }
+
+    void write(std::string_view data) { write_parts({data}); }
+
+    void write(const char* data, size_t size) { write_parts({std::string_view(data, size)}); }
+
+    void put(char c) {
+        if (used == capacity) flush();
+        buffer[used++] = c;
+    }
+
+    void fill(char c, size_t count) {
+        while (count-- > 0) put(c);
+    }
+
+    void number(uint64_t n) {
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+        write(digits, end - digits);
+    }
+
+    // Ends the current line; flushed right away on a terminal
+    void newline() {
+        put('\n');
+        if (tty) flush();
+    }
+
+    void line(std::string_view text) {
+        write_parts({text, "\n"});
+        if (tty) flush();
+    }
+};
+
+} // namespace FuzzyBox
+
+#endif // FUZZY_OUTPUT_HPP
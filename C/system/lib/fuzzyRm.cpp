@@ -0,0 +1,199 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+// A directory being emptied. Each node keeps its fd open while any of its
+// subdirectories is still pending: children are opened and removed
+// relative to it, so the walk never resolves a path twice and a directory
+// swapped for a symlink mid-walk is never followed (O_NOFOLLOW on every
+// open, and symlinks themselves are only ever unlinked).
+struct DirNode {
+    std::shared_ptr<DirNode> parent;
+    std::string name;
+    std::string path;
+    int fd = -1;
+    std::atomic<int> pending{1};
+};
+
+class Remover {
+private:
+    bool force;
+    WorkPool pool;
+    std::mutex lock;
+    std::atomic<bool> failed{false};
+
+    void error(const std::string& path, int err) {
+        if (force && err == ENOENT) return;
+        std::lock_guard<std::mutex> guard(lock);
+        std::cerr << "rm: cannot remove '" << path << "': " << strerror(err) << "\n";
+        failed = true;
+    }
+
+    static int parent_fd(const DirNode& node) {
+        return node.parent ? node.parent->fd : AT_FDCWD;
+    }
+
+    // Drop one reference; the last one removes the (now empty) directory
+    // and passes the news up
+    void release(const std::shared_ptr<DirNode>& node) {
+        if (node->pending.fetch_sub(1) != 1) return;
+        if (node->fd >= 0) {
+            close(node->fd);
+            node->fd = -1;
+            if (unlinkat(parent_fd(*node), node->name.c_str(), AT_REMOVEDIR) != 0) {
+                error(node->path, errno);
+            }
+        }
+        if (node->parent) release(node->parent);
+    }
+
+    void push(const std::shared_ptr<DirNode>& parent, const char* name) {
+        auto node = std::make_shared<DirNode>();
+        node->parent = parent;
+        node->name = name;
+        node->path = parent->path + "/" + name;
+        parent->pending++;
+        pool.push([this, node] { empty_dir(node); });
+    }
+
+    void empty_dir(const std::shared_ptr<DirNode>& node) {
+        node->fd = openat(parent_fd(*node), node->name.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (node->fd < 0) {
+            error(node->path, errno);
+            if (node->parent) release(node->parent);
+            return;
+        }
+        bool ok = read_dirents(node->fd, [&](const char* name, unsigned char type) {
+            if (is_dot_or_dotdot(name)) return;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(node->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) type = IFTODT(st.st_mode);
+            }
+            if (type == DT_DIR) {
+                push(node, name);
+            } else if (unlinkat(node->fd, name, 0) != 0) {
+                error(node->path + "/" + name, errno);
+            }
+        });
+        if (!ok) error(node->path, errno);
+        release(node);
+    }
+
+public:
+    explicit Remover(bool f) : force(f) {}
+
+    void add(const std::string& path, bool recursive) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            error(path, errno);
+            return;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            if (unlink(path.c_str()) != 0) error(path, errno);
+            return;
+        }
+        if (!recursive) {
+            error(path, EISDIR);
+            return;
+        }
+        auto node = std::make_shared<DirNode>();
+        node->name = path;
+        node->path = path;
+        pool.push([this, node] { empty_dir(node); });
+    }
+
+    int run() {
+        pool.run();
+        return failed ? 1 : 0;
+    }
+};
+
+// `.`, `..` and `/` are never removed, however they are spelled
+bool refused(const std::string& path) {
+    size_t end = path.find_last_not_of('/');
+    if (end == std::string::npos) {
+        std::cerr << "rm: it is dangerous to operate recursively on '/'\n";
+        return true;
+    }
+    size_t start = path.find_last_of('/', end);
+    std::string last = path.substr(start == std::string::npos ? 0 : start + 1,
+                                   end - (start == std::string::npos ? 0 : start + 1) + 1);
+    if (last == "." || last == "..") {
+        std::cerr << "rm: refusing to remove '.' or '..' directory: skipping '" << path << "'\n";
+        return true;
+    }
+    char real[PATH_MAX];
+    if (realpath(path.c_str(), real) && strcmp(real, "/") == 0) {
+        std::cerr << "rm: it is dangerous to operate recursively on '/'\n";
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int RmCommand::execute(const std::vector<std::string>& args) {
+    bool recursive = false, force = false;
+    std::vector<std::string> operands;
+    bool options = true;
+    for (const auto& arg : args) {
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                switch (arg[i]) {
+                    case 'r': case 'R': recursive = true; break;
+                    case 'f': force = true; break;
+                    default:
+                        std::cerr << "rm: invalid option -- '" << arg[i] << "'\n"
+                                  << "Usage: rm [-fr] <file>...\n";
+                        return 1;
+                }
+            }
+        } else {
+            operands.push_back(arg);
+        }
+    }
+    if (operands.empty()) {
+        if (force) return 0;
+        std::cerr << "Usage: rm [-fr] <file>...\n";
+        return 1;
+    }
+
+    Remover remover(force);
+    int status = 0;
+    for (const auto& path : operands) {
+        if (refused(path)) {
+            status = 1;
+            continue;
+        }
+        remover.add(path, recursive);
+    }
+    return remover.run() | status;
+}
+
+std::string RmCommand::help() const {
+    return "Remove files and directories (-f -r)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
@@ -0,0 +1,199 @@
+#ifndef FUZZY_SHA256_HPP
+#define FUZZY_SHA256_HPP
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FUZZY_SHA256_X86 1
+#endif
+
+namespace FuzzyBox {
+
+// Streaming SHA-256 (FIPS 180-4). Whole blocks go straight from the
+// caller's buffer to the compression function. That function uses the
+// SHA-NI instructions when the CPU has them and a portable version
+// otherwise.
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+private:
+    using Compress = void (*)(uint32_t*, const uint8_t*, size_t);
+
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t used = 0;
+    uint64_t length = 0;
+
+    static constexpr uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    static void compress_portable(uint32_t* h, const uint8_t* data, size_t blocks) {
+        for (; blocks > 0; blocks--, data += 64) {
+            uint32_t w[64];
+            for (int t = 0; t < 16; t++) {
+                w[t] = (uint32_t(data[4 * t]) << 24) | (uint32_t(data[4 * t + 1]) << 16) |
+                       (uint32_t(data[4 * t + 2]) << 8) | uint32_t(data[4 * t + 3]);
+            }
+            for (int t = 16; t < 64; t++) {
+                uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+                uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+                w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+            }
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+            for (int t = 0; t < 64; t++) {
+                uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                k = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+            h[5] += f;
+            h[6] += g;
+            h[7] += k;
+        }
+    }
+
+#ifdef FUZZY_SHA256_X86
+    // The state lives as ABEF/CDGH halves, the layout sha256rnds2 wants.
+    // Each group of four rounds also extends the message schedule four
+    // words ahead: W[t+16..t+19] from msg1, msg2 and W[t+9..t+12].
+    __attribute__((target("sha,sse4.1"))) static void compress_shani(uint32_t* h, const uint8_t* data, size_t blocks) {
+        const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+        __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h)), 0xB1);
+        __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h + 4)), 0x1B);
+        __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+        cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+        for (; blocks > 0; blocks--, data += 64) {
+            __m128i abef_saved = abef, cdgh_saved = cdgh;
+            __m128i w[4];
+            for (int i = 0; i < 4; i++) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), byteswap);
+            }
+            for (int i = 0; i < 16; i++) {
+                __m128i& current = w[i & 3];
+                __m128i msg = _mm_add_epi32(current, _mm_loadu_si128(reinterpret_cast<const __m128i*>(K + 4 * i)));
+                cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+                abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+                if (i < 12) {
+                    const __m128i& next = w[(i + 1) & 3];
+                    const __m128i& third = w[(i + 2) & 3];
+                    const __m128i& last = w[(i + 3) & 3];
+                    __m128i sum = _mm_add_epi32(_mm_sha256msg1_epu32(current, next), _mm_alignr_epi8(last, third, 4));
+                    current = _mm_sha256msg2_epu32(sum, last);
+                }
+            }
+            abef = _mm_add_epi32(abef, abef_saved);
+            cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+        }
+
+        tmp = _mm_shuffle_epi32(abef, 0x1B);
+        cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h), _mm_blend_epi16(tmp, cdgh, 0xF0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+    }
+#endif
+
+    static Compress compressor() {
+        static const Compress chosen = [] {
+#ifdef FUZZY_SHA256_X86
+            if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) return &compress_shani;
+#endif
+            return &compress_portable;
+        }();
+        return chosen;
+    }
+
+public:
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state, initial, sizeof(state));
+        used = 0;
+        length = 0;
+    }
+
+    // Whether the SHA-NI path is in use
+    static bool accelerated() { return compressor() != &compress_portable; }
+
+    void update(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        length += size;
+        if (used > 0) {
+            size_t take = std::min(size, sizeof(block) - used);
+            memcpy(block + used, p, take);
+            used += take;
+            p += take;
+            size -= take;
+            if (used < sizeof(block)) return;
+            compressor()(state, block, 1);
+            used = 0;
+        }
+        if (size >= 64) {
+            compressor()(state, p, size / 64);
+            p += size & ~size_t(63);
+            size &= 63;
+        }
+        memcpy(block, p, size);
+        used = size;
+    }
+
+    Digest finish() {
+        uint64_t bits = length * 8;
+        uint8_t pad[72] = {0x80};
+        size_t pad_size = (used < 56 ? 56 : 120) - used;
+        for (int i = 0; i < 8; i++) pad[pad_size + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        update(pad, pad_size + 8);
+        Digest digest;
+        for (int i = 0; i < 8; i++) {
+            digest[4 * i] = static_cast<uint8_t>(state[i] >> 24);
+            digest[4 * i + 1] = static_cast<uint8_t>(state[i] >> 16);
+            digest[4 * i + 2] = static_cast<uint8_t>(state[i] >> 8);
+            digest[4 * i + 3] = static_cast<uint8_t>(state[i]);
+        }
+        reset();
+        return digest;
+    }
+
+    static std::string hex(const Digest& digest) {
+        static const char digits[] = "0123456789abcdef";
+        std::string text(64, '0');
+        for (size_t i = 0; i < digest.size(); i++) {
+            text[2 * i] = digits[digest[i] >> 4];
+            text[2 * i + 1] = digits[digest[i] & 15];
+        }
+        return text;
+    }
+};
+
+} // namespace FuzzyBox
+
+#endif // FUZZY_SHA256_HPP
@@ -0,0 +1,703 @@
+#include "fuzzylib.hpp"
+#include "fuzzyOutput.hpp"
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+const size_t DEFAULT_BUDGET = 256 << 20;
+const size_t MIN_BUDGET = 1 << 20;
+const size_t READ_BLOCK = 1 << 20;
+// Runs merged at once; more than this are merged in several passes
+const size_t MAX_FANIN = 64;
+// Chunks smaller than this are not worth splitting across threads
+const size_t PARALLEL_MIN = 1 << 16;
+
+struct KeySpec {
+    size_t field = 1;
+    size_t chr = 1;
+    size_t end_field = 0; // 0: to the end of the line
+    size_t end_chr = 0;   // 0: to the end of the field
+    bool numeric = false;
+    bool reverse = false;
+    bool blanks = false;
+};
+
+bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+// The ordering: keys compared in turn, then the whole line as a last
+// resort unless -u is comparing keys alone. Without -t a field starts at
+// the blanks in front of it, as in POSIX sort.
+class Order {
+private:
+    std::vector<KeySpec> keys;
+    char separator;
+    bool unique;
+    bool reverse;
+
+    // Offset where field `n` (1-based) starts
+    size_t field_start(std::string_view line, size_t n) const {
+        size_t pos = 0;
+        for (size_t f = 1; f < n && pos < line.size(); f++) {
+            if (separator) {
+                size_t sep = line.find(separator, pos);
+                if (sep == std::string_view::npos) return line.size();
+                pos = sep + 1;
+            } else {
+                while (pos < line.size() && is_blank(line[pos])) pos++;
+                while (pos < line.size() && !is_blank(line[pos])) pos++;
+            }
+        }
+        return std::min(pos, line.size());
+    }
+
+    size_t field_end(std::string_view line, size_t start) const {
+        if (separator) {
+            size_t sep = line.find(separator, start);
+            return sep == std::string_view::npos ? line.size() : sep;
+        }
+        size_t pos = start;
+        while (pos < line.size() && is_blank(line[pos])) pos++;
+        while (pos < line.size() && !is_blank(line[pos])) pos++;
+        return pos;
+    }
+
+    static int compare_numbers(std::string_view a, std::string_view b);
+
+    int compare_key(std::string_view a, std::string_view b, const KeySpec& spec) const {
+        std::string_view ka = key(a, spec), kb = key(b, spec);
+        int c;
+        if (spec.numeric) {
+            c = compare_numbers(ka, kb);
+        } else {
+            c = memcmp(ka.data(), kb.data(), std::min(ka.size(), kb.size()));
+            if (c == 0) c = ka.size() < kb.size() ? -1 : ka.size() > kb.size() ? 1 : 0;
+        }
+        return spec.reverse ? -c : c;
+    }
+
+public:
+    Order(std::vector<KeySpec> k, char sep, bool uniq, bool rev, bool numeric, bool blanks)
+        : keys(std::move(k)), separator(sep), unique(uniq), reverse(rev) {
+        if (keys.empty()) keys.push_back(KeySpec());
+        // Global -b, -n and -r apply to keys without options of their own
+        for (auto& spec : keys) {
+            if (!spec.numeric && !spec.reverse && !spec.blanks) {
+                spec.numeric = numeric;
+                spec.reverse = rev;
+                spec.blanks = blanks;
+            }
+        }
+    }
+
+    std::string_view key(std::string_view line, const KeySpec& spec) const {
+        size_t start = field_start(line, spec.field);
+        if (spec.blanks) {
+            while (start < line.size() && is_blank(line[start])) start++;
+        }
+        start = std::min(start + spec.chr - 1, line.size());
+        size_t end = line.size();
+        if (spec.end_field) {
+            size_t from = field_start(line, spec.end_field);
+            if (spec.end_chr) {
+                if (spec.blanks) {
+                    while (from < line.size() && is_blank(line[from])) from++;
+                }
+                end = std::min(from + spec.end_chr, line.size());
+            } else {
+                end = field_end(line, from);
+            }
+        }
+        return end > start ? line.substr(start, end - start) : std::string_view();
+    }
+
+    // Only byte-compared first keys get the cached prefix
+    bool prefixed() const { return !keys.front().numeric; }
+    bool prefix_reversed() const { return keys.front().reverse; }
+
+    // The first 8 bytes of the first key, big-endian, so that comparing
+    // prefixes as integers orders like memcmp
+    uint64_t prefix(std::string_view line) const {
+        std::string_view k = key(line, keys.front());
+        uint64_t p = 0;
+        for (size_t i = 0; i < 8; i++) {
+            p = (p << 8) | (i < k.size() ? static_cast<unsigned char>(k[i]) : 0);
+        }
+        return p;
+    }
+
+    int compare_keys(std::string_view a, std::string_view b) const {
+        for (const auto& spec : keys) {
+            int c = compare_key(a, b, spec);
+            if (c) return c;
+        }
+        return 0;
+    }
+
+    int compare(std::string_view a, std::string_view b) const {
+        int c = compare_keys(a, b);
+        if (c || unique) return c;
+        c = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+        if (c == 0) c = a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+        return reverse ? -c : c;
+    }
+
+    bool is_unique() const { return unique; }
+};
+
+// Numbers are compared as digit strings, so no precision is lost however
+// long they are: sign, then integer length, then the digits
+int Order::compare_numbers(std::string_view a, std::string_view b) {
+    struct Number {
+        bool negative = false;
+        std::string_view whole;
+        std::string_view fraction;
+        bool zero() const { return whole.empty() && fraction.empty(); }
+    };
+    auto parse = [](std::string_view s) {
+        Number n;
+        size_t i = 0;
+        while (i < s.size() && isspace(static_cast<unsigned char>(s[i]))) i++;
+        if (i < s.size() && s[i] == '-') {
+            n.negative = true;
+            i++;
+        }
+        while (i < s.size() && s[i] == '0') i++;
+        size_t start = i;
+        while (i < s.size() && isdigit(static_cast<unsigned char>(s[i]))) i++;
+        n.whole = s.substr(start, i - start);
+        if (i < s.size() && s[i] == '.') {
+            start = ++i;
+            while (i < s.size() && isdigit(static_cast<unsigned char>(s[i]))) i++;
+            size_t end = i;
+            while (end > start && s[end - 1] == '0') end--;
+            n.fraction = s.substr(start, end - start);
+        }
+        if (n.zero()) n.negative = false;
+        return n;
+    };
+    Number x = parse(a), y = parse(b);
+    if (x.negative != y.negative) return x.negative ? -1 : 1;
+    int c;
+    if (x.whole.size() != y.whole.size()) {
+        c = x.whole.size() < y.whole.size() ? -1 : 1;
+    } else {
+        c = x.whole.compare(y.whole);
+        if (c == 0) c = x.fraction.compare(y.fraction);
+        c = c < 0 ? -1 : c > 0 ? 1 : 0;
+    }
+    return x.negative ? -c : c;
+}
+
+// A line of the chunk being sorted: its key prefix first, so most
+// comparisons never leave the record array
+struct Record {
+    uint64_t prefix;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Tournament tree over k sorted sources: tree[0] holds the winner and
+// every inner node the loser of the match played there. Replacing the
+// winner replays a single leaf-to-root path, log2(k) comparisons, each
+// against a stored loser rather than both children.
+template <typename Less>
+class LoserTree {
+private:
+    size_t k;
+    std::vector<int> tree;
+    Less less; // less(a, b): source a's head goes first; exhausted sources never do
+
+    void play(int winner, bool building) {
+        for (size_t node = (winner + k) / 2; node > 0; node /= 2) {
+            if (building && tree[node] < 0) {
+                tree[node] = winner;
+                return;
+            }
+            if (less(tree[node], winner)) std::swap(tree[node], winner);
+        }
+        tree[0] = winner;
+    }
+
+public:
+    LoserTree(size_t sources, Less l) : k(sources), tree(std::max<size_t>(sources, 1), -1), less(l) {
+        for (size_t i = 0; i < k; i++) play(static_cast<int>(i), true);
+    }
+
+    int winner() const { return tree[0]; }
+
+    // The winner's source has moved on to its next head
+    void replay() { play(tree[0], false); }
+};
+
+template <typename Less>
+LoserTree<Less> make_loser_tree(size_t sources, Less less) {
+    return LoserTree<Less>(sources, less);
+}
+
+// Reads a spilled run back, one line at a time
+class RunReader {
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t start = 0;
+    size_t end = 0;
+    std::string_view current;
+    bool exhausted = false;
+
+public:
+    RunReader(int run_fd, size_t size) : fd(run_fd), buffer(std::max<size_t>(size, 4096)) {
+        lseek(fd, 0, SEEK_SET);
+        advance();
+    }
+
+    ~RunReader() { close(fd); }
+
+    bool done() const { return exhausted; }
+    std::string_view line() const { return current; }
+
+    void advance() {
+        for (;;) {
+            const char* nl = static_cast<const char*>(memchr(buffer.data() + start, '\n', end - start));
+            if (nl) {
+                current = std::string_view(buffer.data() + start, nl - buffer.data() - start);
+                start = nl - buffer.data() + 1;
+                return;
+            }
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+            ssize_t n = read(fd, buffer.data() + end, buffer.size() - end);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                exhausted = true;
+                return;
+            }
+            end += n;
+        }
+    }
+};
+
+class Sorter {
+private:
+    const Order& order;
+    size_t budget;
+    std::string temp_dir;
+    std::vector<char> text;
+    std::vector<Record> records;
+    std::vector<int> runs;
+
+    std::string_view view(const Record& r) const { return std::string_view(text.data() + r.offset, r.length); }
+
+    bool less(const Record& a, const Record& b) const {
+        if (order.prefixed() && a.prefix != b.prefix) {
+            return order.prefix_reversed() ? a.prefix > b.prefix : a.prefix < b.prefix;
+        }
+        return order.compare(view(a), view(b)) < 0;
+    }
+
+    // Writes lines in order, dropping -u duplicates
+    class Writer {
+    private:
+        const Order& order;
+        Output& out;
+        std::string last;
+        bool any = false;
+
+    public:
+        Writer(const Order& o, Output& output) : order(o), out(output) {}
+
+        void line(std::string_view s) {
+            if (order.is_unique()) {
+                if (any && order.compare(last, s) == 0) return;
+                last.assign(s.data(), s.size());
+                any = true;
+            }
+            out.write_parts({s, "\n"});
+        }
+    };
+
+    // Temporary files are unlinked at once and live on as descriptors
+    int temp_file() {
+        std::string path = temp_dir + "/sortXXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0) {
+            std::cerr << "sort: cannot create temporary file in '" << temp_dir << "': " << strerror(errno) << "\n";
+            return -1;
+        }
+        unlink(path.c_str());
+        return fd;
+    }
+
+    void sort_slice(size_t first, size_t last) {
+        auto cmp = [this](const Record& a, const Record& b) { return less(a, b); };
+        // -u keeps the first of equal lines, so their input order matters
+        if (order.is_unique()) {
+            std::stable_sort(records.begin() + first, records.begin() + last, cmp);
+        } else {
+            std::sort(records.begin() + first, records.begin() + last, cmp);
+        }
+    }
+
+    // Sort the chunk as independent slices on several threads, then
+    // merge the slices straight into `out`
+    void sort_chunk(Output& out) {
+        size_t threads = records.size() < PARALLEL_MIN ? 1 : std::min<size_t>(8, std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::pair<size_t, size_t>> slices;
+        for (size_t t = 0; t < threads; t++) {
+            slices.push_back({records.size() * t / threads, records.size() * (t + 1) / threads});
+        }
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; t++) {
+            workers.emplace_back([this, &slices, t] { sort_slice(slices[t].first, slices[t].second); });
+        }
+        sort_slice(slices[0].first, slices[0].second);
+        for (auto& worker : workers) worker.join();
+
+        Writer writer(order, out);
+        if (threads == 1) {
+            for (const auto& r : records) writer.line(view(r));
+            return;
+        }
+        std::vector<size_t> heads;
+        for (const auto& slice : slices) heads.push_back(slice.first);
+        auto tree = make_loser_tree(slices.size(), [&](int a, int b) {
+            if (a < 0) return false;
+            if (b < 0) return true;
+            bool a_done = heads[a] == slices[a].second, b_done = heads[b] == slices[b].second;
+            if (a_done || b_done) return !a_done;
+            const Record& ra = records[heads[a]];
+            const Record& rb = records[heads[b]];
+            return less(ra, rb) || (!less(rb, ra) && a < b);
+        });
+        for (;;) {
+            int w = tree.winner();
+            if (heads[w] == slices[w].second || interrupted) break;
+            writer.line(view(records[heads[w]]));
+            heads[w]++;
+            tree.replay();
+        }
+    }
+
+    bool spill() {
+        int fd = temp_file();
+        if (fd < 0) return false;
+        {
+            Output out(fd, 1 << 20);
+            sort_chunk(out);
+            out.flush();
+            if (!out.ok()) {
+                std::cerr << "sort: write failed: " << temp_dir << ": " << strerror(out.error()) << "\n";
+                close(fd);
+                return false;
+            }
+        }
+        runs.push_back(fd);
+        records.clear();
+        return true;
+    }
+
+    // Merge runs[first, last) into `out`, closing them
+    void merge(size_t first, size_t last, Output& out) {
+        size_t count = last - first;
+        size_t buffer = std::max<size_t>(budget / (count + 1), 64 << 10);
+        std::vector<std::unique_ptr<RunReader>> readers;
+        for (size_t i = first; i < last; i++) readers.push_back(std::make_unique<RunReader>(runs[i], buffer));
+        auto tree = make_loser_tree(count, [&](int a, int b) {
+            if (a < 0) return false;
+            if (b < 0) return true;
+            if (readers[a]->done() || readers[b]->done()) return !readers[a]->done();
+            int c = order.compare(readers[a]->line(), readers[b]->line());
+            return c < 0 || (c == 0 && a < b);
+        });
+        Writer writer(order, out);
+        for (;;) {
+            int w = tree.winner();
+            if (readers[w]->done() || !out.ok() || interrupted) break;
+            writer.line(readers[w]->line());
+            readers[w]->advance();
+            tree.replay();
+        }
+    }
+
+    // Records the complete lines in text[from, to) and returns the
+    // offset just past the last of them
+    size_t take_lines(size_t from, size_t to) {
+        size_t pos = from;
+        while (pos < to) {
+            const char* nl = static_cast<const char*>(memchr(text.data() + pos, '\n', to - pos));
+            if (!nl) break;
+            size_t end = nl - text.data();
+            std::string_view line(text.data() + pos, end - pos);
+            records.push_back({order.prefixed() ? order.prefix(line) : 0, static_cast<uint32_t>(pos),
+                               static_cast<uint32_t>(end - pos)});
+            pos = end + 1;
+        }
+        return pos;
+    }
+
+public:
+    Sorter(const Order& o, size_t memory, std::string tmp) : order(o), budget(memory), temp_dir(std::move(tmp)) {}
+
+    ~Sorter() {
+        for (int fd : runs) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    // Fill chunks from every input in turn; a chunk that reaches the
+    // budget (its text plus its records) is sorted and spilled. Offsets
+    // are 32-bit, which caps a chunk at 4G.
+    bool read_inputs(const std::vector<std::string>& files) {
+        size_t limit = std::min<size_t>(budget, UINT32_MAX);
+        size_t filled = 0; // bytes of text in use
+        size_t parsed = 0; // of which already split into records
+        for (const auto& file : files) {
+            bool use_stdin = file == "-";
+            int fd = use_stdin ? STDIN_FILENO : open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                std::cerr << "sort: cannot read: " << file << ": " << strerror(errno) << "\n";
+                return false;
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            for (;;) {
+                if (interrupted) {
+                    if (!use_stdin) close(fd);
+                    return false;
+                }
+                if (text.size() < filled + READ_BLOCK) text.resize(filled + READ_BLOCK);
+                ssize_t n = read(fd, text.data() + filled, READ_BLOCK);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    std::cerr << "sort: read failed: " << file << ": " << strerror(errno) << "\n";
+                    if (!use_stdin) close(fd);
+                    return false;
+                }
+                if (n == 0) break;
+                filled += n;
+                parsed = take_lines(parsed, filled);
+                if (filled + records.size() * sizeof(Record) >= limit) {
+                    // Spill what is complete and carry the partial line over
+                    if (!spill()) {
+                        if (!use_stdin) close(fd);
+                        return false;
+                    }
+                    memmove(text.data(), text.data() + parsed, filled - parsed);
+                    filled -= parsed;
+                    parsed = 0;
+                }
+            }
+            if (!use_stdin) close(fd);
+            // A last line without a newline still ends with its file
+            if (filled > parsed) {
+                text[filled++] = '\n';
+                parsed = take_lines(parsed, filled);
+            }
+        }
+        return true;
+    }
+
+    int finish() {
+        Output out;
+        if (runs.empty()) {
+            sort_chunk(out);
+        } else {
+            if (!records.empty() && !spill()) return 2;
+            text.clear();
+            text.shrink_to_fit();
+            // Cut the run count down to one merge's fan-in. Each pass merges
+            // consecutive groups and keeps them in input order, which the
+            // loser tree's tie-break (and so -u) relies on.
+            while (runs.size() > MAX_FANIN) {
+                std::vector<int> merged_runs;
+                for (size_t first = 0; first < runs.size(); first += MAX_FANIN) {
+                    size_t last = std::min(runs.size(), first + MAX_FANIN);
+                    if (last - first == 1) {
+                        merged_runs.push_back(runs[first]);
+                        continue;
+                    }
+                    int fd = temp_file();
+                    if (fd >= 0) {
+                        Output merged(fd, 1 << 20);
+                        merge(first, last, merged);
+                        std::fill(runs.begin() + first, runs.begin() + last, -1);
+                        merged.flush();
+                        if (!merged.ok()) {
+                            std::cerr << "sort: write failed: " << temp_dir << ": " << strerror(merged.error()) << "\n";
+                            close(fd);
+                            fd = -1;
+                        }
+                    }
+                    if (fd < 0) {
+                        runs.insert(runs.end(), merged_runs.begin(), merged_runs.end());
+                        return 2;
+                    }
+                    merged_runs.push_back(fd);
+                }
+                runs = std::move(merged_runs);
+            }
+            merge(0, runs.size(), out);
+            runs.clear();
+        }
+        out.flush();
+        return 0;
+    }
+};
+
+bool parse_size(const std::string& text, size_t& size) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (text.empty() || end == text.c_str() || errno != 0) {
+        std::cerr << "sort: invalid -S argument '" << text << "'\n";
+        return false;
+    }
+    std::string suffix(end);
+    if (suffix == "%") {
+        long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+        value = static_cast<unsigned long long>(pages) * page / 100 * value;
+    } else if (suffix == "k" || suffix == "K" || suffix.empty()) {
+        value <<= 10;
+    } else if (suffix == "m" || suffix == "M") {
+        value <<= 20;
+    } else if (suffix == "g" || suffix == "G") {
+        value <<= 30;
+    } else if (suffix != "b") {
+        std::cerr << "sort: invalid -S argument '" << text << "'\n";
+        return false;
+    }
+    size = std::max<size_t>(value, MIN_BUDGET);
+    return true;
+}
+
+// -k F[.C][bnr][,F[.C][bnr]]
+bool parse_key(const std::string& text, KeySpec& spec) {
+    const char* p = text.c_str();
+    auto number = [&p](size_t& out) {
+        if (!isdigit(static_cast<unsigned char>(*p))) return false;
+        out = strtoul(p, const_cast<char**>(&p), 10);
+        return true;
+    };
+    auto modifiers = [&p, &spec] {
+        for (; *p && *p != ','; p++) {
+            if (*p == 'n') spec.numeric = true;
+            else if (*p == 'r') spec.reverse = true;
+            else if (*p == 'b') spec.blanks = true;
+            else return false;
+        }
+        return true;
+    };
+    bool ok = number(spec.field) && spec.field > 0;
+    if (ok && *p == '.') {
+        p++;
+        ok = number(spec.chr) && spec.chr > 0;
+    }
+    ok = ok && modifiers();
+    if (ok && *p == ',') {
+        p++;
+        ok = number(spec.end_field) && spec.end_field > 0;
+        if (ok && *p == '.') {
+            p++;
+            ok = number(spec.end_chr);
+        }
+        ok = ok && modifiers();
+    }
+    if (!ok || *p) {
+        std::cerr << "sort: invalid key '" << text << "'\n";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int SortCommand::execute(const std::vector<std::string>& args) {
+    bool numeric = false, reverse = false, unique = false, blanks = false;
+    char separator = 0;
+    size_t budget = DEFAULT_BUDGET;
+    const char* tmp = getenv("TMPDIR");
+    std::string temp_dir = tmp && *tmp ? tmp : "/tmp";
+    std::vector<KeySpec> keys;
+    std::vector<std::string> files;
+    bool options = true;
+    const char* usage = "Usage: sort [-bnru] [-k key] [-t sep] [-S size] [-T dir] [file...]\n";
+
+    for (size_t a = 0; a < args.size(); a++) {
+        const std::string& arg = args[a];
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                char c = arg[i];
+                if (c == 'n') {
+                    numeric = true;
+                } else if (c == 'r') {
+                    reverse = true;
+                } else if (c == 'u') {
+                    unique = true;
+                } else if (c == 'b') {
+                    blanks = true;
+                } else if (c == 'k' || c == 't' || c == 'S' || c == 'T') {
+                    std::string value = arg.substr(i + 1);
+                    if (value.empty()) {
+                        if (++a == args.size()) {
+                            std::cerr << "sort: option requires an argument -- '" << c << "'\n" << usage;
+                            return 2;
+                        }
+                        value = args[a];
+                    }
+                    if (c == 'k') {
+                        KeySpec spec;
+                        if (!parse_key(value, spec)) return 2;
+                        keys.push_back(spec);
+                    } else if (c == 't') {
+                        if (value.size() != 1) {
+                            std::cerr << "sort: the separator must be a single character\n";
+                            return 2;
+                        }
+                        separator = value[0];
+                    } else if (c == 'S') {
+                        if (!parse_size(value, budget)) return 2;
+                    } else {
+                        temp_dir = value;
+                    }
+                    break;
+                } else {
+                    std::cerr << "sort: invalid option -- '" << c << "'\n" << usage;
+                    return 2;
+                }
+            }
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty()) files.push_back("-");
+
+    Order order(keys, separator, unique, reverse, numeric, blanks);
+    Sorter sorter(order, budget, temp_dir);
+    if (!sorter.read_inputs(files)) return 2;
+    return sorter.finish();
+}
+
+std::string SortCommand::help() const {
+    return "Sort lines of text, spilling to disk past a memory budget (-b -n -r -u -k -t -S -T)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
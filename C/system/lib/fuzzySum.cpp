@@ -0,0 +1,416 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include "fuzzyOutput.hpp"
+#include "fuzzySha256.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+const size_t READ_SIZE = 256 << 10;
+
+struct SumOptions {
+    bool check = false;
+    bool recursive = false;
+    bool quiet = false;
+};
+
+// A file and what became of hashing it
+struct Hashed {
+    std::string path;
+    std::string hex;
+    int error = 0;
+};
+
+// Hash a file (or stdin for "-") relative to `dirfd`
+int hash_file(int dirfd, const std::string& path, std::string& hex) {
+    bool use_stdin = path == "-";
+    int fd = use_stdin ? STDIN_FILENO : openat(dirfd, path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (!use_stdin) close(fd);
+        return EISDIR;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    thread_local std::unique_ptr<char[]> buffer(new char[READ_SIZE]);
+    Sha256 sha;
+    int err = 0;
+    for (;;) {
+        if (interrupted) {
+            err = EINTR;
+            break;
+        }
+        ssize_t n = read(fd, buffer.get(), READ_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            err = errno;
+            break;
+        }
+        if (n == 0) break;
+        sha.update(buffer.get(), n);
+    }
+    if (!use_stdin) close(fd);
+    if (err == 0) hex = Sha256::hex(sha.finish());
+    return err;
+}
+
+// Hash every entry on a WorkPool; results stay in input order
+void hash_all(int dirfd, std::vector<Hashed>& files) {
+    if (files.size() == 1) {
+        files[0].error = hash_file(dirfd, files[0].path, files[0].hex);
+        return;
+    }
+    WorkPool pool;
+    for (auto& file : files) {
+        Hashed* entry = &file;
+        pool.push([dirfd, entry] { entry->error = hash_file(dirfd, entry->path, entry->hex); });
+    }
+    pool.run();
+}
+
+// Names with a backslash or newline are written escaped, the line marked
+// with a leading backslash, as coreutils does
+std::string escape_name(const std::string& name, bool& escaped) {
+    escaped = name.find_first_of("\\\n") != std::string::npos;
+    if (!escaped) return name;
+    std::string out;
+    for (char c : name) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
+
+bool unescape_name(std::string& name) {
+    std::string out;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (name[i] != '\\') {
+            out += name[i];
+            continue;
+        }
+        if (++i == name.size()) return false;
+        if (name[i] == '\\') out += '\\';
+        else if (name[i] == 'n') out += '\n';
+        else return false;
+    }
+    name = out;
+    return true;
+}
+
+void write_sum(Output& out, const std::string& hex, const std::string& name) {
+    bool escaped;
+    std::string text = escape_name(name, escaped);
+    out.write_parts({escaped ? "\\" : "", hex, "  ", text, "\n"});
+}
+
+// "<hex>  <name>" or "<hex> *<name>"; false for anything else
+bool parse_sum(std::string line, std::string& hex, std::string& name) {
+    bool escaped = !line.empty() && line[0] == '\\';
+    if (escaped) line.erase(0, 1);
+    if (line.size() < 67 || line[64] != ' ' || (line[65] != ' ' && line[65] != '*')) return false;
+    for (size_t i = 0; i < 64; i++) {
+        if (!isxdigit(static_cast<unsigned char>(line[i]))) return false;
+    }
+    hex = line.substr(0, 64);
+    std::transform(hex.begin(), hex.end(), hex.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    name = line.substr(66);
+    return !escaped || unescape_name(name);
+}
+
+// Results of a verification, reported the way coreutils words them
+class Verdict {
+private:
+    Output& out;
+    bool quiet;
+    size_t mismatched = 0;
+    size_t unreadable = 0;
+    size_t extra = 0;
+
+public:
+    size_t malformed = 0;
+
+    Verdict(Output& o, bool q) : out(o), quiet(q) {}
+
+    void check(const std::string& name, const std::string& expected, const Hashed& actual) {
+        if (actual.error) {
+            out.flush();
+            std::cerr << "sha256sum: " << name << ": " << strerror(actual.error) << "\n";
+            out.write_parts({name, ": FAILED open or read\n"});
+            unreadable++;
+        } else if (actual.hex != expected) {
+            out.write_parts({name, ": FAILED\n"});
+            mismatched++;
+        } else if (!quiet) {
+            out.write_parts({name, ": OK\n"});
+        }
+    }
+
+    void missing(const std::string& name) {
+        out.write_parts({name, ": MISSING\n"});
+        unreadable++;
+    }
+
+    void unlisted(const std::string& name) {
+        out.write_parts({name, ": NOT IN MANIFEST\n"});
+        extra++;
+    }
+
+    int finish() {
+        out.flush();
+        auto warn = [](size_t n, const char* one, const char* many) {
+            if (n) std::cerr << "sha256sum: WARNING: " << n << " " << (n == 1 ? one : many) << "\n";
+        };
+        warn(malformed, "line is improperly formatted", "lines are improperly formatted");
+        warn(unreadable, "listed file could not be read", "listed files could not be read");
+        warn(mismatched, "computed checksum did NOT match", "computed checksums did NOT match");
+        warn(extra, "file is not in the manifest", "files are not in the manifest");
+        return mismatched || unreadable || extra ? 1 : 0;
+    }
+};
+
+// Regular files under `root`, as paths relative to it, sorted. Symlinks
+// and special files are not part of a manifest.
+bool list_tree(const std::string& root, std::vector<Hashed>& files) {
+    WorkPool pool;
+    std::mutex lock;
+    bool ok = true;
+    std::function<void(const std::string&)> walk = [&](const std::string& rel) {
+        std::string path = rel.empty() ? root : root + "/" + rel;
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            std::cerr << "sha256sum: " << path << ": " << strerror(errno) << "\n";
+            ok = false;
+            return;
+        }
+        std::vector<Hashed> found;
+        read_dirents(fd, [&](const char* name, unsigned char type) {
+            if (is_dot_or_dotdot(name)) return;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) type = IFTODT(st.st_mode);
+            }
+            std::string child = rel.empty() ? name : rel + "/" + name;
+            if (type == DT_DIR) {
+                pool.push([&walk, child] { walk(child); });
+            } else if (type == DT_REG) {
+                found.push_back({child, "", 0});
+            }
+        });
+        close(fd);
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& file : found) files.push_back(std::move(file));
+    };
+    pool.push([&walk] { walk(""); });
+    pool.run();
+    std::sort(files.begin(), files.end(), [](const Hashed& a, const Hashed& b) { return a.path < b.path; });
+    return ok;
+}
+
+int open_root(const std::string& root) {
+    int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) std::cerr << "sha256sum: " << root << ": " << strerror(errno) << "\n";
+    return fd;
+}
+
+int write_manifest(const std::string& root) {
+    std::vector<Hashed> files;
+    bool ok = list_tree(root, files);
+    int fd = open_root(root);
+    if (fd < 0) return 1;
+    hash_all(fd, files);
+    close(fd);
+    Output out;
+    for (const auto& file : files) {
+        if (file.error) {
+            out.flush();
+            std::cerr << "sha256sum: " << root << "/" << file.path << ": " << strerror(file.error) << "\n";
+            ok = false;
+            continue;
+        }
+        write_sum(out, file.hex, file.path);
+    }
+    out.flush();
+    return ok ? 0 : 1;
+}
+
+bool read_lines(const std::string& source, std::vector<std::string>& lines) {
+    std::string text;
+    if (source == "-") {
+        std::ostringstream ss;
+        ss << std::cin.rdbuf();
+        text = ss.str();
+    } else {
+        std::ifstream in(source, std::ios::binary);
+        if (!in) {
+            std::cerr << "sha256sum: " << source << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        text = ss.str();
+    }
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == std::string::npos) nl = text.size();
+        lines.push_back(text.substr(pos, nl - pos));
+        pos = nl + 1;
+    }
+    return true;
+}
+
+struct Listed {
+    std::string hex;
+    std::string name;
+};
+
+bool parse_list(const std::string& source, std::vector<Listed>& entries, Verdict& verdict) {
+    std::vector<std::string> lines;
+    if (!read_lines(source, lines)) return false;
+    size_t before = entries.size();
+    for (const auto& line : lines) {
+        Listed entry;
+        if (parse_sum(line, entry.hex, entry.name)) entries.push_back(std::move(entry));
+        else verdict.malformed++;
+    }
+    if (entries.size() == before) {
+        std::cerr << "sha256sum: " << source << ": no properly formatted checksum lines found\n";
+        return false;
+    }
+    return true;
+}
+
+// Merge the sorted manifest against the sorted tree: every file is
+// checked, and files missing from either side are reported
+int check_manifest(const std::string& manifest, const std::string& root, bool quiet) {
+    Output out;
+    Verdict verdict(out, quiet);
+    std::vector<Listed> listed;
+    if (!parse_list(manifest, listed, verdict)) return 1;
+    std::sort(listed.begin(), listed.end(), [](const Listed& a, const Listed& b) { return a.name < b.name; });
+
+    std::vector<Hashed> files;
+    bool ok = list_tree(root, files);
+    int fd = open_root(root);
+    if (fd < 0) return 1;
+    hash_all(fd, files);
+    close(fd);
+
+    size_t i = 0, j = 0;
+    while (i < listed.size() || j < files.size()) {
+        if (j == files.size() || (i < listed.size() && listed[i].name < files[j].path)) {
+            verdict.missing(listed[i++].name);
+        } else if (i == listed.size() || files[j].path < listed[i].name) {
+            verdict.unlisted(files[j++].path);
+        } else {
+            verdict.check(listed[i].name, listed[i].hex, files[j]);
+            i++;
+            j++;
+        }
+    }
+    return verdict.finish() | (ok ? 0 : 1);
+}
+
+int check_lists(const std::vector<std::string>& sources, bool quiet) {
+    Output out;
+    Verdict verdict(out, quiet);
+    int status = 0;
+    for (const auto& source : sources) {
+        std::vector<Listed> listed;
+        if (!parse_list(source, listed, verdict)) {
+            status = 1;
+            continue;
+        }
+        std::vector<Hashed> files;
+        for (const auto& entry : listed) files.push_back({entry.name, "", 0});
+        hash_all(AT_FDCWD, files);
+        for (size_t i = 0; i < listed.size(); i++) verdict.check(listed[i].name, listed[i].hex, files[i]);
+    }
+    return verdict.finish() | status;
+}
+
+int print_sums(const std::vector<std::string>& names) {
+    std::vector<Hashed> files;
+    for (const auto& name : names) files.push_back({name, "", 0});
+    hash_all(AT_FDCWD, files);
+    Output out;
+    int status = 0;
+    for (const auto& file : files) {
+        if (file.error) {
+            out.flush();
+            std::cerr << "sha256sum: " << file.path << ": " << strerror(file.error) << "\n";
+            status = 1;
+            continue;
+        }
+        write_sum(out, file.hex, file.path);
+    }
+    out.flush();
+    return status;
+}
+
+} // namespace
+
+int Sha256SumCommand::execute(const std::vector<std::string>& args) {
+    SumOptions opts;
+    std::vector<std::string> operands;
+    bool options = true;
+    const char* usage = "Usage: sha256sum [-q] [file...]\n"
+                        "       sha256sum -c [-q] [sumfile...]\n"
+                        "       sha256sum -r <dir>              (write a manifest of the tree)\n"
+                        "       sha256sum -r -c <manifest> <dir> (check the tree against it)\n";
+    for (const auto& arg : args) {
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && (arg == "--quiet" || arg == "--check")) {
+            (arg == "--quiet" ? opts.quiet : opts.check) = true;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                switch (arg[i]) {
+                    case 'c': opts.check = true; break;
+                    case 'r': opts.recursive = true; break;
+                    case 'q': opts.quiet = true; break;
+                    default:
+                        std::cerr << "sha256sum: invalid option -- '" << arg[i] << "'\n" << usage;
+                        return 1;
+                }
+            }
+        } else {
+            operands.push_back(arg);
+        }
+    }
+
+    if (opts.recursive) {
+        if (opts.check && operands.size() == 2) return check_manifest(operands[0], operands[1], opts.quiet);
+        if (!opts.check && operands.size() == 1) return write_manifest(operands[0]);
+        std::cerr << usage;
+        return 1;
+    }
+    if (operands.empty()) operands.push_back("-");
+    return opts.check ? check_lists(operands, opts.quiet) : print_sums(operands);
+}
+
+std::string Sha256SumCommand::help() const {
+    return "Compute and check SHA-256 checksums, in parallel (-c -q -r for tree manifests)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
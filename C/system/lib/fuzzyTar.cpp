@@ -0,0 +1,1428 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <zlib.h>
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+const size_t BLOCK = 512;
+// Archives are padded to GNU tar's default record of 20 blocks
+const size_t RECORD = 20 * BLOCK;
+// Compression works on independent chunks of this size
+const size_t CHUNK = 1 << 20;
+const size_t COPY_SIZE = 256 << 10;
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// Codecs. Compression cuts the stream into CHUNK-sized pieces and turns
+// each into a complete gzip member or zstd frame. Those are compressed
+// side by side on worker threads and written in order; both formats
+// define a concatenation of members/frames as one stream. Decoding is
+// sequential, but runs in its own thread ahead of the tar parser.
+
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+    // Decode `size` bytes of input, appending to `out`
+    virtual bool decode(const char* data, size_t size, std::string& out) = 0;
+    // Whether the input so far ends on a member/frame boundary
+    virtual bool complete() const = 0;
+};
+
+struct Codec {
+    const char* name;
+    unsigned char magic[4];
+    size_t magic_size;
+    int level;
+    bool (*available)();
+    bool (*compress)(const char* data, size_t size, int level, std::string& out);
+    std::unique_ptr<Decoder> (*decoder)();
+};
+
+bool gzip_available() { return true; }
+
+bool gzip_compress(const char* data, size_t size, int level, std::string& out) {
+    z_stream zs = {};
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    out.resize(deflateBound(&zs, size));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in = static_cast<uInt>(size);
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+class GzipDecoder : public Decoder {
+private:
+    z_stream zs = {};
+    bool member_done = false;
+    bool started = false;
+    std::vector<char> buffer = std::vector<char>(COPY_SIZE);
+
+public:
+    GzipDecoder() { inflateInit2(&zs, 15 + 16); }
+    ~GzipDecoder() override { inflateEnd(&zs); }
+
+    bool decode(const char* data, size_t size, std::string& out) override {
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = static_cast<uInt>(size);
+        for (;;) {
+            if (member_done) {
+                if (zs.avail_in == 0) break;
+                inflateReset(&zs);
+                member_done = false;
+            }
+            started = true;
+            zs.next_out = reinterpret_cast<Bytef*>(buffer.data());
+            zs.avail_out = static_cast<uInt>(buffer.size());
+            int rc = inflate(&zs, Z_NO_FLUSH);
+            out.append(buffer.data(), buffer.size() - zs.avail_out);
+            if (rc == Z_STREAM_END) {
+                member_done = true;
+                continue;
+            }
+            if (rc == Z_BUF_ERROR) break;
+            if (rc != Z_OK) return false;
+            if (zs.avail_in == 0 && zs.avail_out != 0) break;
+        }
+        return true;
+    }
+
+    bool complete() const override { return member_done || !started; }
+};
+
+std::unique_ptr<Decoder> gzip_decoder() { return std::make_unique<GzipDecoder>(); }
+
+// libzstd is loaded at run time, so systems without it (or without its
+// headers at build time) still get every other codec. Only the stable
+// part of its API is used.
+struct ZstdInBuffer {
+    const void* src;
+    size_t size;
+    size_t pos;
+};
+
+struct ZstdOutBuffer {
+    void* dst;
+    size_t size;
+    size_t pos;
+};
+
+struct ZstdApi {
+    size_t (*compress)(void*, size_t, const void*, size_t, int) = nullptr;
+    size_t (*compress_bound)(size_t) = nullptr;
+    unsigned (*is_error)(size_t) = nullptr;
+    void* (*create_dstream)() = nullptr;
+    size_t (*init_dstream)(void*) = nullptr;
+    size_t (*free_dstream)(void*) = nullptr;
+    size_t (*decompress_stream)(void*, ZstdOutBuffer*, ZstdInBuffer*) = nullptr;
+    bool loaded = false;
+};
+
+const ZstdApi& zstd() {
+    static const ZstdApi api = [] {
+        ZstdApi z;
+        void* lib = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (!lib) return z;
+        z.compress = reinterpret_cast<decltype(z.compress)>(dlsym(lib, "ZSTD_compress"));
+        z.compress_bound = reinterpret_cast<decltype(z.compress_bound)>(dlsym(lib, "ZSTD_compressBound"));
+        z.is_error = reinterpret_cast<decltype(z.is_error)>(dlsym(lib, "ZSTD_isError"));
+        z.create_dstream = reinterpret_cast<decltype(z.create_dstream)>(dlsym(lib, "ZSTD_createDStream"));
+        z.init_dstream = reinterpret_cast<decltype(z.init_dstream)>(dlsym(lib, "ZSTD_initDStream"));
+        z.free_dstream = reinterpret_cast<decltype(z.free_dstream)>(dlsym(lib, "ZSTD_freeDStream"));
+        z.decompress_stream = reinterpret_cast<decltype(z.decompress_stream)>(dlsym(lib, "ZSTD_decompressStream"));
+        z.loaded = z.compress && z.compress_bound && z.is_error && z.create_dstream && z.init_dstream &&
+                   z.free_dstream && z.decompress_stream;
+        return z;
+    }();
+    return api;
+}
+
+bool zstd_available() { return zstd().loaded; }
+
+bool zstd_compress(const char* data, size_t size, int level, std::string& out) {
+    const ZstdApi& z = zstd();
+    out.resize(z.compress_bound(size));
+    size_t n = z.compress(&out[0], out.size(), data, size, level);
+    if (z.is_error(n)) return false;
+    out.resize(n);
+    return true;
+}
+
+class ZstdDecoder : public Decoder {
+private:
+    const ZstdApi& z = zstd();
+    void* stream;
+    bool frame_done = true;
+    std::vector<char> buffer = std::vector<char>(COPY_SIZE);
+
+public:
+    ZstdDecoder() : stream(z.create_dstream()) { z.init_dstream(stream); }
+    ~ZstdDecoder() override { z.free_dstream(stream); }
+
+    bool decode(const char* data, size_t size, std::string& out) override {
+        ZstdInBuffer in = {data, size, 0};
+        while (in.pos < in.size) {
+            ZstdOutBuffer o = {buffer.data(), buffer.size(), 0};
+            size_t rc = z.decompress_stream(stream, &o, &in);
+            if (z.is_error(rc)) return false;
+            out.append(buffer.data(), o.pos);
+            frame_done = rc == 0;
+            // A full buffer may hold back more output for the same input
+            while (o.pos == o.size) {
+                o.pos = 0;
+                rc = z.decompress_stream(stream, &o, &in);
+                if (z.is_error(rc)) return false;
+                out.append(buffer.data(), o.pos);
+                frame_done = rc == 0;
+            }
+        }
+        return true;
+    }
+
+    bool complete() const override { return frame_done; }
+};
+
+std::unique_ptr<Decoder> zstd_decoder() { return std::make_unique<ZstdDecoder>(); }
+
+const Codec codecs[] = {
+    {"gzip", {0x1f, 0x8b}, 2, 6, gzip_available, gzip_compress, gzip_decoder},
+    {"zstd", {0x28, 0xb5, 0x2f, 0xfd}, 4, 3, zstd_available, zstd_compress, zstd_decoder},
+};
+
+const Codec* find_codec(const std::string& name) {
+    for (const auto& codec : codecs) {
+        if (name == codec.name) return &codec;
+    }
+    return nullptr;
+}
+
+const Codec* detect_codec(const char* data, size_t size) {
+    for (const auto& codec : codecs) {
+        if (size >= codec.magic_size && memcmp(data, codec.magic, codec.magic_size) == 0) return &codec;
+    }
+    return nullptr;
+}
+
+// ---------------------------------------------------------------------
+// Archive streams
+
+// Buffers the archive into chunks and passes each to the codec on its
+// own thread, keeping a few in flight and writing results in order
+class ArchiveWriter {
+private:
+    int fd;
+    const Codec* codec;
+    unsigned threads;
+    std::string chunk;
+    std::deque<std::future<std::pair<bool, std::string>>> pending;
+    uint64_t total = 0;
+    bool failed = false;
+
+    void drain_one() {
+        auto result = pending.front().get();
+        pending.pop_front();
+        if (!result.first) {
+            if (!failed) std::cerr << "tar: " << codec->name << " compression failed\n";
+            failed = true;
+        } else if (!failed && !write_all(fd, result.second.data(), result.second.size())) {
+            std::cerr << "tar: write error: " << strerror(errno) << "\n";
+            failed = true;
+        }
+    }
+
+    void ship() {
+        if (chunk.empty()) return;
+        if (!codec) {
+            if (!failed && !write_all(fd, chunk.data(), chunk.size())) {
+                std::cerr << "tar: write error: " << strerror(errno) << "\n";
+                failed = true;
+            }
+            chunk.clear();
+            return;
+        }
+        while (pending.size() >= threads * 2) drain_one();
+        const Codec* c = codec;
+        pending.push_back(std::async(std::launch::async, [c, data = std::move(chunk)] {
+            std::string out;
+            bool ok = c->compress(data.data(), data.size(), c->level, out);
+            return std::make_pair(ok, std::move(out));
+        }));
+        chunk = std::string();
+        chunk.reserve(CHUNK);
+    }
+
+public:
+    ArchiveWriter(int out_fd, const Codec* c)
+        : fd(out_fd), codec(c), threads(std::max(1u, std::min(16u, std::thread::hardware_concurrency()))) {
+        chunk.reserve(CHUNK);
+    }
+
+    bool ok() const { return !failed; }
+
+    void write(const char* data, size_t size) {
+        total += size;
+        while (size > 0) {
+            size_t take = std::min(size, CHUNK - chunk.size());
+            chunk.append(data, take);
+            data += take;
+            size -= take;
+            if (chunk.size() == CHUNK) ship();
+        }
+    }
+
+    void zeros(size_t size) {
+        static const char nothing[BLOCK] = {};
+        while (size > 0) {
+            size_t take = std::min(size, BLOCK);
+            write(nothing, take);
+            size -= take;
+        }
+    }
+
+    void pad() { zeros((BLOCK - total % BLOCK) % BLOCK); }
+
+    // The end-of-archive blocks, padding to a whole record, and the rest
+    // of the pipeline
+    bool finish() {
+        zeros(2 * BLOCK);
+        zeros((RECORD - total % RECORD) % RECORD);
+        ship();
+        while (!pending.empty()) drain_one();
+        return !failed;
+    }
+};
+
+// Decoded blocks handed from the decoding thread to the parser
+class BlockQueue {
+private:
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::string> blocks;
+    bool closed = false;
+    bool abandoned = false;
+    static const size_t MAX_BLOCKS = 8;
+
+public:
+    bool push(std::string block) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return blocks.size() < MAX_BLOCKS || abandoned; });
+        if (abandoned) return false;
+        blocks.push_back(std::move(block));
+        changed.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        changed.notify_all();
+    }
+
+    void abandon() {
+        std::lock_guard<std::mutex> guard(lock);
+        abandoned = true;
+        changed.notify_all();
+    }
+
+    // False once the producer is done and everything has been taken
+    bool pop(std::string& block) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return !blocks.empty() || closed; });
+        if (blocks.empty()) return false;
+        block = std::move(blocks.front());
+        blocks.pop_front();
+        changed.notify_all();
+        return true;
+    }
+};
+
+class ArchiveReader {
+private:
+    int fd;
+    const Codec* codec = nullptr;
+    BlockQueue queue;
+    std::thread worker;
+    std::string current;
+    size_t pos = 0;
+    bool eof = false;
+    std::string failure;
+
+    void decode_all(std::string first) {
+        std::unique_ptr<Decoder> decoder = codec->decoder();
+        std::string in = std::move(first);
+        std::string out;
+        for (;;) {
+            if (!decoder->decode(in.data(), in.size(), out)) {
+                failure = std::string(codec->name) + ": invalid compressed data";
+                break;
+            }
+            if (out.size() >= COPY_SIZE) {
+                if (!queue.push(std::move(out))) return;
+                out = std::string();
+            }
+            in.resize(CHUNK);
+            ssize_t n = read(fd, &in[0], in.size());
+            if (n < 0 && errno == EINTR) {
+                in.clear();
+                continue;
+            }
+            if (n < 0) {
+                failure = std::string("read error: ") + strerror(errno);
+                break;
+            }
+            if (n == 0) {
+                if (!decoder->complete()) failure = std::string(codec->name) + ": unexpected end of compressed data";
+                break;
+            }
+            in.resize(n);
+        }
+        if (!out.empty()) queue.push(std::move(out));
+        queue.close();
+    }
+
+    bool fill() {
+        if (eof) return false;
+        if (codec) {
+            if (queue.pop(current)) {
+                pos = 0;
+                return true;
+            }
+            if (worker.joinable()) worker.join();
+            eof = true;
+            return false;
+        }
+        current.resize(COPY_SIZE);
+        for (;;) {
+            ssize_t n = read(fd, &current[0], current.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) failure = std::string("read error: ") + strerror(errno);
+            if (n <= 0) {
+                current.clear();
+                eof = true;
+                return false;
+            }
+            current.resize(n);
+            pos = 0;
+            return true;
+        }
+    }
+
+public:
+    explicit ArchiveReader(int in_fd) : fd(in_fd) {}
+
+    ~ArchiveReader() {
+        queue.abandon();
+        if (worker.joinable()) worker.join();
+    }
+
+    // Read the first bytes to recognize a compressed archive
+    bool start() {
+        std::string head(BLOCK, '\0');
+        size_t got = 0;
+        while (got < head.size()) {
+            ssize_t n = read(fd, &head[got], head.size() - got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                failure = std::string("read error: ") + strerror(errno);
+                return false;
+            }
+            if (n == 0) break;
+            got += n;
+        }
+        head.resize(got);
+        codec = detect_codec(head.data(), head.size());
+        if (codec && !codec->available()) {
+            failure = std::string("archive is ") + codec->name + "-compressed, and lib" + codec->name + " is not available";
+            return false;
+        }
+        if (codec) {
+            worker = std::thread([this, h = std::move(head)]() mutable { decode_all(std::move(h)); });
+        } else {
+            current = std::move(head);
+            pos = 0;
+        }
+        return true;
+    }
+
+    const std::string& error() const { return failure; }
+
+    // Hands out up to `max` bytes in place; false at the end
+    bool next(const char*& data, size_t& size, size_t max) {
+        while (pos == current.size()) {
+            if (!fill()) return false;
+        }
+        data = current.data() + pos;
+        size = std::min(max, current.size() - pos);
+        pos += size;
+        return true;
+    }
+
+    bool read_exact(char* out, size_t size) {
+        while (size > 0) {
+            const char* data;
+            size_t n;
+            if (!next(data, n, size)) return false;
+            memcpy(out, data, n);
+            out += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    bool skip(uint64_t size) {
+        while (size > 0) {
+            const char* data;
+            size_t n;
+            if (!next(data, n, std::min<uint64_t>(size, COPY_SIZE))) return false;
+            size -= n;
+        }
+        return true;
+    }
+};
+
+// ---------------------------------------------------------------------
+// Headers
+
+struct Header {
+    std::string name;
+    std::string link;
+    char type = '0';
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint32_t devmajor = 0;
+    uint32_t devminor = 0;
+    std::string uname;
+    std::string gname;
+};
+
+struct RawHeader {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char link[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+static_assert(sizeof(RawHeader) == BLOCK, "tar headers are one block");
+
+// width - 1 octal digits and a NUL; false if the value does not fit
+bool put_octal(char* field, size_t width, uint64_t value) {
+    if (width < 12 && value >> (3 * (width - 1))) return false;
+    if (width >= 12 && value > 077777777777ull) return false;
+    snprintf(field, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+    return true;
+}
+
+// Octal, or GNU's base-256 with the top bit of the first byte set
+uint64_t get_number(const char* field, size_t width) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(field);
+    uint64_t value = 0;
+    if (p[0] & 0x80) {
+        value = p[0] & 0x3f;
+        for (size_t i = 1; i < width; i++) value = (value << 8) | p[i];
+        return value;
+    }
+    size_t i = 0;
+    while (i < width && (p[i] == ' ' || p[i] == '\0')) {
+        if (p[i] == '\0') return 0;
+        i++;
+    }
+    for (; i < width && p[i] >= '0' && p[i] <= '7'; i++) value = (value << 3) | (p[i] - '0');
+    return value;
+}
+
+unsigned header_checksum(const RawHeader& raw) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(&raw);
+    unsigned sum = 0;
+    for (size_t i = 0; i < BLOCK; i++) {
+        bool in_field = i >= offsetof(RawHeader, checksum) && i < offsetof(RawHeader, checksum) + 8;
+        sum += in_field ? ' ' : p[i];
+    }
+    return sum;
+}
+
+void add_pax(std::string& pax, const std::string& key, const std::string& value) {
+    std::string body = " " + key + "=" + value + "\n";
+    size_t length = body.size() + 1;
+    while (std::to_string(length).size() + body.size() != length) length++;
+    pax += std::to_string(length) + body;
+}
+
+void copy_field(char* field, size_t width, const std::string& value) {
+    memcpy(field, value.data(), std::min(width, value.size()));
+}
+
+// ustar header, preceded by a pax header for whatever ustar cannot hold
+void write_header(ArchiveWriter& out, const Header& h) {
+    RawHeader raw = {};
+    std::string pax;
+
+    std::string prefix, name = h.name;
+    if (name.size() > sizeof(raw.name)) {
+        size_t split = std::string::npos;
+        for (size_t i = name.find('/'); i != std::string::npos && i <= sizeof(raw.prefix); i = name.find('/', i + 1)) {
+            if (name.size() - i - 1 <= sizeof(raw.name) && name.size() - i - 1 > 0) {
+                split = i;
+                break;
+            }
+        }
+        if (split != std::string::npos) {
+            prefix = name.substr(0, split);
+            name = name.substr(split + 1);
+        } else {
+            add_pax(pax, "path", h.name);
+        }
+    }
+    copy_field(raw.name, sizeof(raw.name), name);
+    copy_field(raw.prefix, sizeof(raw.prefix), prefix);
+    if (h.link.size() > sizeof(raw.link)) add_pax(pax, "linkpath", h.link);
+    copy_field(raw.link, sizeof(raw.link), h.link);
+
+    put_octal(raw.mode, sizeof(raw.mode), h.mode & 07777);
+    if (!put_octal(raw.uid, sizeof(raw.uid), h.uid)) {
+        add_pax(pax, "uid", std::to_string(h.uid));
+        put_octal(raw.uid, sizeof(raw.uid), 0);
+    }
+    if (!put_octal(raw.gid, sizeof(raw.gid), h.gid)) {
+        add_pax(pax, "gid", std::to_string(h.gid));
+        put_octal(raw.gid, sizeof(raw.gid), 0);
+    }
+    if (!put_octal(raw.size, sizeof(raw.size), h.size)) {
+        add_pax(pax, "size", std::to_string(h.size));
+        put_octal(raw.size, sizeof(raw.size), 0);
+    }
+    if (h.mtime < 0 || !put_octal(raw.mtime, sizeof(raw.mtime), h.mtime)) {
+        add_pax(pax, "mtime", std::to_string(h.mtime));
+        put_octal(raw.mtime, sizeof(raw.mtime), 0);
+    }
+    raw.type = h.type;
+    memcpy(raw.magic, "ustar", 6);
+    memcpy(raw.version, "00", 2);
+    copy_field(raw.uname, sizeof(raw.uname) - 1, h.uname);
+    copy_field(raw.gname, sizeof(raw.gname) - 1, h.gname);
+    put_octal(raw.devmajor, sizeof(raw.devmajor), h.devmajor);
+    put_octal(raw.devminor, sizeof(raw.devminor), h.devminor);
+    snprintf(raw.checksum, sizeof(raw.checksum), "%06o", header_checksum(raw));
+    raw.checksum[7] = ' ';
+
+    if (!pax.empty()) {
+        Header x;
+        size_t slash = h.name.find_last_of('/', h.name.size() > 1 ? h.name.size() - 2 : 0);
+        x.name = "PaxHeaders/" + (slash == std::string::npos ? h.name : h.name.substr(slash + 1));
+        if (x.name.size() > 100) x.name.resize(100);
+        x.type = 'x';
+        x.size = pax.size();
+        x.mode = 0644;
+        x.mtime = h.mtime > 0 ? h.mtime : 0;
+        write_header(out, x);
+        out.write(pax.data(), pax.size());
+        out.pad();
+    }
+    out.write(reinterpret_cast<const char*>(&raw), sizeof(raw));
+}
+
+// pax records override the next header's fields
+void apply_pax(const std::string& records, std::map<std::string, std::string>& values) {
+    size_t pos = 0;
+    while (pos < records.size()) {
+        size_t space = records.find(' ', pos);
+        if (space == std::string::npos) break;
+        size_t length = strtoull(records.c_str() + pos, nullptr, 10);
+        if (length == 0 || pos + length > records.size()) break;
+        std::string record = records.substr(space + 1, pos + length - space - 2);
+        size_t eq = record.find('=');
+        if (eq != std::string::npos) values[record.substr(0, eq)] = record.substr(eq + 1);
+        pos += length;
+    }
+}
+
+// ---------------------------------------------------------------------
+// Creation
+
+// A file to archive. Directories are read on the WorkPool, each sorting
+// its own entries, and the archive is then written by walking the tree
+// in order, so the output does not depend on which worker got there first.
+struct Node {
+    std::string name;
+    std::string path;
+    struct stat st;
+    std::string link;
+    int stat_error = 0;
+    int read_error = 0;
+    std::vector<std::unique_ptr<Node>> children;
+};
+
+class Creator {
+private:
+    ArchiveWriter& out;
+    bool verbose;
+    std::ostream& log;
+    WorkPool pool;
+    std::vector<std::unique_ptr<Node>> roots;
+    std::map<std::pair<dev_t, ino_t>, std::string> links;
+    std::map<uid_t, std::string> users;
+    std::map<gid_t, std::string> groups;
+    struct stat archive;
+    bool has_archive = false;
+    bool failed = false;
+
+    void scan(Node* dir) {
+        int fd = open(dir->path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            dir->read_error = errno;
+            return;
+        }
+        std::vector<std::string> names;
+        if (!read_dirents(fd, [&](const char* name, unsigned char) {
+                if (!is_dot_or_dotdot(name)) names.push_back(name);
+            })) {
+            dir->read_error = errno;
+        }
+        std::sort(names.begin(), names.end());
+        for (const auto& name : names) {
+            auto child = std::make_unique<Node>();
+            child->name = dir->name + "/" + name;
+            child->path = dir->path + "/" + name;
+            if (fstatat(fd, name.c_str(), &child->st, AT_SYMLINK_NOFOLLOW) != 0) {
+                child->stat_error = errno;
+            } else if (S_ISLNK(child->st.st_mode)) {
+                char target[4096];
+                ssize_t n = readlinkat(fd, name.c_str(), target, sizeof(target));
+                if (n >= 0) child->link.assign(target, n);
+            }
+            dir->children.push_back(std::move(child));
+        }
+        close(fd);
+        // Only now is the children vector final
+        for (auto& child : dir->children) {
+            if (!child->stat_error && S_ISDIR(child->st.st_mode)) {
+                Node* raw = child.get();
+                pool.push([this, raw] { scan(raw); });
+            }
+        }
+    }
+
+    const std::string& user(uid_t uid) {
+        auto it = users.find(uid);
+        if (it != users.end()) return it->second;
+        struct passwd* pw = getpwuid(uid);
+        return users[uid] = pw ? pw->pw_name : "";
+    }
+
+    const std::string& group(gid_t gid) {
+        auto it = groups.find(gid);
+        if (it != groups.end()) return it->second;
+        struct group* gr = getgrgid(gid);
+        return groups[gid] = gr ? gr->gr_name : "";
+    }
+
+    void warn(const std::string& path, const char* what, int err) {
+        std::cerr << "tar: " << path << ": " << what << ": " << strerror(err) << "\n";
+        failed = true;
+    }
+
+    // Stream a regular file's contents, exactly as long as its header says
+    void copy_data(const Node& node, uint64_t size) {
+        int fd = open(node.path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            warn(node.path, "Cannot open", errno);
+            out.zeros(size);
+            out.pad();
+            return;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        static thread_local std::vector<char> buffer(COPY_SIZE);
+        uint64_t left = size;
+        while (left > 0 && !interrupted) {
+            ssize_t n = read(fd, buffer.data(), std::min<uint64_t>(left, buffer.size()));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (n < 0) warn(node.path, "Read error", errno);
+                else std::cerr << "tar: " << node.path << ": File shrank by " << left << " bytes; padding with zeros\n";
+                failed = true;
+                out.zeros(left);
+                break;
+            }
+            out.write(buffer.data(), n);
+            left -= n;
+        }
+        close(fd);
+        out.pad();
+    }
+
+    void emit(const Node& node) {
+        if (interrupted) return;
+        if (node.stat_error) {
+            warn(node.path, "Cannot stat", node.stat_error);
+            return;
+        }
+        const struct stat& st = node.st;
+        if (has_archive && st.st_dev == archive.st_dev && st.st_ino == archive.st_ino) {
+            std::cerr << "tar: " << node.path << ": file is the archive; not dumped\n";
+            return;
+        }
+        Header h;
+        h.name = node.name;
+        h.mode = st.st_mode;
+        h.uid = st.st_uid;
+        h.gid = st.st_gid;
+        h.mtime = st.st_mtime;
+        h.uname = user(st.st_uid);
+        h.gname = group(st.st_gid);
+
+        bool data = false;
+        if (S_ISREG(st.st_mode)) {
+            auto key = std::make_pair(st.st_dev, st.st_ino);
+            auto seen = st.st_nlink > 1 ? links.find(key) : links.end();
+            if (seen != links.end()) {
+                h.type = '1';
+                h.link = seen->second;
+            } else {
+                if (st.st_nlink > 1) links[key] = node.name;
+                h.type = '0';
+                h.size = st.st_size;
+                data = true;
+            }
+        } else if (S_ISDIR(st.st_mode)) {
+            h.type = '5';
+            h.name += '/';
+        } else if (S_ISLNK(st.st_mode)) {
+            h.type = '2';
+            h.link = node.link;
+        } else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+            h.type = S_ISCHR(st.st_mode) ? '3' : '4';
+            h.devmajor = major(st.st_rdev);
+            h.devminor = minor(st.st_rdev);
+        } else if (S_ISFIFO(st.st_mode)) {
+            h.type = '6';
+        } else {
+            std::cerr << "tar: " << node.path << ": socket ignored\n";
+            return;
+        }
+
+        if (verbose) log << h.name << "\n";
+        write_header(out, h);
+        if (data) copy_data(node, h.size);
+        if (node.read_error) warn(node.path, "Cannot read directory", node.read_error);
+        for (const auto& child : node.children) emit(*child);
+    }
+
+public:
+    Creator(ArchiveWriter& writer, bool v, std::ostream& l, int archive_fd) : out(writer), verbose(v), log(l) {
+        has_archive = archive_fd >= 0 && fstat(archive_fd, &archive) == 0 && S_ISREG(archive.st_mode);
+    }
+
+    void add(const std::string& name, const std::string& path) {
+        auto node = std::make_unique<Node>();
+        node->name = name;
+        node->path = path;
+        if (lstat(path.c_str(), &node->st) != 0) {
+            node->stat_error = errno;
+        } else if (S_ISLNK(node->st.st_mode)) {
+            char target[4096];
+            ssize_t n = readlink(path.c_str(), target, sizeof(target));
+            if (n >= 0) node->link.assign(target, n);
+        } else if (S_ISDIR(node->st.st_mode)) {
+            Node* raw = node.get();
+            pool.push([this, raw] { scan(raw); });
+        }
+        roots.push_back(std::move(node));
+    }
+
+    bool run() {
+        pool.run();
+        for (const auto& root : roots) emit(*root);
+        return !failed && !interrupted;
+    }
+};
+
+// ---------------------------------------------------------------------
+// Extraction and listing
+
+// Member names are made relative and may not climb out of the target
+// Links, devices and directories have no data, whatever the size field
+// says; unknown types are treated as regular files
+bool carries_data(char type) { return type == '\0' || !strchr("123456", type); }
+
+bool clean_name(const std::string& name, std::string& clean, bool& warned_absolute) {
+    size_t start = name.find_first_not_of('/');
+    if (start == std::string::npos) start = name.size();
+    if (start > 0 && !warned_absolute) {
+        std::cerr << "tar: Removing leading `/' from member names\n";
+        warned_absolute = true;
+    }
+    clean.clear();
+    size_t pos = start;
+    while (pos < name.size()) {
+        size_t slash = name.find('/', pos);
+        if (slash == std::string::npos) slash = name.size();
+        std::string part = name.substr(pos, slash - pos);
+        if (part == "..") {
+            std::cerr << "tar: " << name << ": Member name contains '..'\n";
+            return false;
+        }
+        if (!part.empty() && part != ".") {
+            if (!clean.empty()) clean += '/';
+            clean += part;
+        }
+        pos = slash + 1;
+    }
+    return true;
+}
+
+class Extractor {
+private:
+    int root;
+    bool verbose;
+    bool privileged;
+    mode_t mask;
+    std::string cached_dir;
+    int cached_fd = -1;
+    bool failed = false;
+    bool warned_absolute = false;
+
+    struct Fixup {
+        std::string path;
+        Header header;
+    };
+    std::vector<Fixup> fixups;
+
+    void warn(const std::string& path, const char* what, int err) {
+        std::cerr << "tar: " << path << ": " << what << ": " << strerror(err) << "\n";
+        failed = true;
+    }
+
+    // Open the directory `dir` below the root, creating missing parts if
+    // asked. Every component is opened with O_NOFOLLOW relative to the
+    // last, so a symlink in the archive cannot redirect later members.
+    int open_dir(const std::string& dir, bool create) {
+        int fd = dup(root);
+        size_t pos = 0;
+        while (fd >= 0 && pos <= dir.size()) {
+            size_t next = dir.find('/', pos);
+            if (next == std::string::npos) next = dir.size();
+            std::string part = dir.substr(pos, next - pos);
+            int sub = openat(fd, part.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (sub < 0 && create && errno == ENOENT && mkdirat(fd, part.c_str(), 0777) == 0) {
+                sub = openat(fd, part.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+            if (sub < 0) warn(dir.substr(0, next), "Cannot open", errno);
+            close(fd);
+            fd = sub;
+            pos = next + 1;
+        }
+        return fd;
+    }
+
+    static void split(const std::string& path, std::string& dir, std::string& leaf) {
+        size_t slash = path.rfind('/');
+        leaf = slash == std::string::npos ? path : path.substr(slash + 1);
+        dir = slash == std::string::npos ? "" : path.substr(0, slash);
+    }
+
+    // Directory fd for the parent of `path`, owned by the one-entry cache
+    int parent_of(const std::string& path, std::string& leaf, bool create = true) {
+        std::string dir;
+        split(path, dir, leaf);
+        if (dir.empty()) return root;
+        if (cached_fd >= 0 && dir == cached_dir) return cached_fd;
+        if (cached_fd >= 0) close(cached_fd);
+        cached_fd = open_dir(dir, create);
+        cached_dir = dir;
+        return cached_fd;
+    }
+
+    mode_t file_mode(const Header& h) const { return privileged ? h.mode & 07777 : h.mode & 0777 & ~mask; }
+
+    void extract_file(ArchiveReader& in, const Header& h, int dir, const std::string& leaf, const std::string& path) {
+        // Whatever is in the way is replaced, never written through: it
+        // may be a hard link to a file outside the target
+        int fd = openat(dir, leaf.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            replace(dir, leaf);
+            fd = openat(dir, leaf.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        }
+        if (fd < 0) {
+            warn(path, "Cannot open", errno);
+            in.skip(h.size);
+            return;
+        }
+        // Reserve the space up front: fewer extents, and ENOSPC before
+        // any data is written
+        if (h.size > 0 && fallocate(fd, 0, 0, h.size) != 0 && errno == ENOSPC) {
+            warn(path, "Cannot write", ENOSPC);
+        }
+        uint64_t left = h.size;
+        bool write_failed = false;
+        while (left > 0 && !interrupted) {
+            const char* data;
+            size_t n;
+            if (!in.next(data, n, std::min<uint64_t>(left, COPY_SIZE))) break;
+            if (!write_failed && !write_all(fd, data, n)) {
+                warn(path, "Cannot write", errno);
+                write_failed = true;
+            }
+            left -= n;
+        }
+        if (privileged) fchown(fd, h.uid, h.gid);
+        fchmod(fd, file_mode(h));
+        struct timespec times[2] = {{h.mtime, 0}, {h.mtime, 0}};
+        futimens(fd, times);
+        close(fd);
+    }
+
+    void replace(int dir, const std::string& leaf) {
+        if (unlinkat(dir, leaf.c_str(), 0) != 0 && errno == EISDIR) unlinkat(dir, leaf.c_str(), AT_REMOVEDIR);
+    }
+
+public:
+    Extractor(int root_fd, bool v) : root(root_fd), verbose(v), privileged(geteuid() == 0) {
+        mask = umask(0);
+        umask(mask);
+    }
+
+    ~Extractor() {
+        if (cached_fd >= 0) close(cached_fd);
+    }
+
+    void extract(ArchiveReader& in, const Header& h) {
+        std::string path;
+        bool regular = carries_data(h.type);
+        if (!clean_name(h.name, path, warned_absolute)) {
+            failed = true;
+            if (regular) in.skip(h.size);
+            return;
+        }
+        if (verbose) std::cout << h.name << "\n";
+        if (path.empty()) {
+            if (regular) in.skip(h.size);
+            return;
+        }
+        std::string leaf;
+        int dir = parent_of(path, leaf);
+        if (dir < 0) {
+            if (regular) in.skip(h.size);
+            return;
+        }
+        struct timespec times[2] = {{h.mtime, 0}, {h.mtime, 0}};
+        switch (h.type) {
+            case '0': case '\0': case '7':
+                extract_file(in, h, dir, leaf, path);
+                break;
+            case '5':
+                if (mkdirat(dir, leaf.c_str(), 0700) != 0 && errno != EEXIST) {
+                    warn(path, "Cannot mkdir", errno);
+                    break;
+                }
+                fixups.push_back({path, h});
+                break;
+            case '2': {
+                int rc = symlinkat(h.link.c_str(), dir, leaf.c_str());
+                if (rc != 0 && errno == EEXIST) {
+                    replace(dir, leaf);
+                    rc = symlinkat(h.link.c_str(), dir, leaf.c_str());
+                }
+                if (rc != 0) {
+                    warn(path, "Cannot create symlink", errno);
+                    break;
+                }
+                if (privileged) fchownat(dir, leaf.c_str(), h.uid, h.gid, AT_SYMLINK_NOFOLLOW);
+                utimensat(dir, leaf.c_str(), times, AT_SYMLINK_NOFOLLOW);
+                break;
+            }
+            case '1': {
+                std::string target;
+                if (!clean_name(h.link, target, warned_absolute)) {
+                    failed = true;
+                    break;
+                }
+                // The target is reached by the same O_NOFOLLOW walk, so it
+                // cannot name a file outside the root
+                std::string target_dir, target_leaf;
+                split(target, target_dir, target_leaf);
+                int from = target_dir.empty() ? root : open_dir(target_dir, false);
+                if (from < 0) break;
+                int rc = linkat(from, target_leaf.c_str(), dir, leaf.c_str(), 0);
+                if (rc != 0 && errno == EEXIST) {
+                    replace(dir, leaf);
+                    rc = linkat(from, target_leaf.c_str(), dir, leaf.c_str(), 0);
+                }
+                if (rc != 0) warn(path, "Cannot hard link", errno);
+                if (from != root) close(from);
+                break;
+            }
+            case '3': case '4': case '6': {
+                mode_t type = h.type == '3' ? S_IFCHR : h.type == '4' ? S_IFBLK : S_IFIFO;
+                replace(dir, leaf);
+                if (mknodat(dir, leaf.c_str(), type | file_mode(h), makedev(h.devmajor, h.devminor)) != 0) {
+                    warn(path, "Cannot mknod", errno);
+                    break;
+                }
+                if (privileged) fchownat(dir, leaf.c_str(), h.uid, h.gid, AT_SYMLINK_NOFOLLOW);
+                utimensat(dir, leaf.c_str(), times, AT_SYMLINK_NOFOLLOW);
+                break;
+            }
+            default:
+                std::cerr << "tar: " << h.name << ": Unknown file type '" << h.type << "', extracted as normal file\n";
+                extract_file(in, h, dir, leaf, path);
+                break;
+        }
+    }
+
+    // Directory modes and times go last, deepest first, so extracting
+    // into them is not blocked and their mtimes are not disturbed. Each
+    // is reopened without following symlinks, since a later member may
+    // have replaced it with one.
+    bool finish() {
+        for (auto it = fixups.rbegin(); it != fixups.rend(); ++it) {
+            const Header& h = it->header;
+            std::string leaf;
+            int dir = parent_of(it->path, leaf, false);
+            if (dir < 0) continue;
+            int fd = openat(dir, leaf.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0) continue;
+            struct timespec times[2] = {{h.mtime, 0}, {h.mtime, 0}};
+            if (privileged) fchown(fd, h.uid, h.gid);
+            fchmod(fd, file_mode(h));
+            futimens(fd, times);
+            close(fd);
+        }
+        if (cached_fd >= 0) close(cached_fd);
+        cached_fd = -1;
+        return !failed;
+    }
+};
+
+std::string long_listing(const Header& h) {
+    static const char types[] = "-hlcbdp";
+    const char* kinds = "0123456";
+    const char* t = strchr(kinds, h.type ? h.type : '0');
+    std::string mode(1, t ? types[t - kinds] : '-');
+    const char* bits = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) mode += (h.mode & (0400 >> i)) ? bits[i] : '-';
+    if (h.mode & 04000) mode[3] = (h.mode & 0100) ? 's' : 'S';
+    if (h.mode & 02000) mode[6] = (h.mode & 010) ? 's' : 'S';
+    if (h.mode & 01000) mode[9] = (h.mode & 01) ? 't' : 'T';
+    std::string owner = (h.uname.empty() ? std::to_string(h.uid) : h.uname) + "/" +
+                        (h.gname.empty() ? std::to_string(h.gid) : h.gname);
+    char date[32];
+    time_t mtime = h.mtime;
+    struct tm tm;
+    localtime_r(&mtime, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+    char size[32];
+    if (h.type == '3' || h.type == '4') snprintf(size, sizeof(size), "%u,%u", h.devmajor, h.devminor);
+    else snprintf(size, sizeof(size), "%llu", static_cast<unsigned long long>(h.size));
+    std::string line = mode + " " + owner + " ";
+    size_t width = owner.size() + strlen(size) + 1;
+    if (width < 19) line.append(19 - width, ' ');
+    line += std::string(size) + " " + date + " " + h.name;
+    if (h.type == '1') line += " link to " + h.link;
+    if (h.type == '2') line += " -> " + h.link;
+    return line;
+}
+
+bool selected(const std::string& name, const std::vector<std::string>& members) {
+    if (members.empty()) return true;
+    std::string bare = name;
+    while (bare.size() > 1 && bare.back() == '/') bare.pop_back();
+    for (const auto& m : members) {
+        std::string want = m;
+        while (want.size() > 1 && want.back() == '/') want.pop_back();
+        if (bare == want || (bare.size() > want.size() && bare.compare(0, want.size(), want) == 0 && bare[want.size()] == '/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Walk the archive's members, extracting them or listing them
+int read_archive(int fd, bool extract, bool verbose, const std::string& target, const std::vector<std::string>& members) {
+    ArchiveReader in(fd);
+    if (!in.start()) {
+        std::cerr << "tar: " << in.error() << "\n";
+        return 2;
+    }
+    int root = -1;
+    if (extract) {
+        root = open(target.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (root < 0) {
+            std::cerr << "tar: " << target << ": Cannot open: " << strerror(errno) << "\n";
+            return 2;
+        }
+    }
+    Extractor extractor(root, verbose);
+    std::map<std::string, std::string> pax;
+    std::string long_name, long_link;
+    bool any = false;
+    int status = 0;
+
+    for (;;) {
+        if (interrupted) {
+            status = 2;
+            break;
+        }
+        RawHeader raw;
+        if (!in.read_exact(reinterpret_cast<char*>(&raw), BLOCK)) {
+            if (!in.error().empty()) std::cerr << "tar: " << in.error() << "\n";
+            else if (!any) std::cerr << "tar: This does not look like a tar archive\n";
+            else std::cerr << "tar: Unexpected EOF in archive\n";
+            status = 2;
+            break;
+        }
+        const char* bytes = reinterpret_cast<const char*>(&raw);
+        if (std::all_of(bytes, bytes + BLOCK, [](char c) { return c == 0; })) break;
+        if (get_number(raw.checksum, sizeof(raw.checksum)) != header_checksum(raw)) {
+            std::cerr << (any ? "tar: Skipping to next header\n" : "tar: This does not look like a tar archive\n");
+            status = 2;
+            break;
+        }
+        any = true;
+
+        Header h;
+        h.type = raw.type;
+        h.mode = static_cast<uint32_t>(get_number(raw.mode, sizeof(raw.mode)));
+        h.uid = static_cast<uint32_t>(get_number(raw.uid, sizeof(raw.uid)));
+        h.gid = static_cast<uint32_t>(get_number(raw.gid, sizeof(raw.gid)));
+        h.size = get_number(raw.size, sizeof(raw.size));
+        h.mtime = static_cast<int64_t>(get_number(raw.mtime, sizeof(raw.mtime)));
+        h.devmajor = static_cast<uint32_t>(get_number(raw.devmajor, sizeof(raw.devmajor)));
+        h.devminor = static_cast<uint32_t>(get_number(raw.devminor, sizeof(raw.devminor)));
+        h.uname.assign(raw.uname, strnlen(raw.uname, sizeof(raw.uname)));
+        h.gname.assign(raw.gname, strnlen(raw.gname, sizeof(raw.gname)));
+        h.link.assign(raw.link, strnlen(raw.link, sizeof(raw.link)));
+        h.name.assign(raw.name, strnlen(raw.name, sizeof(raw.name)));
+        if (memcmp(raw.magic, "ustar", 5) == 0 && raw.prefix[0]) {
+            h.name = std::string(raw.prefix, strnlen(raw.prefix, sizeof(raw.prefix))) + "/" + h.name;
+        }
+        uint64_t padded = (h.size + BLOCK - 1) / BLOCK * BLOCK;
+
+        // Extended headers describe the member that follows them
+        if (h.type == 'x' || h.type == 'g' || h.type == 'L' || h.type == 'K') {
+            std::string body(h.size, '\0');
+            if (!in.read_exact(&body[0], body.size()) || !in.skip(padded - h.size)) {
+                std::cerr << "tar: Unexpected EOF in archive\n";
+                status = 2;
+                break;
+            }
+            if (h.type == 'x') apply_pax(body, pax);
+            if (h.type == 'L') long_name = body.c_str();
+            if (h.type == 'K') long_link = body.c_str();
+            continue;
+        }
+        if (!long_name.empty()) h.name = long_name;
+        if (!long_link.empty()) h.link = long_link;
+        for (const auto& entry : pax) {
+            if (entry.first == "path") h.name = entry.second;
+            else if (entry.first == "linkpath") h.link = entry.second;
+            else if (entry.first == "size") h.size = strtoull(entry.second.c_str(), nullptr, 10);
+            else if (entry.first == "mtime") h.mtime = strtoll(entry.second.c_str(), nullptr, 10);
+            else if (entry.first == "uid") h.uid = static_cast<uint32_t>(strtoul(entry.second.c_str(), nullptr, 10));
+            else if (entry.first == "gid") h.gid = static_cast<uint32_t>(strtoul(entry.second.c_str(), nullptr, 10));
+            else if (entry.first == "uname") h.uname = entry.second;
+            else if (entry.first == "gname") h.gname = entry.second;
+        }
+        long_name.clear();
+        long_link.clear();
+        pax.clear();
+        padded = (h.size + BLOCK - 1) / BLOCK * BLOCK;
+        bool has_data = carries_data(h.type);
+        uint64_t data = has_data ? h.size : 0;
+        uint64_t padding = has_data ? padded - h.size : 0;
+
+        if (!selected(h.name, members)) {
+            in.skip(data + padding);
+            continue;
+        }
+        if (extract) {
+            extractor.extract(in, h);
+            in.skip(padding);
+        } else {
+            std::cout << (verbose ? long_listing(h) : h.name) << "\n";
+            in.skip(data + padding);
+        }
+    }
+    if (extract) {
+        if (!extractor.finish() && status == 0) status = 2;
+        close(root);
+    }
+    std::cout.flush();
+    return status;
+}
+
+} // namespace
+
+int TarCommand::execute(const std::vector<std::string>& args) {
+    char mode = 0;
+    bool verbose = false;
+    const Codec* codec = nullptr;
+    std::string archive = "-";
+    std::string directory;
+    std::vector<std::string> operands;
+    const char* usage = "Usage: tar -c [-vz] [--zstd] [-f archive] [-C dir] <file>...\n"
+                        "       tar -x|-t [-v] [-f archive] [-C dir] [member...]\n";
+
+    // Old-style bundled letters ("tar czf out.tgz dir") and their
+    // arguments taken in order from the words that follow
+    std::vector<std::string> words = args;
+    bool old_style = !words.empty() && !words[0].empty() && words[0][0] != '-';
+    if (old_style) words[0] = "-" + words[0];
+    bool options = true;
+    for (size_t a = 0; a < words.size(); a++) {
+        const std::string& arg = words[a];
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && (arg == "--zstd" || arg == "--gzip")) {
+            codec = find_codec(arg.substr(2));
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                char c = arg[i];
+                switch (c) {
+                    case 'c': case 'x': case 't':
+                        if (mode && mode != c) {
+                            std::cerr << "tar: You may not specify more than one '-ctx' option\n" << usage;
+                            return 2;
+                        }
+                        mode = c;
+                        break;
+                    case 'v': verbose = true; break;
+                    case 'z': codec = find_codec("gzip"); break;
+                    case 'f': case 'C': {
+                        std::string value;
+                        if (!(a == 0 && old_style) && i + 1 < arg.size()) {
+                            value = arg.substr(i + 1);
+                            i = arg.size();
+                        } else if (++a < words.size()) {
+                            value = words[a];
+                        } else {
+                            std::cerr << "tar: option requires an argument -- '" << c << "'\n" << usage;
+                            return 2;
+                        }
+                        (c == 'f' ? archive : directory) = value;
+                        break;
+                    }
+                    default:
+                        std::cerr << "tar: invalid option -- '" << c << "'\n" << usage;
+                        return 2;
+                }
+            }
+        } else {
+            operands.push_back(arg);
+        }
+    }
+    if (!mode) {
+        std::cerr << "tar: You must specify one of the '-ctx' options\n" << usage;
+        return 2;
+    }
+
+    if (mode == 'c') {
+        if (operands.empty()) {
+            std::cerr << "tar: Cowardly refusing to create an empty archive\n";
+            return 2;
+        }
+        if (codec && !codec->available()) {
+            std::cerr << "tar: lib" << codec->name << " is not available\n";
+            return 2;
+        }
+        int fd = archive == "-" ? STDOUT_FILENO : open(archive.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            std::cerr << "tar: " << archive << ": Cannot open: " << strerror(errno) << "\n";
+            return 2;
+        }
+        if (isatty(fd)) {
+            std::cerr << "tar: Refusing to write archive contents to terminal\n";
+            return 2;
+        }
+        std::cout.flush();
+        ArchiveWriter writer(fd, codec);
+        Creator creator(writer, verbose, archive == "-" ? std::cerr : std::cout, fd);
+        bool warned_absolute = false;
+        for (const auto& operand : operands) {
+            std::string name = operand;
+            size_t start = name.find_first_not_of('/');
+            if (start != 0 && start != std::string::npos) {
+                if (!warned_absolute) std::cerr << "tar: Removing leading `/' from member names\n";
+                warned_absolute = true;
+                name = name.substr(start);
+            }
+            while (name.size() > 1 && name.back() == '/') name.pop_back();
+            std::string path = directory.empty() || operand[0] == '/' ? operand : directory + "/" + operand;
+            creator.add(name, path);
+        }
+        bool ok = creator.run();
+        ok = writer.finish() && ok;
+        if (fd != STDOUT_FILENO) close(fd);
+        return ok ? 0 : 2;
+    }
+
+    int fd = archive == "-" ? STDIN_FILENO : open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "tar: " << archive << ": Cannot open: " << strerror(errno) << "\n";
+        return 2;
+    }
+    int status = read_archive(fd, mode == 'x', verbose, directory.empty() ? "." : directory, operands);
+    if (fd != STDIN_FILENO) close(fd);
+    return status;
+}
+
+std::string TarCommand::help() const {
+    return "Create, extract and list ustar/pax archives, compressing on every core (-c -x -t -v -z --zstd -f -C)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
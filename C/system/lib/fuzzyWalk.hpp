@@ -0,0 +1,171 @@
+#ifndef FUZZY_WALK_HPP
+#define FUZZY_WALK_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "fuzzylib.hpp"
+
+namespace FuzzyBox {
+
+// Call fn(name, d_type) for every entry of the open directory `fd`, read
+// in large getdents64 batches. . and .. are included; d_type may be
+// DT_UNKNOWN on filesystems that don't fill it in. Returns false on a read
+// error, with errno set.
+template <typename Fn>
+bool read_dirents(int fd, Fn&& fn) {
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+    static const size_t BUFFER_SIZE = 256 << 10;
+    thread_local std::unique_ptr<char[]> buffer;
+    if (!buffer) buffer.reset(new char[BUFFER_SIZE]);
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buffer.get(), BUFFER_SIZE)) > 0) {
+        for (long off = 0; off < n;) {
+            auto* d = reinterpret_cast<LinuxDirent64*>(buffer.get() + off);
+            off += d->d_reclen;
+            fn(static_cast<const char*>(d->d_name), d->d_type);
+        }
+    }
+    return n == 0;
+}
+
+inline bool is_dot_or_dotdot(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// A work-stealing pool for tree walks. Tasks push more tasks as they find
+// subdirectories; each worker takes its own newest task first (depth-first,
+// so paths stay hot in the dentry cache) and steals the oldest task of
+// another worker when it runs dry, which hands out whole subtrees.
+class WorkPool {
+public:
+    using Task = std::function<void()>;
+
+    // Tree walks mostly wait on the filesystem, so even one CPU profits
+    // from a few workers
+    static unsigned default_threads() {
+        return std::min(16u, std::max(4u, std::thread::hardware_concurrency()));
+    }
+
+    explicit WorkPool(unsigned threads = default_threads()) {
+        for (unsigned i = 0; i < std::max(1u, threads); i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+    }
+
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    // From inside a task, to the running worker's own queue
+    void push(Task task) {
+        pending.fetch_add(1);
+        Queue& q = *queues[worker_id() >= 0 ? worker_id() : 0];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            generation.fetch_add(1);
+        }
+        idle.notify_one();
+    }
+
+    // Work through every task, including the ones they push. The calling
+    // thread is worker 0.
+    void run() {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < queues.size(); i++) {
+            threads.emplace_back([this, i] { work(static_cast<int>(i)); });
+        }
+        work(0);
+        for (auto& thread : threads) thread.join();
+    }
+
+    size_t size() const { return queues.size(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<size_t> pending{0};
+    // Bumped under idle_mutex on every push, so a worker that found
+    // nothing can sleep until something new arrives
+    std::atomic<uint64_t> generation{0};
+    std::mutex idle_mutex;
+    std::condition_variable idle;
+
+    static int& worker_id() {
+        thread_local int id = -1;
+        return id;
+    }
+
+    bool take(int self, Task& task) {
+        Queue& own = *queues[self];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(int self) {
+        worker_id() = self;
+        Task task;
+        while (true) {
+            uint64_t seen = generation.load();
+            if (take(self, task)) {
+                // After an interrupt the rest of the work is just drained
+                if (!interrupted) task();
+                task = nullptr;
+                if (pending.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(idle_mutex);
+                    idle.notify_all();
+                }
+                continue;
+            }
+            if (pending.load() == 0) break;
+            // Sleep until a push after the failed take, or the end
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            idle.wait(lock, [&] { return generation.load() != seen || pending.load() == 0; });
+        }
+        worker_id() = -1;
+    }
+};
+
+} // namespace FuzzyBox
+
+#endif // FUZZY_WALK_HPP
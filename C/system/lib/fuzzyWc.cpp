@@ -0,0 +1,422 @@
+#include "fuzzylib.hpp"
+#include "fuzzyWalk.hpp"
+#include "fuzzyOutput.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WC_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define WC_NEON 1
+#endif
+
+namespace FuzzyBox {
+namespace Commands {
+
+namespace {
+
+const size_t BUFFER_SIZE = 256 << 10;
+
+struct Counts {
+    uint64_t lines = 0;
+    uint64_t words = 0;
+    uint64_t bytes = 0;
+};
+
+// Classes as GNU wc sees bytes in the C locale: whitespace ends a word,
+// a printable byte starts one, and anything else leaves the state alone
+inline bool is_space(unsigned char c) {
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+inline bool is_graph(unsigned char c) {
+    return static_cast<unsigned char>(c - '!') <= '~' - '!';
+}
+
+// The kernels below count newlines, and optionally words: printable
+// bytes whose last non-neutral predecessor was whitespace. `in_word`
+// carries across calls, so a word split between two buffers counts once.
+// A vector block made only of whitespace and printable bytes is counted
+// from its masks; one with other bytes in it goes through the scalar loop.
+using LineKernel = uint64_t (*)(const char*, size_t);
+using WordKernel = void (*)(const char*, size_t, Counts&, bool&);
+
+uint64_t lines_scalar(const char* p, size_t n) {
+    uint64_t lines = 0;
+    const char* end = p + n;
+    while ((p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr) {
+        lines++;
+        p++;
+    }
+    return lines;
+}
+
+void words_scalar(const char* p, size_t n, Counts& counts, bool& in_word) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+        if (is_space(c)) {
+            counts.lines += c == '\n';
+            in_word = false;
+        } else if (is_graph(c)) {
+            counts.words += !in_word;
+            in_word = true;
+        }
+    }
+}
+
+#ifdef WC_X86
+
+// Newline matches are summed per byte lane (each compare yields -1) and
+// folded into 64-bit totals with psadbw before a lane can overflow
+uint64_t lines_sse2(const char* p, size_t n) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        __m128i lanes = zero;
+        for (int rounds = 0; rounds < 255 && i + 16 <= n; rounds++, i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(v, newline));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(lanes, zero));
+    }
+    uint64_t lines = static_cast<uint64_t>(_mm_cvtsi128_si64(total)) +
+                     static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total)));
+    return lines + lines_scalar(p + i, n - i);
+}
+
+// Unsigned range tests without unsigned compares: (c - lo) <= span is
+// min(c - lo, span) == c - lo
+void words_sse2(const char* p, size_t n, Counts& counts, bool& in_word) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i bang = _mm_set1_epi8('!');
+    const __m128i graph_span = _mm_set1_epi8('~' - '!');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i t = _mm_sub_epi8(v, tab);
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(t, four), t), _mm_cmpeq_epi8(v, blank));
+        __m128i g = _mm_sub_epi8(v, bang);
+        __m128i graph = _mm_cmpeq_epi8(_mm_min_epu8(g, graph_span), g);
+        uint32_t word = static_cast<uint32_t>(_mm_movemask_epi8(graph));
+        if ((word | static_cast<uint32_t>(_mm_movemask_epi8(space))) != 0xFFFF) {
+            words_scalar(p + i, 16, counts, in_word);
+            continue;
+        }
+        uint32_t starts = word & ~((word << 1) | in_word);
+        counts.words += __builtin_popcount(starts);
+        counts.lines += __builtin_popcount(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline))));
+        in_word = word >> 15;
+    }
+    words_scalar(p + i, n - i, counts, in_word);
+}
+
+__attribute__((target("avx2"))) uint64_t lines_avx2(const char* p, size_t n) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+    while (i + 32 <= n) {
+        __m256i lanes = zero;
+        for (int rounds = 0; rounds < 255 && i + 32 <= n; rounds++, i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(v, newline));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(lanes, zero));
+    }
+    uint64_t lines = static_cast<uint64_t>(_mm256_extract_epi64(total, 0)) +
+                     static_cast<uint64_t>(_mm256_extract_epi64(total, 1)) +
+                     static_cast<uint64_t>(_mm256_extract_epi64(total, 2)) +
+                     static_cast<uint64_t>(_mm256_extract_epi64(total, 3));
+    return lines + lines_sse2(p + i, n - i);
+}
+
+__attribute__((target("avx2,popcnt"))) void words_avx2(const char* p, size_t n, Counts& counts, bool& in_word) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i blank = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    const __m256i bang = _mm256_set1_epi8('!');
+    const __m256i graph_span = _mm256_set1_epi8('~' - '!');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i t = _mm256_sub_epi8(v, tab);
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, four), t), _mm256_cmpeq_epi8(v, blank));
+        __m256i g = _mm256_sub_epi8(v, bang);
+        __m256i graph = _mm256_cmpeq_epi8(_mm256_min_epu8(g, graph_span), g);
+        uint64_t word = static_cast<uint32_t>(_mm256_movemask_epi8(graph));
+        if ((word | static_cast<uint32_t>(_mm256_movemask_epi8(space))) != 0xFFFFFFFFull) {
+            words_scalar(p + i, 32, counts, in_word);
+            continue;
+        }
+        uint64_t starts = word & ~((word << 1) | in_word);
+        counts.words += _mm_popcnt_u64(starts);
+        counts.lines += _mm_popcnt_u32(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline))));
+        in_word = word >> 31;
+    }
+    words_sse2(p + i, n - i, counts, in_word);
+}
+
+#endif // WC_X86
+
+#ifdef WC_NEON
+
+uint64_t lines_neon(const char* p, size_t n) {
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    uint64_t lines = 0;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        uint8x16_t lanes = vdupq_n_u8(0);
+        for (int rounds = 0; rounds < 255 && i + 16 <= n; rounds++, i += 16) {
+            uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+            lanes = vsubq_u8(lanes, vceqq_u8(v, newline));
+        }
+        lines += vaddlvq_u8(lanes);
+    }
+    return lines + lines_scalar(p + i, n - i);
+}
+
+// NEON has no movemask; narrowing each 16-bit pair by 4 bits leaves a
+// 64-bit mask with one nibble per byte
+void words_neon(const char* p, size_t n, Counts& counts, bool& in_word) {
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    const uint8x16_t blank = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t four = vdupq_n_u8(4);
+    const uint8x16_t bang = vdupq_n_u8('!');
+    const uint8x16_t graph_span = vdupq_n_u8('~' - '!');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+        uint8x16_t space = vorrq_u8(vcleq_u8(vsubq_u8(v, tab), four), vceqq_u8(v, blank));
+        uint8x16_t graph = vcleq_u8(vsubq_u8(v, bang), graph_span);
+        if (vminvq_u8(vorrq_u8(space, graph)) != 0xFF) {
+            words_scalar(p + i, 16, counts, in_word);
+            continue;
+        }
+        uint64_t word = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(graph), 4)), 0);
+        uint64_t starts = word & ~((word << 4) | (in_word ? 0xF : 0));
+        counts.words += __builtin_popcountll(starts) / 4;
+        counts.lines += vaddvq_u8(vandq_u8(vceqq_u8(v, newline), vdupq_n_u8(1)));
+        in_word = word >> 60;
+    }
+    words_scalar(p + i, n - i, counts, in_word);
+}
+
+#endif // WC_NEON
+
+struct Kernels {
+    LineKernel lines;
+    WordKernel words;
+};
+
+// Picked once, for the CPU we are running on
+const Kernels& kernels() {
+    static const Kernels chosen = [] {
+#if defined(WC_X86)
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) return Kernels{lines_avx2, words_avx2};
+        return Kernels{lines_sse2, words_sse2};
+#elif defined(WC_NEON)
+        return Kernels{lines_neon, words_neon};
+#else
+        return Kernels{lines_scalar, words_scalar};
+#endif
+    }();
+    return chosen;
+}
+
+struct WcOptions {
+    bool lines = false;
+    bool words = false;
+    bool bytes = false;
+};
+
+struct FileResult {
+    Counts counts;
+    int error = 0;
+    bool regular = false;
+};
+
+// Count one input. A regular file needing only its byte count is never
+// read: the size comes from fstat, less whatever was already consumed.
+// Files reporting a size of 0 (/proc, /sys) are read like any other.
+FileResult count_file(const std::string& name, const WcOptions& opts) {
+    FileResult result;
+    bool use_stdin = name == "-";
+    int fd = use_stdin ? STDIN_FILENO : open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        result.error = errno;
+        return result;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        result.error = errno;
+        if (!use_stdin) close(fd);
+        return result;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        if (!use_stdin) close(fd);
+        result.error = EISDIR;
+        return result;
+    }
+    result.regular = S_ISREG(st.st_mode);
+    if (result.regular && st.st_size > 0 && !opts.lines && !opts.words) {
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        result.counts.bytes = st.st_size > pos && pos >= 0 ? st.st_size - pos : 0;
+        if (!use_stdin) close(fd);
+        return result;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    void* raw = nullptr;
+    if (posix_memalign(&raw, 4096, BUFFER_SIZE) != 0) {
+        if (!use_stdin) close(fd);
+        result.error = ENOMEM;
+        return result;
+    }
+    std::unique_ptr<char, decltype(&free)> buffer(static_cast<char*>(raw), free);
+    const Kernels& k = kernels();
+    bool in_word = false;
+    for (;;) {
+        if (interrupted) {
+            result.error = EINTR;
+            break;
+        }
+        ssize_t n = read(fd, buffer.get(), BUFFER_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            result.error = errno;
+            break;
+        }
+        if (n == 0) break;
+        result.counts.bytes += n;
+        if (opts.words) {
+            k.words(buffer.get(), n, result.counts, in_word);
+        } else if (opts.lines) {
+            result.counts.lines += k.lines(buffer.get(), n);
+        }
+    }
+    if (!use_stdin) close(fd);
+    return result;
+}
+
+int digits(uint64_t n) {
+    int d = 1;
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+} // namespace
+
+int WcCommand::execute(const std::vector<std::string>& args) {
+    WcOptions opts;
+    std::vector<std::string> files;
+    bool options = true;
+    for (const auto& arg : args) {
+        if (options && arg == "--") {
+            options = false;
+        } else if (options && arg.size() > 1 && arg[0] == '-') {
+            for (size_t i = 1; i < arg.size(); i++) {
+                switch (arg[i]) {
+                    case 'l': opts.lines = true; break;
+                    case 'w': opts.words = true; break;
+                    case 'c': opts.bytes = true; break;
+                    default:
+                        std::cerr << "wc: invalid option -- '" << arg[i] << "'\n"
+                                  << "Usage: wc [-clw] [file...]\n";
+                        return 1;
+                }
+            }
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (!opts.lines && !opts.words && !opts.bytes) opts.lines = opts.words = opts.bytes = true;
+    bool named = !files.empty();
+    if (!named) files.push_back("-");
+
+    // Every file is counted on its own worker; results print in order
+    std::vector<FileResult> results(files.size());
+    if (files.size() == 1) {
+        results[0] = count_file(files[0], opts);
+    } else {
+        WorkPool pool(std::min<unsigned>(files.size(), WorkPool::default_threads()));
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.push([&, i] { results[i] = count_file(files[i], opts); });
+        }
+        pool.run();
+    }
+
+    // Column width as GNU wc sizes it: wide enough for the total bytes
+    // of the regular files, at least 7 when any input is not one, and
+    // unpadded for a single count of a single input
+    Counts total;
+    uint64_t sizes = 0;
+    bool irregular = false;
+    for (size_t i = 0; i < files.size(); i++) {
+        total.lines += results[i].counts.lines;
+        total.words += results[i].counts.words;
+        total.bytes += results[i].counts.bytes;
+        if (results[i].regular) sizes += results[i].counts.bytes;
+        else irregular = true;
+    }
+    int columns = opts.lines + opts.words + opts.bytes;
+    int width = columns == 1 && files.size() == 1 ? 1 : std::max(digits(sizes), irregular ? 7 : 1);
+
+    Output out;
+    auto print = [&](const Counts& c, const std::string& name) {
+        std::string row;
+        auto column = [&](uint64_t value) {
+            std::string text = std::to_string(value);
+            if (!row.empty()) row += ' ';
+            if (static_cast<int>(text.size()) < width) row.append(width - text.size(), ' ');
+            row += text;
+        };
+        if (opts.lines) column(c.lines);
+        if (opts.words) column(c.words);
+        if (opts.bytes) column(c.bytes);
+        if (!name.empty()) {
+            row += ' ';
+            row += name;
+        }
+        out.line(row);
+    };
+
+    int status = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (results[i].error) {
+            out.flush();
+            std::cerr << "wc: " << files[i] << ": " << strerror(results[i].error) << "\n";
+            status = 1;
+            if (results[i].error != EISDIR) continue;
+        }
+        print(results[i].counts, named ? files[i] : "");
+    }
+    if (files.size() > 1) print(total, "total");
+    out.flush();
+    return status;
+}
+
+std::string WcCommand::help() const {
+    return "Count lines, words and bytes (-l -w -c)";
+}
+
+} // namespace Commands
+} // namespace FuzzyBox
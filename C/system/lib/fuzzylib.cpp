@@ -1,9 +1,17 @@
 #include "fuzzylib.hpp"
+#include "fuzzyOutput.hpp"
 #include <iostream>
 #include <sstream>
 #include <filesystem>
 #include <fstream>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 namespace fs = std::filesystem;
 
@@ -34,16 +42,27 @@ int FuzzyShell::executeCommand(const std::string& name, const std::vector<std::s
     return it->second->execute(args);
 }
 
+std::vector<std::string> FuzzyShell::commandNames() const {
+    std::vector<std::string> names;
+    for (const auto& cmd : commands) {
+        names.push_back(cmd.first);
+    }
+    return names;
+}
+
 void FuzzyShell::displayHelp(const std::string& command) {
+    Output out;
     if (command.empty()) {
-        std::cout << "Available commands:\n";
+        out.line("Available commands:");
         for (const auto& cmd : commands) {
-            std::cout << "  " << cmd.first << " - " << cmd.second->help() << "\n";
+            out.write_parts({"  ", cmd.first, " - ", cmd.second->help()});
+            out.newline();
         }
     } else {
         auto it = commands.find(command);
         if (it != commands.end()) {
-            std::cout << command << " - " << it->second->help() << "\n";
+            out.write_parts({command, " - ", it->second->help()});
+            out.newline();
         } else {
             std::cerr << "No help available for: " << command << "\n";
         }
@@ -77,67 +96,156 @@ void FuzzyShell::run() {
 
 namespace Commands {
 
-int CatCommand::execute(const std::vector<std::string>& args) {
-    if (args.empty()) {
-        std::cerr << "Usage: cat <file>" << std::endl;
-        return 1;
-    }
-    
-    std::ifstream file(args[0]);
-    if (!file) {
-        std::cerr << "Cannot open file: " << args[0] << std::endl;
-        return 1;
-    }
-    
-    std::string line;
-    while (std::getline(file, line)) {
-        std::cout << line << std::endl;
-    }
-    
-    return 0;
-}
+namespace {
 
-std::string CatCommand::help() const {
-    return "Display file contents";
+// How cat moves bytes from one input to its stdout. The kernel-side copies
+// never bring the data into user space; the buffer loop is the fallback
+// for everything they refuse.
+enum class CopyMethod { CopyRange, Splice, Sendfile, Buffer };
+
+const size_t COPY_CHUNK = 1 << 20;
+const size_t BUFFER_SIZE = 128 << 10;
+
+CopyMethod choose_copy(const struct stat& in, const struct stat& out) {
+    if (S_ISFIFO(out.st_mode) || S_ISFIFO(in.st_mode)) return CopyMethod::Splice;
+    if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode)) return CopyMethod::CopyRange;
+    if (S_ISREG(in.st_mode) && S_ISSOCK(out.st_mode)) return CopyMethod::Sendfile;
+    return CopyMethod::Buffer;
 }
 
-int LsCommand::execute(const std::vector<std::string>& args) {
-    std::string path = args.empty() ? "." : args[0];
-    
-    try {
-        for (const auto& entry : fs::directory_iterator(path)) {
-            std::cout << entry.path().filename().string() << std::endl;
+// Move everything from `in` to `out` without a user-space copy. Returns 1
+// at end of input, 0 if this pair of fds needs the buffer loop (the file
+// offsets have advanced past whatever was already copied), or -1 with
+// errno set.
+int kernel_copy(int in, int out, CopyMethod method) {
+    while (true) {
+        if (interrupted) return 1;
+        ssize_t n;
+        switch (method) {
+            case CopyMethod::CopyRange:
+                n = copy_file_range(in, nullptr, out, nullptr, COPY_CHUNK, 0);
+                break;
+            case CopyMethod::Splice:
+                n = splice(in, nullptr, out, nullptr, COPY_CHUNK, SPLICE_F_MORE);
+                break;
+            default:
+                n = sendfile(out, in, nullptr, COPY_CHUNK);
+                break;
         }
-    } catch (const fs::filesystem_error& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-        return 1;
+        if (n > 0) continue;
+        if (n == 0) return 1;
+        if (errno == EINTR) continue;
+        // Unsupported for these fds: other filesystems, O_APPEND output,
+        // ttys, old kernels
+        if (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP ||
+            errno == EBADF) {
+            return 0;
+        }
+        return -1;
     }
-    
-    return 0;
 }
 
-std::string LsCommand::help() const {
-    return "List directory contents";
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
 }
 
-int CpCommand::execute(const std::vector<std::string>& args) {
-    if (args.size() != 2) {
-        std::cerr << "Usage: cp <source> <destination>" << std::endl;
-        return 1;
+} // namespace
+
+int CatCommand::execute(const std::vector<std::string>& args) {
+    std::vector<std::string> files;
+    bool options = true;
+    for (const auto& arg : args) {
+        if (options && arg == "--") {
+            options = false;
+        } else {
+            files.push_back(arg);
+        }
     }
+    if (files.empty()) files.push_back("-");
     
-    try {
-        fs::copy(args[0], args[1], fs::copy_options::overwrite_existing);
-    } catch (const fs::filesystem_error& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+    // Anything already buffered for stdout goes first
+    std::cout.flush();
+    struct stat out_st;
+    if (fstat(STDOUT_FILENO, &out_st) != 0) {
+        std::cerr << "cat: standard output: " << strerror(errno) << "\n";
         return 1;
     }
     
-    return 0;
+    std::unique_ptr<char, decltype(&free)> buffer(nullptr, free);
+    int status = 0;
+    for (const auto& name : files) {
+        bool use_stdin = name == "-";
+        const char* label = use_stdin ? "standard input" : name.c_str();
+        int in = use_stdin ? STDIN_FILENO : open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat in_st;
+        if (in < 0 || fstat(in, &in_st) != 0) {
+            std::cerr << "cat: " << label << ": " << strerror(errno) << "\n";
+            if (in >= 0 && !use_stdin) close(in);
+            status = 1;
+            continue;
+        }
+        if (S_ISDIR(in_st.st_mode)) {
+            std::cerr << "cat: " << label << ": Is a directory\n";
+            if (!use_stdin) close(in);
+            status = 1;
+            continue;
+        }
+        // Copying a file onto its own end would never finish
+        if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode) && in_st.st_size > 0 &&
+            in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+            std::cerr << "cat: " << label << ": input file is output file\n";
+            if (!use_stdin) close(in);
+            status = 1;
+            continue;
+        }
+        if (S_ISREG(in_st.st_mode)) posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+        
+        CopyMethod method = choose_copy(in_st, out_st);
+        int done = method == CopyMethod::Buffer ? 0 : kernel_copy(in, STDOUT_FILENO, method);
+        if (done == 0) {
+            if (!buffer) buffer.reset(static_cast<char*>(aligned_alloc(4096, BUFFER_SIZE)));
+            ssize_t n;
+            while ((n = read(in, buffer.get(), BUFFER_SIZE)) != 0) {
+                if (interrupted) {
+                    n = 0;
+                    break;
+                }
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                if (!write_all(STDOUT_FILENO, buffer.get(), n)) {
+                    n = -1;
+                    break;
+                }
+            }
+            done = n == 0 ? 1 : -1;
+        }
+        // The reader went away; nothing more can be written
+        if (done < 0 && errno == EPIPE) {
+            if (!use_stdin) close(in);
+            return 1;
+        }
+        if (done < 0) {
+            std::cerr << "cat: " << label << ": " << strerror(errno) << "\n";
+            status = 1;
+        }
+        if (!use_stdin) close(in);
+    }
+    return status;
 }
 
-std::string CpCommand::help() const {
-    return "Copy files";
+std::string CatCommand::help() const {
+    return "Concatenate files (or stdin) to standard output";
 }
 
 int MvCommand::execute(const std::vector<std::string>& args) {
@@ -160,26 +268,6 @@ std::string MvCommand::help() const {
     return "Move/rename files";
 }
 
-int RmCommand::execute(const std::vector<std::string>& args) {
-    if (args.empty()) {
-        std::cerr << "Usage: rm <file>" << std::endl;
-        return 1;
-    }
-    
-    try {
-        fs::remove(args[0]);
-    } catch (const fs::filesystem_error& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-        return 1;
-    }
-    
-    return 0;
-}
-
-std::string RmCommand::help() const {
-    return "Remove files";
-}
-
 int MkdirCommand::execute(const std::vector<std::string>& args) {
     if (args.empty()) {
         std::cerr << "Usage: mkdir <directory>" << std::endl;
@@ -204,7 +292,9 @@ int PwdCommand::execute(const std::vector<std::string>& args) {
     (void)args; // Unused
     char cwd[PATH_MAX];
     if (getcwd(cwd, sizeof(cwd)) != nullptr) {
-        std::cout << cwd << std::endl;
+        Output out;
+        out.line(cwd);
+        return out.flush() ? 0 : 1;
     } else {
         std::cerr << "Error getting current directory" << std::endl;
         return 1;
@@ -232,12 +322,13 @@ std::string CdCommand::help() const {
 }
 
 int EchoCommand::execute(const std::vector<std::string>& args) {
+    Output out;
     for (size_t i = 0; i < args.size(); ++i) {
-        std::cout << args[i];
-        if (i < args.size() - 1) std::cout << " ";
+        out.write(args[i]);
+        if (i < args.size() - 1) out.put(' ');
     }
-    std::cout << std::endl;
-    return 0;
+    out.newline();
+    return out.flush() ? 0 : 1;
 }
 
 std::string EchoCommand::help() const {
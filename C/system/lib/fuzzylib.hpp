@@ -6,9 +6,15 @@
 #include <functional>
 #include <memory>
 #include <map>
+#include <atomic>
 
 namespace FuzzyBox {
 
+// Set when the user interrupts a command running inside the shell's own
+// process, where ^C cannot simply kill it. Long-running loops check it and
+// wind down early; the shell then reports the command as interrupted.
+inline std::atomic<bool> interrupted{false};
+
 class Command {
 public:
     virtual ~Command() = default;
@@ -31,6 +37,8 @@ public:
     
     // Command execution helpers
     int executeCommand(const std::string& name, const std::vector<std::string>& args);
+    bool hasCommand(const std::string& name) const { return commands.count(name) != 0; }
+    std::vector<std::string> commandNames() const;
     std::vector<std::string> parseCommand(const std::string& cmdline);
     void displayHelp(const std::string& command = "");
 };
@@ -91,6 +99,48 @@ public:
     std::string help() const override;
 };
 
+class FindCommand : public Command {
+public:
+    int execute(const std::vector<std::string>& args) override;
+    std::string help() const override;
+};
+
+class GrepCommand : public Command {
+public:
+    int execute(const std::vector<std::string>& args) override;
+    std::string help() const override;
+};
+
+class DuCommand : public Command {
+public:
+    int execute(const std::vector<std::string>& args) override;
+    std::string help() const override;
+};
+
+class SortCommand : public Command {
+public:
+    int execute(const std::vector<std::string>& args) override;
+    std::string help() const override;
+};
+
+class WcCommand : public Command {
+public:
+    int execute(const std::vector<std::string>& args) override;
+    std::string help() const override;
+};
+
+class Sha256SumCommand : public Command {
+public:
+    int execute(const std::vector<std::string>& args) override;
+    std::string help() const override;
+};
+
+class TarCommand : public Command {
+public:
+    int execute(const std::vector<std::string>& args) override;
+    std::string help() const override;
+};
+
 } // namespace Commands
 
 } // namespace FuzzyBox
@@ -0,0 +1,447 @@
+#ifndef GLOB_ENGINE_HPP
+#define GLOB_ENGINE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "commandInterpreter.hpp"
+
+namespace Ash {
+
+// Brace expansion: a{b,c}d -> abd acd, {1..5}, {a..e}, {01..10..3}.
+// Runs on the raw word, so quoted braces and ${...} are left alone. The
+// expansion is capped at MAX_BRACE_WORDS words.
+class BraceExpander {
+private:
+    static const size_t MAX_BRACE_WORDS = 65536;
+
+    // Index of the character after a quoted or substituted part starting
+    // at word[i], or i + 1 for anything else
+    static size_t skip(std::string_view word, size_t i) {
+        char c = word[i];
+        size_t next = i + 1;
+        if (c == '\\') {
+            next = i + 2;
+        } else if (c == '\'') {
+            next = word.find('\'', i + 1);
+            if (next != std::string_view::npos) next++;
+        } else if (c == '"') {
+            next = scan_double_quote(word, i);
+        } else if (c == '`') {
+            next = scan_backquote(word, i);
+        } else if (c == '$' && i + 1 < word.size() && word[i + 1] == '(') {
+            next = scan_substitution(word, i);
+        } else if (c == '$' && i + 1 < word.size() && word[i + 1] == '{') {
+            next = word.find('}', i);
+            if (next != std::string_view::npos) next++;
+        }
+        return std::min(next, word.size());
+    }
+
+    static bool parse_int(std::string_view s, long& value) {
+        if (s.empty() || s.size() > 18) return false;
+        size_t i = s[0] == '-' || s[0] == '+' ? 1 : 0;
+        if (i == s.size()) return false;
+        value = 0;
+        for (size_t j = i; j < s.size(); j++) {
+            if (s[j] < '0' || s[j] > '9') return false;
+            value = value * 10 + (s[j] - '0');
+        }
+        if (s[0] == '-') value = -value;
+        return true;
+    }
+
+    // {x..y} and {x..y..step} over integers or single characters
+    static bool sequence(std::string_view body, std::vector<std::string>& items) {
+        size_t dots = body.find("..");
+        if (dots == std::string_view::npos) return false;
+        std::string_view from = body.substr(0, dots);
+        std::string_view rest = body.substr(dots + 2);
+        long step = 1;
+        size_t dots2 = rest.find("..");
+        std::string_view to = rest.substr(0, dots2);
+        if (dots2 != std::string_view::npos && (!parse_int(rest.substr(dots2 + 2), step) || step == 0)) {
+            return false;
+        }
+        step = step < 0 ? -step : step;
+
+        long a, b;
+        bool numeric = parse_int(from, a) && parse_int(to, b);
+        if (!numeric) {
+            if (from.size() != 1 || to.size() != 1) return false;
+            a = static_cast<unsigned char>(from[0]);
+            b = static_cast<unsigned char>(to[0]);
+        }
+        size_t width = 0;
+        if (numeric) {
+            auto padded = [](std::string_view s) {
+                size_t digits = s[0] == '-' || s[0] == '+' ? 1 : 0;
+                return s.size() > digits + 1 && s[digits] == '0';
+            };
+            if (padded(from) || padded(to)) width = std::max(from.size(), to.size());
+        }
+
+        long dir = a <= b ? 1 : -1;
+        for (long v = a; dir > 0 ? v <= b : v >= b; v += dir * step) {
+            if (items.size() >= MAX_BRACE_WORDS) break;
+            if (numeric) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%0*ld", static_cast<int>(width), v);
+                items.emplace_back(buf);
+            } else {
+                items.emplace_back(1, static_cast<char>(v));
+            }
+        }
+        return true;
+    }
+
+    static void expand(const std::string& word, std::vector<std::string>& out) {
+        for (size_t i = 0; i < word.size(); i = skip(word, i)) {
+            if (word[i] != '{') continue;
+
+            // Find the matching '}' and the top-level commas
+            std::vector<size_t> commas;
+            int depth = 0;
+            size_t close = std::string::npos;
+            for (size_t j = i; j < word.size(); j = skip(word, j)) {
+                if (word[j] == '{') {
+                    depth++;
+                } else if (word[j] == '}' && --depth == 0) {
+                    close = j;
+                    break;
+                } else if (word[j] == ',' && depth == 1) {
+                    commas.push_back(j);
+                }
+            }
+            if (close == std::string::npos) return out.push_back(word);
+
+            std::vector<std::string> items;
+            if (commas.empty()) {
+                if (!sequence(std::string_view(word).substr(i + 1, close - i - 1), items)) continue;
+            } else {
+                size_t start = i + 1;
+                commas.push_back(close);
+                for (size_t comma : commas) {
+                    items.push_back(word.substr(start, comma - start));
+                    start = comma + 1;
+                }
+            }
+
+            std::string prefix = word.substr(0, i);
+            std::string suffix = word.substr(close + 1);
+            for (const auto& item : items) {
+                if (out.size() >= MAX_BRACE_WORDS) return;
+                expand(prefix + item + suffix, out);
+            }
+            return;
+        }
+        out.push_back(word);
+    }
+
+public:
+    // Cheap pre-check so most words skip the copy
+    static bool has_braces(std::string_view word) {
+        return word.find('{') != std::string_view::npos;
+    }
+
+    static void expand(std::string_view word, std::vector<std::string>& out) {
+        expand(std::string(word), out);
+    }
+};
+
+// fnmatch() for one path component: *, ?, [...] (with ! or ^ negation and
+// ranges) and backslash escapes. A leading '.' only matches a literal '.'.
+inline bool glob_match(std::string_view pat, std::string_view name) {
+    if (!name.empty() && name[0] == '.' && (pat.empty() || pat[0] != '.')) return false;
+
+    size_t p = 0, n = 0;
+    size_t star_p = std::string_view::npos, star_n = 0;
+    while (n < name.size()) {
+        if (p < pat.size()) {
+            char c = pat[p];
+            if (c == '*') {
+                star_p = ++p;
+                star_n = n;
+                continue;
+            }
+            if (c == '?') {
+                p++;
+                n++;
+                continue;
+            }
+            if (c == '[') {
+                size_t q = p + 1;
+                bool negate = q < pat.size() && (pat[q] == '!' || pat[q] == '^');
+                if (negate) q++;
+                bool matched = false;
+                bool closed = false;
+                unsigned char ch = static_cast<unsigned char>(name[n]);
+                for (bool first = true; q < pat.size(); first = false) {
+                    if (pat[q] == ']' && !first) {
+                        closed = true;
+                        break;
+                    }
+                    if (pat[q] == '\\' && q + 1 < pat.size()) q++;
+                    unsigned char lo = static_cast<unsigned char>(pat[q++]);
+                    unsigned char hi = lo;
+                    if (q + 1 < pat.size() && pat[q] == '-' && pat[q + 1] != ']') {
+                        q++;
+                        if (pat[q] == '\\' && q + 1 < pat.size()) q++;
+                        hi = static_cast<unsigned char>(pat[q++]);
+                    }
+                    if (ch >= lo && ch <= hi) matched = true;
+                }
+                if (closed) {
+                    if (matched != negate) {
+                        p = q + 1;
+                        n++;
+                        continue;
+                    }
+                } else if (name[n] == '[') {
+                    // No closing ']': a literal '['
+                    p++;
+                    n++;
+                    continue;
+                }
+            } else {
+                if (c == '\\' && p + 1 < pat.size()) c = pat[++p];
+                if (c == name[n]) {
+                    p++;
+                    n++;
+                    continue;
+                }
+            }
+        }
+        if (star_p == std::string_view::npos) return false;
+        p = star_p;
+        n = ++star_n;
+    }
+    while (p < pat.size() && pat[p] == '*') p++;
+    return p == pat.size();
+}
+
+// Pathname expansion. Directories are read with getdents64 and their
+// listings cached until clear(), which the shell calls after expanding
+// each pipeline, so patterns that revisit a directory (several globs in
+// one command line, or **) read it once. The cache keeps at most
+// MAX_CACHED_BYTES of names; larger directories are streamed and only
+// their matches kept.
+class GlobEngine {
+private:
+    static const size_t MAX_CACHED_BYTES = 8 << 20;
+    static const size_t BUFFER_SIZE = 64 << 10;
+
+    struct Entry {
+        uint32_t offset;
+        uint32_t length;
+        unsigned char type;
+    };
+
+    // Names packed into one buffer instead of one allocation per entry
+    struct Listing {
+        std::string names;
+        std::vector<Entry> entries;
+
+        size_t bytes() const { return names.size() + entries.size() * sizeof(Entry); }
+    };
+
+    struct Match {
+        std::string name;
+        unsigned char type;
+    };
+
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    std::unordered_map<std::string, Listing> cache;
+    size_t cached_bytes = 0;
+    std::unique_ptr<char[]> buffer;
+
+    std::vector<std::string_view> segments;
+    bool trailing_slash = false;
+
+    static bool has_meta(std::string_view s) {
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] == '\\') {
+                i++;
+            } else if (s[i] == '*' || s[i] == '?') {
+                return true;
+            } else if (s[i] == '[' && s.find(']', i + 2) != std::string_view::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static std::string unescape(std::string_view s) {
+        std::string out;
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] == '\\' && i + 1 < s.size()) i++;
+            out += s[i];
+        }
+        return out;
+    }
+
+    static bool is_dir(const std::string& path, unsigned char type, bool follow) {
+        if (type == DT_DIR) return true;
+        if (type != DT_UNKNOWN && !(type == DT_LNK && follow)) return false;
+        struct stat st;
+        int rc = follow ? stat(path.c_str(), &st) : lstat(path.c_str(), &st);
+        return rc == 0 && S_ISDIR(st.st_mode);
+    }
+
+    static bool exists(const std::string& path) {
+        struct stat st;
+        return lstat(path.c_str(), &st) == 0;
+    }
+
+    // Entries of `dir` ("" for the current directory) for which
+    // keep(name) holds, skipping . and ..
+    template <typename Keep>
+    std::vector<Match> list(const std::string& dir, Keep&& keep) {
+        std::vector<Match> out;
+        auto it = cache.find(dir);
+        if (it != cache.end()) {
+            const Listing& listing = it->second;
+            for (const Entry& e : listing.entries) {
+                std::string_view name(listing.names.data() + e.offset, e.length);
+                if (keep(name)) out.push_back({std::string(name), e.type});
+            }
+            return out;
+        }
+
+        int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return out;
+        if (!buffer) buffer.reset(new char[BUFFER_SIZE]);
+
+        Listing listing;
+        bool caching = true;
+        long n;
+        while ((n = syscall(SYS_getdents64, fd, buffer.get(), BUFFER_SIZE)) > 0) {
+            for (long off = 0; off < n;) {
+                auto* d = reinterpret_cast<LinuxDirent64*>(buffer.get() + off);
+                off += d->d_reclen;
+                std::string_view name(d->d_name);
+                if (name == "." || name == "..") continue;
+                if (keep(name)) out.push_back({std::string(name), d->d_type});
+                if (!caching) continue;
+
+                listing.entries.push_back({static_cast<uint32_t>(listing.names.size()),
+                                           static_cast<uint32_t>(name.size()), d->d_type});
+                listing.names.append(name);
+                if (cached_bytes + listing.bytes() > MAX_CACHED_BYTES) {
+                    caching = false;
+                    listing = Listing();
+                }
+            }
+        }
+        close(fd);
+
+        if (caching) {
+            cached_bytes += listing.bytes();
+            cache.emplace(dir, std::move(listing));
+        }
+        return out;
+    }
+
+    // A candidate `path` matched segment `i`
+    void matched(const std::string& path, unsigned char type, size_t i, std::vector<std::string>& out) {
+        if (i + 1 == segments.size()) {
+            if (!trailing_slash) {
+                out.push_back(path);
+            } else if (is_dir(path, type, true)) {
+                out.push_back(path + "/");
+            }
+        } else if (is_dir(path, type, true)) {
+            walk(path + "/", i + 1, out);
+        }
+    }
+
+    // Match segments[i..] below `base`, which is "" or ends in '/'
+    void walk(const std::string& base, size_t i, std::vector<std::string>& out) {
+        std::string_view seg = segments[i];
+        bool last = i + 1 == segments.size();
+
+        if (seg == "**") {
+            // Zero or more directories; symlinks are not followed
+            if (!last) walk(base, i + 1, out);
+            auto entries = list(base, [](std::string_view name) { return name[0] != '.'; });
+            for (const auto& e : entries) {
+                std::string path = base + e.name;
+                bool dir = is_dir(path, e.type, false);
+                if (last && (!trailing_slash || dir)) out.push_back(trailing_slash ? path + "/" : path);
+                if (dir) walk(path + "/", i, out);
+            }
+            return;
+        }
+
+        if (!has_meta(seg)) {
+            std::string path = base + unescape(seg);
+            if (!last) {
+                walk(path + "/", i + 1, out);
+            } else if (exists(path)) {
+                matched(path, DT_UNKNOWN, i, out);
+            }
+            return;
+        }
+
+        auto entries = list(base, [seg](std::string_view name) { return glob_match(seg, name); });
+        for (const auto& e : entries) {
+            matched(base + e.name, e.type, i, out);
+        }
+    }
+
+public:
+    // Does `pattern` (quoted characters backslash-escaped) need expanding?
+    static bool is_pattern(std::string_view pattern) { return has_meta(pattern); }
+
+    // Append the paths matching `pattern`, sorted bytewise. Returns false,
+    // appending nothing, if none match.
+    bool expand(std::string_view pattern, std::vector<std::string>& out) {
+        segments.clear();
+        trailing_slash = !pattern.empty() && pattern.back() == '/';
+        std::string base = !pattern.empty() && pattern[0] == '/' ? "/" : "";
+
+        size_t start = 0;
+        while (start < pattern.size()) {
+            size_t slash = pattern.find('/', start);
+            if (slash == std::string_view::npos) slash = pattern.size();
+            if (slash > start) segments.push_back(pattern.substr(start, slash - start));
+            start = slash + 1;
+        }
+        if (segments.empty()) return false;
+
+        std::vector<std::string> found;
+        walk(base, 0, found);
+        if (found.empty()) return false;
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+        for (auto& path : found) out.push_back(std::move(path));
+        return true;
+    }
+
+    void clear() {
+        cache.clear();
+        cached_bytes = 0;
+    }
+};
+
+} // namespace Ash
+
+#endif // GLOB_ENGINE_HPP
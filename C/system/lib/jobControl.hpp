@@ -0,0 +1,259 @@
+#ifndef JOB_CONTROL_HPP
+#define JOB_CONTROL_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+namespace Ash {
+
+// One process of a job. Stages that never started (command not found,
+// failed redirection) are recorded with pid -1 and their status preset.
+// `usage` and `ended` are filled in when the process is reaped.
+struct JobProcess {
+    pid_t pid;
+    int status;
+    bool exited;
+    bool stopped;
+    struct rusage usage{};
+    std::chrono::steady_clock::time_point ended{};
+};
+
+struct Job {
+    enum class State { Running, Stopped, Done };
+
+    int id;
+    pid_t pgid;
+    std::vector<JobProcess> procs;
+    std::string command;
+    bool background;
+    bool notified = false;
+    bool has_tmodes = false;
+    struct termios tmodes;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point ended;
+
+    State state() const {
+        bool any_stopped = false;
+        for (const auto& p : procs) {
+            if (!p.exited && !p.stopped) return State::Running;
+            any_stopped = any_stopped || (!p.exited && p.stopped);
+        }
+        return any_stopped ? State::Stopped : State::Done;
+    }
+
+    // $? of the job: the status of its last stage
+    int status() const { return procs.empty() ? 0 : procs.back().status; }
+
+    pid_t last_pid() const {
+        for (auto it = procs.rbegin(); it != procs.rend(); ++it) {
+            if (it->pid > 0) return it->pid;
+        }
+        return -1;
+    }
+
+    double elapsed() const {
+        auto end = state() == State::Done ? ended : std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - started).count();
+    }
+};
+
+// Decode a wait status the way POSIX shells report it in $?
+inline int wait_status_code(int wstatus) {
+    if (WIFEXITED(wstatus)) return WEXITSTATUS(wstatus);
+    if (WIFSIGNALED(wstatus)) return 128 + WTERMSIG(wstatus);
+    if (WIFSTOPPED(wstatus)) return 128 + WSTOPSIG(wstatus);
+    return 1;
+}
+
+class JobTable {
+private:
+    std::vector<std::unique_ptr<Job>> jobs;
+
+    // How many finished jobs a non-interactive shell keeps for `wait`
+    static const size_t MAX_DONE = 256;
+
+    static const char* state_name(const Job& job, char* buf, size_t size) {
+        switch (job.state()) {
+            case Job::State::Running: return "Running";
+            case Job::State::Stopped: return "Stopped";
+            case Job::State::Done: break;
+        }
+        if (job.status() == 0) return "Done";
+        snprintf(buf, size, "Exit %d", job.status());
+        return buf;
+    }
+
+public:
+    Job& add(pid_t pgid, std::vector<JobProcess> procs, const std::string& command, bool background) {
+        int id = 1;
+        for (const auto& job : jobs) {
+            if (job->id >= id) id = job->id + 1;
+        }
+        auto job = std::make_unique<Job>();
+        job->id = id;
+        job->pgid = pgid;
+        job->procs = std::move(procs);
+        job->command = command;
+        job->background = background;
+        job->started = std::chrono::steady_clock::now();
+        jobs.push_back(std::move(job));
+        return *jobs.back();
+    }
+
+    void remove(const Job& job) {
+        for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+            if (it->get() == &job) {
+                jobs.erase(it);
+                return;
+            }
+        }
+    }
+
+    void clear() { jobs.clear(); }
+    bool empty() const { return jobs.empty(); }
+
+    // Record a wait4() result. Returns false if no job owns `pid`.
+    bool update(pid_t pid, int wstatus, const struct rusage& usage) {
+        for (auto& job : jobs) {
+            for (auto& p : job->procs) {
+                if (p.pid != pid) continue;
+                if (WIFSTOPPED(wstatus)) {
+                    p.stopped = true;
+                    p.status = wait_status_code(wstatus);
+                    job->notified = false;
+                } else if (WIFCONTINUED(wstatus)) {
+                    p.stopped = false;
+                } else {
+                    p.exited = true;
+                    p.status = wait_status_code(wstatus);
+                    p.usage = usage;
+                    p.ended = std::chrono::steady_clock::now();
+                    if (job->state() == Job::State::Done) job->ended = p.ended;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Collect every child that changed state, without blocking
+    void reap() {
+        int wstatus;
+        struct rusage usage;
+        pid_t pid;
+        while ((pid = wait4(-1, &wstatus, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+            update(pid, wstatus, usage);
+        }
+    }
+
+    // Block until some child changes state. Returns false if there are none.
+    bool wait_any() {
+        int wstatus;
+        struct rusage usage;
+        pid_t pid;
+        while ((pid = wait4(-1, &wstatus, WUNTRACED, &usage)) < 0) {
+            if (errno != EINTR) return false;
+        }
+        update(pid, wstatus, usage);
+        return true;
+    }
+
+    Job* find_pid(pid_t pid) {
+        for (auto& job : jobs) {
+            for (const auto& p : job->procs) {
+                if (p.pid == pid) return job.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // The job `fg`/`bg` act on by default: the most recent one
+    Job* current() {
+        return jobs.empty() ? nullptr : jobs.back().get();
+    }
+
+    // Job specs: %n, %%, %+, %-, %prefix, or a plain pid
+    Job* find(const std::string& spec) {
+        if (spec.empty()) return current();
+        if (spec[0] != '%') return find_pid(static_cast<pid_t>(atoi(spec.c_str())));
+        if (spec == "%" || spec == "%%" || spec == "%+") return current();
+        if (spec == "%-") return jobs.size() > 1 ? jobs[jobs.size() - 2].get() : nullptr;
+        if (spec.find_first_not_of("0123456789", 1) == std::string::npos) {
+            int id = atoi(spec.c_str() + 1);
+            for (auto& job : jobs) {
+                if (job->id == id) return job.get();
+            }
+            return nullptr;
+        }
+        for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
+            if ((*it)->command.compare(0, spec.size() - 1, spec, 1) == 0) return it->get();
+        }
+        return nullptr;
+    }
+
+    std::vector<Job*> background_jobs() {
+        std::vector<Job*> out;
+        for (auto& job : jobs) {
+            if (job->background) out.push_back(job.get());
+        }
+        return out;
+    }
+
+    void print(FILE* out, const Job& job) {
+        char buf[32];
+        char mark = &job == current() ? '+' : (jobs.size() > 1 && &job == jobs[jobs.size() - 2].get()) ? '-' : ' ';
+        fprintf(out, "[%d]%c  %-10s %8.1fs  %s%s\n", job.id, mark, state_name(job, buf, sizeof(buf)),
+                job.elapsed(), job.command.c_str(), job.state() == Job::State::Running ? " &" : "");
+    }
+
+    // `jobs` builtin
+    void list(FILE* out) {
+        for (auto& job : jobs) {
+            print(out, *job);
+            if (job->state() != Job::State::Running) job->notified = true;
+        }
+        prune();
+    }
+
+    // Report background jobs that finished or stopped since the last
+    // prompt, then forget the finished ones
+    void notify(FILE* out) {
+        for (auto& job : jobs) {
+            if (!job->notified && job->state() != Job::State::Running) {
+                print(out, *job);
+                job->notified = true;
+            }
+        }
+        prune();
+    }
+
+    // Drop finished jobs that were reported. A non-interactive shell never
+    // reports, so there the oldest finished jobs go once MAX_DONE is hit.
+    void prune() {
+        size_t done = 0;
+        for (const auto& job : jobs) {
+            if (job->state() == Job::State::Done) done++;
+        }
+        for (auto it = jobs.begin(); it != jobs.end();) {
+            if ((*it)->state() == Job::State::Done && ((*it)->notified || done > MAX_DONE)) {
+                it = jobs.erase(it);
+                done--;
+            } else {
+                ++it;
+            }
+        }
+    }
+};
+
+} // namespace Ash
+
+#endif // JOB_CONTROL_HPP
@@ -0,0 +1,122 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace Ash {
+
+// perf_event_open counters for one process and everything it forks
+// (inherit). Counters the kernel refuses -- no PMU in a VM, or
+// perf_event_paranoid too strict -- are simply unavailable.
+class PerfCounters {
+public:
+    enum Event { Cycles, Instructions, CacheMisses, ContextSwitches, PageFaults, NUM_EVENTS };
+
+    static const char* name(int event) {
+        static const char* names[NUM_EVENTS] = {
+            "cycles", "instructions", "cache-misses", "context-switches", "page-faults",
+        };
+        return names[event];
+    }
+
+private:
+    int fds[NUM_EVENTS];
+    uint64_t values[NUM_EVENTS] = {};
+
+    static int perf_event_open(struct perf_event_attr* attr, pid_t pid) {
+        return static_cast<int>(syscall(SYS_perf_event_open, attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+
+    static void describe(int event, struct perf_event_attr& attr) {
+        switch (event) {
+            case Cycles: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+            case Instructions: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+            case CacheMisses: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+            case ContextSwitches: attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES; break;
+            default: attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+        }
+    }
+
+public:
+    PerfCounters() {
+        for (int& fd : fds) fd = -1;
+    }
+
+    ~PerfCounters() { close_all(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Attach to `pid`, which must not have started the work to be measured
+    // yet. With `on_exec` the counters start at its next execve(); otherwise
+    // call enable(). Returns false if no counter could be opened.
+    bool open(pid_t pid, bool on_exec) {
+        bool any = false;
+        for (int e = 0; e < NUM_EVENTS; e++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            describe(e, attr);
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.enable_on_exec = on_exec;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            fds[e] = perf_event_open(&attr, pid);
+            // perf_event_paranoid >= 2 only allows user-space counting.
+            // A context switch always happens in the kernel, so it would
+            // read as zero there; leave it unavailable instead.
+            if (fds[e] < 0 && (errno == EACCES || errno == EPERM) && e != ContextSwitches) {
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fds[e] = perf_event_open(&attr, pid);
+            }
+            any = any || fds[e] >= 0;
+        }
+        return any;
+    }
+
+    void enable() {
+        for (int fd : fds) {
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // Read the final counts, scaled up if the PMU was multiplexed. Counters
+    // that can't be read become unavailable.
+    void collect() {
+        for (int e = 0; e < NUM_EVENTS; e++) {
+            if (fds[e] < 0) continue;
+            uint64_t data[3];
+            if (read(fds[e], data, sizeof(data)) != sizeof(data)) {
+                close(fds[e]);
+                fds[e] = -1;
+                continue;
+            }
+            values[e] = data[0];
+            if (data[2] > 0 && data[2] < data[1]) {
+                values[e] = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+            }
+        }
+    }
+
+    bool available(int event) const { return fds[event] >= 0; }
+    uint64_t value(int event) const { return values[event]; }
+
+    void close_all() {
+        for (int& fd : fds) {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+    }
+};
+
+} // namespace Ash
+
+#endif // PERF_COUNTERS_HPP
@@ -0,0 +1,390 @@
+#ifndef SCRIPT_CACHE_HPP
+#define SCRIPT_CACHE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "commandInterpreter.hpp"
+
+namespace Ash {
+
+// Compiled scripts are a pre-order encoding of the AST: one opcode byte
+// per node, varint counts and lengths, and strings stored inline so the
+// decoded AST can point straight into the mapped cache file.
+//
+//   file     := header program
+//   header   := "ASHC" u32:version i64:mtime_sec i64:mtime_nsec u64:size str:path
+//   list     := OP_LIST n:entries { u8:background n:pipelines { u8:connector pipeline } }
+//   pipeline := OP_PIPELINE u8:negate u8:profile n:commands { command }
+//   command  := OP_SIMPLE n:words { u8:plain str } redirs
+//             | OP_SUBSHELL list redirs
+//   redirs   := n:count { u8:op n:fd u8:flags str }
+enum Opcode : uint8_t {
+    OP_LIST = 0xA1,
+    OP_PIPELINE = 0xA2,
+    OP_SIMPLE = 0xA3,
+    OP_SUBSHELL = 0xA4,
+};
+
+class BytecodeWriter {
+private:
+    std::string out;
+
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            out += static_cast<char>((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        out += static_cast<char>(v);
+    }
+
+    void byte(uint8_t b) { out += static_cast<char>(b); }
+
+    void str(std::string_view s) {
+        varint(s.size());
+        out.append(s);
+    }
+
+    void raw(const void* p, size_t n) { out.append(static_cast<const char*>(p), n); }
+
+    void redirects(const Redirect* r) {
+        size_t n = 0;
+        for (const Redirect* it = r; it; it = it->next) n++;
+        varint(n);
+        for (; r; r = r->next) {
+            byte(static_cast<uint8_t>(r->op));
+            varint(r->fd);
+            byte((r->quoted ? 1 : 0) | (r->strip_tabs ? 2 : 0));
+            str(r->target);
+        }
+    }
+
+    void command(const Command* cmd) {
+        if (cmd->subshell) {
+            byte(OP_SUBSHELL);
+            list(cmd->subshell);
+        } else {
+            byte(OP_SIMPLE);
+            size_t n = 0;
+            for (const Word* w = cmd->words; w; w = w->next) n++;
+            varint(n);
+            for (const Word* w = cmd->words; w; w = w->next) {
+                byte(w->plain);
+                str(w->text);
+            }
+        }
+        redirects(cmd->redirects);
+    }
+
+    void pipeline(const Pipeline* p) {
+        byte(OP_PIPELINE);
+        byte(p->negate);
+        byte(static_cast<uint8_t>(p->profile));
+        varint(p->length);
+        for (const Command* c = p->commands; c; c = c->next) command(c);
+    }
+
+    void list(const List* l) {
+        byte(OP_LIST);
+        size_t n = 0;
+        for (const ListEntry* e = l->entries; e; e = e->next) n++;
+        varint(n);
+        for (const ListEntry* e = l->entries; e; e = e->next) {
+            byte(e->background);
+            size_t chain = 0;
+            for (const AndOr* a = e->chain; a; a = a->next) chain++;
+            varint(chain);
+            for (const AndOr* a = e->chain; a; a = a->next) {
+                byte(static_cast<uint8_t>(a->connector));
+                pipeline(a->pipeline);
+            }
+        }
+    }
+
+public:
+    static const uint32_t VERSION = 3;
+
+    std::string compile(const List* program, const std::string& path, const struct stat& st) {
+        out.clear();
+        out.append("ASHC", 4);
+        uint32_t version = VERSION;
+        int64_t sec = st.st_mtim.tv_sec;
+        int64_t nsec = st.st_mtim.tv_nsec;
+        uint64_t size = st.st_size;
+        raw(&version, sizeof(version));
+        raw(&sec, sizeof(sec));
+        raw(&nsec, sizeof(nsec));
+        raw(&size, sizeof(size));
+        str(path);
+        list(program);
+        return out;
+    }
+};
+
+// Decodes a compiled script back into an AST in `arena`. Every check
+// failure throws, so a truncated or stale cache file is simply a miss.
+class BytecodeReader {
+private:
+    Arena& arena;
+    const char* p;
+    const char* end;
+
+    struct Corrupt {};
+
+    void need(size_t n) {
+        if (static_cast<size_t>(end - p) < n) throw Corrupt{};
+    }
+
+    uint8_t byte() {
+        need(1);
+        return static_cast<uint8_t>(*p++);
+    }
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw Corrupt{};
+    }
+
+    std::string_view str() {
+        uint64_t n = varint();
+        need(n);
+        std::string_view s(p, n);
+        p += n;
+        return s;
+    }
+
+    template <typename T>
+    T raw() {
+        T v;
+        need(sizeof(v));
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+
+    void expect(uint8_t op) {
+        if (byte() != op) throw Corrupt{};
+    }
+
+    Redirect* redirects() {
+        Redirect* head = nullptr;
+        Redirect** tail = &head;
+        for (uint64_t n = varint(); n > 0; n--) {
+            Redirect* r = arena.make<Redirect>();
+            uint8_t op = byte();
+            if (op > static_cast<uint8_t>(RedirOp::HereString)) throw Corrupt{};
+            r->op = static_cast<RedirOp>(op);
+            r->fd = static_cast<int>(varint());
+            uint8_t flags = byte();
+            r->quoted = flags & 1;
+            r->strip_tabs = flags & 2;
+            r->target = str();
+            *tail = r;
+            tail = &r->next;
+        }
+        return head;
+    }
+
+    Command* command() {
+        Command* cmd = arena.make<Command>();
+        uint8_t op = byte();
+        if (op == OP_SUBSHELL) {
+            cmd->subshell = list();
+        } else if (op == OP_SIMPLE) {
+            Word** tail = &cmd->words;
+            for (uint64_t n = varint(); n > 0; n--) {
+                bool plain = byte();
+                *tail = arena.make<Word>(Word{str(), plain, nullptr});
+                tail = &(*tail)->next;
+            }
+        } else {
+            throw Corrupt{};
+        }
+        cmd->redirects = redirects();
+        return cmd;
+    }
+
+    Pipeline* pipeline() {
+        expect(OP_PIPELINE);
+        Pipeline* pl = arena.make<Pipeline>();
+        pl->negate = byte();
+        uint8_t profile = byte();
+        if (profile > static_cast<uint8_t>(Profile::Json)) throw Corrupt{};
+        pl->profile = static_cast<Profile>(profile);
+        pl->length = varint();
+        if (pl->length == 0) throw Corrupt{};
+        Command** tail = &pl->commands;
+        for (size_t i = 0; i < pl->length; i++) {
+            *tail = command();
+            tail = &(*tail)->next;
+        }
+        return pl;
+    }
+
+    List* list() {
+        expect(OP_LIST);
+        List* l = arena.make<List>();
+        ListEntry** tail = &l->entries;
+        for (uint64_t n = varint(); n > 0; n--) {
+            ListEntry* e = arena.make<ListEntry>();
+            e->background = byte();
+            AndOr** chain = &e->chain;
+            for (uint64_t m = varint(); m > 0; m--) {
+                uint8_t connector = byte();
+                if (connector > static_cast<uint8_t>(Connector::Or)) throw Corrupt{};
+                *chain = arena.make<AndOr>();
+                (*chain)->connector = static_cast<Connector>(connector);
+                (*chain)->pipeline = pipeline();
+                chain = &(*chain)->next;
+            }
+            if (!e->chain) throw Corrupt{};
+            *tail = e;
+            tail = &e->next;
+        }
+        return l;
+    }
+
+public:
+    BytecodeReader(Arena& a, std::string_view data) : arena(a), p(data.data()), end(data.data() + data.size()) {}
+
+    // Returns nullptr unless the header matches `path` and `st` exactly
+    List* load(const std::string& path, const struct stat& st) {
+        try {
+            need(4);
+            if (memcmp(p, "ASHC", 4) != 0) return nullptr;
+            p += 4;
+            if (raw<uint32_t>() != BytecodeWriter::VERSION) return nullptr;
+            if (raw<int64_t>() != st.st_mtim.tv_sec) return nullptr;
+            if (raw<int64_t>() != st.st_mtim.tv_nsec) return nullptr;
+            if (raw<uint64_t>() != static_cast<uint64_t>(st.st_size)) return nullptr;
+            if (str() != path) return nullptr;
+            List* program = list();
+            return p == end ? program : nullptr;
+        } catch (const Corrupt&) {
+            return nullptr;
+        }
+    }
+};
+
+// On-disk cache of compiled scripts, one file per script path under
+// $ASH_CACHE_DIR (default $XDG_CACHE_HOME/ash or ~/.cache/ash). Entries
+// are keyed by path and validated against the script's mtime and size.
+class ScriptCache {
+private:
+    std::string dir;
+    void* map = MAP_FAILED;
+    size_t map_size = 0;
+
+    static uint64_t fnv1a(const std::string& s) {
+        uint64_t h = 1469598103934665603ULL;
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    std::string entry_path(const std::string& script) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.ashc", static_cast<unsigned long long>(fnv1a(script)));
+        return dir + name;
+    }
+
+    // mkdir -p; ~/.cache itself is often missing in a fresh chroot
+    void make_dir() const {
+        for (size_t slash = dir.find('/', 1); slash != std::string::npos; slash = dir.find('/', slash + 1)) {
+            mkdir(dir.substr(0, slash).c_str(), 0700);
+        }
+        mkdir(dir.c_str(), 0700);
+    }
+
+    void unmap() {
+        if (map != MAP_FAILED) munmap(map, map_size);
+        map = MAP_FAILED;
+        map_size = 0;
+    }
+
+public:
+    // Empty or relative values are ignored, as the XDG spec asks
+    ScriptCache() {
+        auto usable = [](const char* value) { return value && value[0] == '/'; };
+        if (const char* env = getenv("ASH_CACHE_DIR"); usable(env)) {
+            dir = env;
+        } else if (const char* xdg = getenv("XDG_CACHE_HOME"); usable(xdg)) {
+            dir = std::string(xdg) + "/ash";
+        } else if (const char* home = getenv("HOME"); usable(home)) {
+            dir = std::string(home) + "/.cache/ash";
+        }
+    }
+
+    ~ScriptCache() { unmap(); }
+
+    ScriptCache(const ScriptCache&) = delete;
+    ScriptCache& operator=(const ScriptCache&) = delete;
+
+    // Map the cached program for `script`. The returned AST points into
+    // the mapping and stays valid until the cache is destroyed.
+    List* load(const std::string& script, const struct stat& st, Arena& arena) {
+        if (dir.empty()) return nullptr;
+        int fd = open(entry_path(script).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+
+        struct stat cst;
+        if (fstat(fd, &cst) != 0 || cst.st_size == 0) {
+            close(fd);
+            return nullptr;
+        }
+        unmap();
+        map_size = cst.st_size;
+        map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return nullptr;
+
+        BytecodeReader reader(arena, std::string_view(static_cast<const char*>(map), map_size));
+        List* program = reader.load(script, st);
+        if (!program) unmap();
+        return program;
+    }
+
+    // Best effort: a cache that can't be written just means re-parsing
+    void store(const std::string& script, const struct stat& st, const List* program) {
+        if (dir.empty()) return;
+        make_dir();
+
+        std::string data = BytecodeWriter().compile(program, script, st);
+        std::string target = entry_path(script);
+        std::string tmp = target + ".XXXXXX";
+        int fd = mkstemp(&tmp[0]);
+        if (fd < 0) return;
+
+        const char* p = data.data();
+        size_t left = data.size();
+        while (left > 0) {
+            ssize_t n = write(fd, p, left);
+            if (n <= 0) break;
+            p += n;
+            left -= n;
+        }
+        close(fd);
+
+        // rename() keeps concurrent readers from seeing a partial file
+        if (left != 0 || rename(tmp.c_str(), target.c_str()) != 0) unlink(tmp.c_str());
+    }
+};
+
+} // namespace Ash
+
+#endif // SCRIPT_CACHE_HPP
@@ -0,0 +1,181 @@
+// ashbench: startup benchmark for ash
+//
+//   ashbench [-n iterations] [path/to/ash]
+//
+// Measures time-to-first-exec: from posix_spawn() of the shell until the
+// first command it runs has been exec'ed. That command is ashbench itself
+// in marker mode, which writes CLOCK_MONOTONIC to fd 3 and exits. The same
+// marker spawned directly gives the baseline; the difference is what the
+// shell adds to every `sh -c` a program runs.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <climits>
+#include <sys/wait.h>
+
+extern char** environ;
+
+static const char* MARK_ARG = "--mark";
+
+static int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+class StartupBench {
+private:
+    std::string ash;
+    std::string marker;
+    std::string script;
+    int iterations;
+
+    // Spawn argv with the marker pipe on fd 3 and, if given, `input` on
+    // stdin. Returns nanoseconds until the marker reported in, or -1.
+    int64_t run_once(const std::vector<std::string>& args, const std::string& input) {
+        int mark[2];
+        int in[2] = {-1, -1};
+        if (pipe2(mark, O_CLOEXEC) != 0) return -1;
+        if (!input.empty() && pipe2(in, O_CLOEXEC) != 0) {
+            close(mark[0]);
+            close(mark[1]);
+            return -1;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, mark[1], 3);
+        if (in[0] >= 0) posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+
+        std::vector<char*> argv;
+        for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        pid_t pid;
+        int64_t start = now_ns();
+        int err = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(mark[1]);
+        if (in[0] >= 0) close(in[0]);
+        if (err != 0) {
+            fprintf(stderr, "ashbench: %s: %s\n", argv[0], strerror(err));
+            close(mark[0]);
+            if (in[1] >= 0) close(in[1]);
+            return -1;
+        }
+        if (in[1] >= 0) {
+            ssize_t n = write(in[1], input.data(), input.size());
+            (void)n;
+            close(in[1]);
+        }
+
+        int64_t stamp = -1;
+        if (read(mark[0], &stamp, sizeof(stamp)) != sizeof(stamp)) stamp = -1;
+        close(mark[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        return stamp < 0 ? -1 : stamp - start;
+    }
+
+    void report(const char* label, std::vector<int64_t> samples, double baseline) {
+        if (samples.empty()) {
+            printf("%-10s failed\n", label);
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        double sum = 0;
+        for (int64_t s : samples) sum += s;
+        double median = samples[samples.size() / 2] / 1000.0;
+        printf("%-10s min %8.1f  median %8.1f  p90 %8.1f  mean %8.1f us",
+               label, samples.front() / 1000.0, median,
+               samples[samples.size() * 9 / 10] / 1000.0, sum / samples.size() / 1000.0);
+        if (baseline > 0) printf("  (+%.1f us over direct exec)", median - baseline);
+        printf("\n");
+    }
+
+    std::vector<int64_t> measure(const std::vector<std::string>& args, const std::string& input = "") {
+        std::vector<int64_t> samples;
+        for (int i = 0; i < iterations; i++) {
+            int64_t t = run_once(args, input);
+            if (t >= 0) samples.push_back(t);
+        }
+        return samples;
+    }
+
+public:
+    StartupBench(const std::string& shell, const std::string& self, int n)
+        : ash(shell), marker(self), iterations(n) {}
+
+    ~StartupBench() {
+        if (!script.empty()) unlink(script.c_str());
+    }
+
+    bool prepare() {
+        const char* tmpdir = getenv("TMPDIR");
+        script = std::string(tmpdir ? tmpdir : "/tmp") + "/ashbench.XXXXXX";
+        int fd = mkstemp(&script[0]);
+        if (fd < 0) {
+            perror("ashbench: mkstemp");
+            script.clear();
+            return false;
+        }
+        std::string body = marker + " " + MARK_ARG + "\n";
+        bool ok = write(fd, body.data(), body.size()) == static_cast<ssize_t>(body.size());
+        close(fd);
+        return ok;
+    }
+
+    void run() {
+        std::string command = marker + " " + MARK_ARG;
+        printf("%s, %d iterations\n", ash.c_str(), iterations);
+
+        auto direct = measure({marker, MARK_ARG});
+        report("direct", direct, 0);
+        std::sort(direct.begin(), direct.end());
+        double baseline = direct.empty() ? 0 : direct[direct.size() / 2] / 1000.0;
+
+        report("ash -c", measure({ash, "-c", command}), baseline);
+        report("stdin", measure({ash}, command + "\n"), baseline);
+        report("script", measure({ash, script}), baseline);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc == 2 && strcmp(argv[1], MARK_ARG) == 0) {
+        int64_t stamp = now_ns();
+        ssize_t n = write(3, &stamp, sizeof(stamp));
+        _exit(n == sizeof(stamp) ? 0 : 1);
+    }
+
+    int iterations = 200;
+    std::string ash = "bin/ash";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            ash = argv[i];
+        }
+    }
+    if (iterations < 1) iterations = 1;
+
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        perror("ashbench: /proc/self/exe");
+        return 1;
+    }
+    self[len] = '\0';
+
+    StartupBench bench(ash, self, iterations);
+    if (!bench.prepare()) return 1;
+    bench.run();
+    return 0;
+}